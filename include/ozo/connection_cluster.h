@@ -0,0 +1,218 @@
+#pragma once
+
+#include <ozo/connection_info.h>
+#include <ozo/connection_pool.h>
+#include <ozo/impl/connection_cluster.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ozo {
+
+/**
+ * @brief Connection cluster configuration
+ * @ingroup group-connection-types
+ */
+struct connection_cluster_config {
+    time_traits::duration role_check_interval = std::chrono::seconds(10); //!< time a learned role of a host is trusted, after that it is checked again
+    time_traits::duration role_check_timeout = std::chrono::seconds(1); //!< time-out of a role check request
+    time_traits::duration latency_decay = std::chrono::seconds(10); //!< time constant of the moving average of a host latency
+};
+
+/**
+ * @brief Session consistency token
+ * @ingroup group-connection-types
+ *
+ * The token is held by a caller for a user session and keeps the WAL position of the last write of the session,
+ * see `ozo::track_write_lsn()`. A connection requested from `ozo::connection_cluster` with the token is provided
+ * to a replica only if the replica has replayed that position, otherwise to the primary. So the session reads its
+ * own writes while the rest of reads go to replicas. Copies of the token share the position, the token is
+ * thread-safe.
+ */
+class session_token {
+public:
+    session_token() : lsn_(std::make_shared<std::atomic<std::uint64_t>>(0)) {}
+
+    /**
+     * @brief WAL position of the last write of the session in bytes, 0 if there was no write
+     */
+    std::uint64_t lsn() const noexcept { return lsn_->load(std::memory_order_acquire); }
+
+    /**
+     * @brief Moves the position of the session forward, a position less than the current one is ignored
+     */
+    void advance(std::uint64_t lsn) noexcept {
+        auto current = lsn_->load(std::memory_order_relaxed);
+        while (current < lsn && !lsn_->compare_exchange_weak(current, lsn, std::memory_order_acq_rel)) {}
+    }
+
+private:
+    std::shared_ptr<std::atomic<std::uint64_t>> lsn_;
+};
+
+/**
+ * @brief Records the WAL position of a write in the session token
+ * @ingroup group-connection-functions
+ * @relates ozo::session_token
+ *
+ * Requests `pg_current_wal_lsn()` via the connection to the primary after a write is committed and advances
+ * the session token with it.
+ *
+ * @param conn --- #Connection to the primary the write was made via.
+ * @param session --- session token.
+ * @param timeout --- request time-out.
+ * @param token --- operation #CompletionToken.
+ * @return deduced from #CompletionToken.
+ */
+template <typename Connection, typename CompletionToken>
+inline auto track_write_lsn(Connection&& conn, const session_token& session, const time_traits::duration& timeout,
+        CompletionToken&& token) {
+    using signature_t = void (error_code, std::decay_t<Connection>);
+    async_completion<CompletionToken, signature_t> init(token);
+
+    impl::async_request_lsn(std::forward<Connection>(conn),
+        make_query("SELECT (pg_current_wal_lsn() - '0/0'::pg_lsn)::bigint"), timeout,
+        [session = session_token {session}, handler = std::move(init.completion_handler)] (error_code ec, auto conn, std::uint64_t lsn) mutable {
+            if (!ec) {
+                session.advance(lsn);
+            }
+            handler(std::move(ec), std::move(conn));
+        });
+
+    return init.result.get();
+}
+
+/**
+ * @brief Connection source of several database hosts with role routing
+ * @ingroup group-connection-types
+ *
+ * `connection_cluster` is a #ConnectionSource over several #ConnectionSource objects, one per database host,
+ * usually `ozo::connection_pool` objects. A connection is requested for `ozo::target_role`: the primary,
+ * any replica or a replica if there is an available one and the primary otherwise, e.g.
+ * `ozo::make_connector(cluster, io, ozo::target_role::replica, timeouts)`. Additional arguments after the role
+ * are passed to the host's source.
+ *
+ * Roles of hosts are learned on connection via `SELECT pg_is_in_recovery()` and trusted for
+ * `connection_cluster_config::role_check_interval`, so a failover is noticed in that time. Only one probe of a host
+ * is in flight, other requests which get a connection to the host meanwhile wait for its result. Hosts of the requested
+ * role are balanced with the power of two choices: the less loaded one of two random hosts is tried first. The load
+ * of a host is the number of its connections in use and the moving average of the time to get a connection from
+ * the host, i.e. of the connect and the first response of the host, see `connection_cluster_config::latency_decay`.
+ * The time a connection is held by its user is not taken into account. So a slow replica, e.g. busy with vacuum
+ * or with a cold cache, gets fewer requests. Connections in use are counted only for sources which report the
+ * connection return, like `ozo::connection_pool`. A host which fails to provide a connection is skipped and its
+ * role is checked again on next connection. Errors of the source which are not caused by the host, i.e. a time-out
+ * or an overflow of the pool queue, `ozo::error::pool_overloaded` and `ozo::error::circuit_open`, only skip the host
+ * for the request. If no host of the role is available
+ * the handler is invoked with the last error or `ozo::error::no_suitable_host`.
+ *
+ * A connection may be requested with `ozo::session_token` instead of the role for reads of a session which must see
+ * its own writes, e.g. `ozo::make_connector(cluster, io, session, timeouts)`. Then a replica is chosen only if it has
+ * replayed the last write of the session, which is checked via `pg_last_wal_replay_lsn()` unless it is already known,
+ * and the primary is chosen otherwise.
+ *
+ * @tparam Source --- #ConnectionSource of a host.
+ * @tparam RoleProbe --- role check operation, `impl::recovery_status_probe` by default.
+ */
+template <typename Source, typename RoleProbe = impl::recovery_status_probe>
+class connection_cluster {
+public:
+    /**
+     * @brief Type of connection is the same as of the host's source
+     *
+     * Type is used to model #ConnectionSource
+     */
+    using connection_type = ozo::connection_type<Source>;
+
+    /**
+     * @brief Construct a new connection cluster object
+     *
+     * @param hosts --- #ConnectionSource objects of hosts.
+     * @param config --- cluster configuration.
+     * @param probe --- role check operation.
+     */
+    connection_cluster(std::vector<Source> hosts, const connection_cluster_config& config = connection_cluster_config {},
+            RoleProbe probe = RoleProbe {})
+    : impl_(std::make_shared<state_type>(std::move(hosts), std::move(probe),
+            config.role_check_interval, config.role_check_timeout, config.latency_decay)) {}
+
+    /**
+     * @brief Provides connection to the primary host
+     *
+     * @param io --- `io_context` for the connection IO.
+     * @param handler --- #Handler.
+     */
+    template <typename Handler>
+    void operator ()(io_context& io, Handler&& handler) const {
+        (*this)(io, std::forward<Handler>(handler), target_role::primary);
+    }
+
+    /**
+     * @brief Provides connection to a host of the given role
+     *
+     * @param io --- `io_context` for the connection IO.
+     * @param handler --- #Handler.
+     * @param role --- role of a host to connect to.
+     * @param args --- additional arguments of the host's source, e.g. `ozo::connection_pool_timeouts`.
+     */
+    template <typename Handler, typename ... Args>
+    void operator ()(io_context& io, Handler&& handler, target_role role, const Args& ... args) const {
+        impl::async_cluster_connect(impl_, io, role, std::forward<Handler>(handler), args ...);
+    }
+
+    /**
+     * @brief Provides connection to a replica which has replayed writes of the session, or to the primary
+     *
+     * @param io --- `io_context` for the connection IO.
+     * @param handler --- #Handler.
+     * @param session --- session token.
+     * @param args --- additional arguments of the host's source, e.g. `ozo::connection_pool_timeouts`.
+     */
+    template <typename Handler, typename ... Args>
+    void operator ()(io_context& io, Handler&& handler, const session_token& session, const Args& ... args) const {
+        impl::async_session_connect(impl_, io, session.lsn(), std::forward<Handler>(handler), args ...);
+    }
+
+    /**
+     * @brief Number of hosts in the cluster
+     */
+    std::size_t size() const noexcept { return impl_->hosts.size(); }
+
+private:
+    using state_type = impl::cluster_state<Source, RoleProbe>;
+
+    std::shared_ptr<state_type> impl_;
+};
+
+/**
+ * @brief Connection cluster construct helper function
+ * @ingroup group-connection-functions
+ * @relates ozo::connection_cluster
+ *
+ * Creates `ozo::connection_cluster` with `ozo::connection_pool` per host.
+ *
+ * @param conn_strs --- connection strings of hosts.
+ * @param pool_config --- configuration of a pool of each host.
+ * @param config --- cluster configuration.
+ * @param OidMap --- oid map for user defined types.
+ * @return `ozo::connection_cluster` specialization.
+ */
+template <typename OidMap = empty_oid_map>
+inline auto make_connection_cluster(const std::vector<std::string>& conn_strs,
+        const connection_pool_config& pool_config,
+        const connection_cluster_config& config = connection_cluster_config {},
+        const OidMap& = OidMap {}) {
+    using pool_type = connection_pool<connection_info<OidMap>>;
+    std::vector<pool_type> pools;
+    pools.reserve(conn_strs.size());
+    for (const auto& conn_str : conn_strs) {
+        pools.emplace_back(connection_info<OidMap> {conn_str}, pool_config);
+    }
+    return connection_cluster<pool_type> {std::move(pools), config};
+}
+
+} // namespace ozo
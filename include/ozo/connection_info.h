@@ -3,6 +3,7 @@
 #include <ozo/connector.h>
 #include <ozo/connection.h>
 #include <ozo/impl/async_connect.h>
+#include <ozo/impl/async_resolve.h>
 #include <ozo/ext/std/shared_ptr.h>
 
 #include <chrono>
@@ -16,6 +17,20 @@ namespace ozo {
  *
  * This type is a basic #ConnectionSource implementation. This source allows to establish connection
  * via [connection string](https://www.postgresql.org/docs/9.4/static/libpq-connect.html#LIBPQ-CONNSTRING) specified.
+ *
+ * OIDs of the custom types from the `OidMap` are requested from a database by the first established connection
+ * and stored in the process-wide cache for the connection string, so next connections to the same database get them
+ * without a query. If a custom type is recreated in the database the cache becomes stale and requests fail with
+ * `ozo::error::oid_type_mismatch`, call `invalidate_oid_map()` in that case to request OIDs again.
+ *
+ * A host name from the connection string is resolved asynchronously and passed to libpq via the `hostaddr`
+ * parameter, so the `io_context` thread is not blocked by the name resolution. All the resolved addresses are passed,
+ * so libpq tries them in order if one is unreachable. The resolving is a part of the connection time-out.
+ *
+ * The connection string is parsed once on construction, connections are established with the parsed parameters,
+ * so libpq does not parse the string on every connect. If the string is invalid, `conninfo_error()` returns
+ * the parsing error and connections fail with the error of libpq. Parameters may be overridden with `with_param()`.
+ *
  * @tparam OidMap --- oids map type which defines user types are used within this connection.
  * @tparam Statistics --- statistics type which defines statistics is collected for this connection.
  */
@@ -23,7 +38,8 @@ template <
     typename OidMap = empty_oid_map,
     typename Statistics = no_statistics>
 class connection_info {
-    std::string conn_str;
+    impl::parsed_conninfo conninfo;
+    std::string target;
     Statistics statistics;
 
 public:
@@ -44,7 +60,32 @@ public:
      * @param statistics --- statistics are being used for connections.
      */
     connection_info(std::string conn_str, Statistics statistics = Statistics{})
-            : conn_str(std::move(conn_str)), statistics(std::move(statistics)) {
+            : conninfo(conn_str), target(std::move(conn_str)), statistics(std::move(statistics)) {
+    }
+
+    /**
+     * @brief Error of the connection string parsing
+     *
+     * @return libpq error message if the connection string is invalid, an empty string otherwise.
+     */
+    const std::string& conninfo_error() const noexcept { return conninfo.error(); }
+
+    /**
+     * @brief Copy of the connection information with a connection parameter overridden
+     *
+     * The parsed parameters are shared with the original object, so it is cheap to make a copy per connect,
+     * e.g. with `application_name` of a request or with `host` chosen by a balancer. Custom types OIDs are
+     * cached separately for the overridden parameters.
+     *
+     * @param keyword --- libpq connection parameter keyword.
+     * @param value --- value of the parameter.
+     * @return `ozo::connection_info` with the parameter overridden.
+     */
+    connection_info with_param(std::string keyword, std::string value) const {
+        auto result = *this;
+        impl::append_conninfo_param(result.target, keyword, value);
+        result.conninfo.set(std::move(keyword), std::move(value));
+        return result;
     }
 
     /**
@@ -60,12 +101,33 @@ public:
     template <typename Handler>
     void operator ()(io_context& io, Handler&& handler,
             time_traits::duration timeout = time_traits::duration::max()) const {
-        impl::async_connect(
-            conn_str,
-            timeout,
-            std::make_shared<connection>(io, statistics),
-            std::forward<Handler>(handler)
-        );
+        auto conn = std::make_shared<connection>(io, statistics);
+        impl::async_resolve_conninfo(io, conninfo, timeout,
+            [&io, conn, target = target, handler = std::forward<Handler>(handler)]
+            (error_code ec, impl::parsed_conninfo conninfo, time_traits::duration timeout) mutable {
+                if (ec) {
+                    set_error_context(conn, "error while resolving host");
+                    return asio::post(io, detail::bind(std::move(handler), std::move(ec), std::move(conn)));
+                }
+                impl::async_connect(
+                    std::move(conninfo),
+                    timeout,
+                    std::move(conn),
+                    impl::get_oid_map_cache<OidMap>(),
+                    std::move(target),
+                    std::move(handler)
+                );
+            });
+    }
+
+    /**
+     * @brief Drops cached OIDs of the custom types for the connection string
+     *
+     * Next established connection requests OIDs from a database again. Connections which are already established
+     * keep their OIDs, so they should be closed too.
+     */
+    void invalidate_oid_map() const {
+        impl::get_oid_map_cache<OidMap>().invalidate(target);
     }
 };
 
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <ozo/impl/connection_multiplexer.h>
+#include <ozo/request.h>
+
+#include <memory>
+
+namespace ozo {
+
+/**
+ * @brief Connection shared by concurrent requests
+ * @ingroup group-connection-types
+ *
+ * `connection_multiplexer` sends requests of many coroutines via a single connection of the underlying
+ * #ConnectionProvider, so they use a single database backend instead of a backend per request. Requests are
+ * queued in FIFO order and their handlers are invoked in the same order.
+ *
+ * If libpq supports pipeline mode (PostgreSQL 14 and later, unless `OZO_DISABLE_PIPELINING` is defined) requests
+ * are sent back to back without waiting for results of the previous ones, so the connection throughput is not
+ * limited by the round trip time. Each request is followed by a sync point, so a failed request does not affect
+ * the next ones. If the connection fails, all the requests sent via it fail, the connection is closed and a new
+ * one is requested from the underlying provider for the next request. Without pipeline mode requests are sent
+ * one by one, so the multiplexer only limits the number of backends.
+ *
+ * The request timeout covers both the wait in the queue and the query itself. The result of a query which has
+ * timed out is dropped. If such a query is the first one in the pipeline, results of the next ones can not be
+ * received before it completes, so the connection is closed, the requests sent via it fail with
+ * `boost::asio::error::connection_aborted` and the next request gets a new connection.
+ *
+ * The connection passed to a handler is shared by requests, it may be used to get the error message only.
+ * Transactions can not be performed via the multiplexer.
+ *
+ * Copies of the multiplexer share the connection and the queue, the multiplexer is thread-safe.
+ *
+ * @tparam Provider --- underlying #ConnectionProvider with `std::shared_ptr` connection type, e.g. `ozo::connector`
+ * of `ozo::connection_pool`.
+ */
+template <typename Provider>
+class connection_multiplexer {
+public:
+    /**
+     * @brief Type of connection passed to the handlers is the same as of the underlying provider
+     */
+    using connection_type = ozo::connection_type<Provider>;
+
+    /**
+     * @brief Construct a new connection multiplexer object
+     *
+     * @param io --- `io_context` the handlers and the timers are run via.
+     * @param provider --- underlying #ConnectionProvider.
+     * @param queue_capacity --- maximum number of requests which are queued or wait for results.
+     */
+    connection_multiplexer(io_context& io, Provider provider, std::size_t queue_capacity = 1024)
+    : impl_(std::make_shared<impl::multiplexer_state<Provider>>(io, std::move(provider), queue_capacity)) {}
+
+    /**
+     * @brief Queues the request, see `ozo::request()`
+     *
+     * @param query --- #Query or #QueryBuilder to perform.
+     * @param timeout --- request timeout including the wait in the queue.
+     * @param out --- output object like Iterator, Container or `ozo::result`.
+     * @param handler --- #Handler.
+     */
+    template <typename Query, typename Out, typename Handler>
+    void async_request(Query&& query, const time_traits::duration& timeout, Out out, Handler&& handler) const {
+        static_assert(ozo::Query<Query> || QueryBuilder<Query>, "is neither Query nor QueryBuilder");
+        impl_->request(std::forward<Query>(query), timeout, impl::make_async_request_out_handler(std::move(out)),
+            std::forward<Handler>(handler));
+    }
+
+    /**
+     * @brief Number of requests which are queued or wait for results
+     */
+    std::size_t waiting() const { return impl_->waiting(); }
+
+private:
+    std::shared_ptr<impl::multiplexer_state<Provider>> impl_;
+};
+
+/**
+ * @brief Connection multiplexer construct helper function
+ * @ingroup group-connection-functions
+ * @relates ozo::connection_multiplexer
+ *
+ * @param io --- `io_context` the handlers and the timers are run via.
+ * @param provider --- underlying #ConnectionProvider.
+ * @param queue_capacity --- maximum number of requests which are queued or wait for results.
+ * @return `ozo::connection_multiplexer` object.
+ */
+template <typename Provider>
+inline auto make_connection_multiplexer(io_context& io, Provider&& provider, std::size_t queue_capacity = 1024) {
+    static_assert(ConnectionProvider<Provider>, "is not a ConnectionProvider");
+    return connection_multiplexer<std::decay_t<Provider>> {io, std::forward<Provider>(provider), queue_capacity};
+}
+
+/**
+ * @brief Performs a request via the connection multiplexer
+ * @ingroup group-requests-functions
+ * @relates ozo::connection_multiplexer
+ *
+ * The same as `ozo::request()` for a #ConnectionProvider, but the request is queued and sent via the shared
+ * connection of the multiplexer.
+ *
+ * @param multiplexer --- `ozo::connection_multiplexer` to send the request via.
+ * @param query --- #Query or #QueryBuilder to perform.
+ * @param timeout --- request timeout including the wait in the queue.
+ * @param out --- output object like Iterator, Container or `ozo::result`.
+ * @param token --- operation #CompletionToken.
+ * @return deduced from #CompletionToken.
+ */
+template <typename P, typename Q, typename Out, typename CompletionToken>
+inline auto request(const connection_multiplexer<P>& multiplexer, Q&& query, const time_traits::duration& timeout,
+        Out out, CompletionToken&& token) {
+    using signature_t = void (error_code, connection_type<P>);
+    async_completion<CompletionToken, signature_t> init(token);
+
+    multiplexer.async_request(std::forward<Q>(query), timeout, std::move(out), init.completion_handler);
+
+    return init.result.get();
+}
+
+/**
+ * @brief Performs a request via the connection multiplexer without timeout
+ * @ingroup group-requests-functions
+ * @relates ozo::connection_multiplexer
+ */
+template <typename P, typename Q, typename Out, typename CompletionToken>
+inline auto request(const connection_multiplexer<P>& multiplexer, Q&& query, Out out, CompletionToken&& token) {
+    return request(multiplexer, std::forward<Q>(query), time_traits::duration::max(), std::move(out),
+        std::forward<CompletionToken>(token));
+}
+
+} // namespace ozo
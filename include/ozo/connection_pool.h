@@ -1,34 +1,35 @@
 #pragma once
 
+#include <ozo/connection_pool_config.h>
 #include <ozo/impl/connection_pool.h>
+#include <ozo/impl/pool_tasks.h>
 #include <ozo/connection_info.h>
 #include <ozo/asio.h>
 
 namespace ozo {
 
 /**
- * @brief Connection pool configuration
+ * @brief Timeouts for the ozo::get_connection() operation
  * @ingroup group-connection-types
  *
- * Configuration of the `ozo::connection_pool`, e.g. how many connection are in the pool,
- * how many queries can be in wait queue if all connections are used by another queries,
- * and how long to keep connection open.
+ * Time restrictions to get connection from the `ozo::connection_pool`
  */
-struct connection_pool_config {
-    std::size_t capacity = 10; //!< maximum number of stored connections
-    std::size_t queue_capacity = 128; //!< maximum number of queued requests to get available connection
-    time_traits::duration idle_timeout = std::chrono::seconds(60); //!< time interval to close connection after last usage
+struct connection_pool_timeouts {
+    time_traits::duration connect = std::chrono::seconds(10); //!< maximum time interval to establish connection with DBMS
+    time_traits::duration queue = std::chrono::seconds(10); //!< maximum time interval to wait for available connection handle in `conneciton_pool`
 };
 
 /**
- * @brief Timeouts for the ozo::get_connection() operation
+ * @brief Priority of a connection request
  * @ingroup group-connection-types
  *
- * Time restrictions to get connection from the `ozo::connection_pool`
+ * When all connections of `ozo::connection_pool` are busy, waiting requests get released connections
+ * in the order of priority, and in FIFO order within the same priority.
  */
-struct connection_pool_timeouts {
-    time_traits::duration connect = std::chrono::seconds(10); //!< maximum time interval to establish connection with DBMS
-    time_traits::duration queue = std::chrono::seconds(10); //!< maximum time interval to wait for available connection handle in `conneciton_pool`
+enum class connection_priority {
+    low, //!< e.g. background or batch jobs
+    normal, //!< default priority
+    high, //!< e.g. user-facing requests
 };
 
 /**
@@ -47,6 +48,54 @@ struct connection_pool_timeouts {
  * * If all connections are busy and there is no room to create a new one --- the request will be placed into the internal queue to wait for the free connection.
  *
  * The request may be limited by time via optional `connection_pool_timeouts` argument of the `connection_pool::operator()`.
+ * Queued requests are served in the order of optional `connection_priority` argument, so interactive requests may
+ * bypass batch ones, e.g. `ozo::make_connector(pool, io, timeouts, ozo::connection_priority::high)`.
+ *
+ * The pool may be split into several shards via `connection_pool_config::shards`. Each shard is owned by
+ * the `io_context` which requests a connection from it first, so connections are not rebound between
+ * `io_context`s and threads do not contend for a single pool. Each shard has its own queue of requests limited by
+ * the shard capacity, so the queue is not a point of contention either. A request is served by another shard only
+ * if the local one has no free slot and the other one has, otherwise it waits in the local queue. The socket of a connection is rebound only
+ * if it is provided to another `io_context` than the one it is bound to, successful rebinds are counted
+ * in `connection_pool_metrics::rebinds`.
+ *
+ * Connections may be limited in age via `connection_pool_config::lifespan`. A connection older than that is closed
+ * when it is returned to the pool and a replacement is opened in background. Each connection gets its own random
+ * part of `connection_pool_config::lifespan_jitter` subtracted, so connections opened at once are not closed at once.
+ *
+ * A connection taken from the pool is checked for liveness without a round trip to the server: if the server has
+ * closed it, e.g. on restart, a new connection is established instead. With `connection_pool_config::health_check_interval`
+ * idle connections are also checked periodically in background, and dead ones are replaced by new connections. The check
+ * takes only free slots of the queue, and closes connections which are not used for `connection_pool_config::idle_timeout`.
+ *
+ * The effective capacity of the pool may be adaptive via `connection_pool_config::min_capacity`. In this mode the
+ * number of connections in use is limited by an AIMD controller of each shard between its parts of `min_capacity`
+ * and `capacity`: the limit is
+ * decreased by 10% if connections are held much longer than usual, see `connection_pool_config::latency_tolerance`,
+ * and it is increased by one if requests wait in the queue while the latency is fine. So the pool does not overload
+ * the database when it gets slow.
+ *
+ * The queue may shed load via `connection_pool_config::queue_delay_target`. If every request waited in the queue
+ * longer than the target during `connection_pool_config::queue_delay_interval`, the queue is treated as overloaded:
+ * requests are served in LIFO order and a request which waits longer than the target fails fast with
+ * `ozo::error::pool_overloaded` instead of waiting for `connection_pool_timeouts::queue`. So under overload fresh
+ * requests still get connections in time while the rest fail fast, instead of all of them timing out.
+ *
+ * The pool may have a circuit breaker via `connection_pool_config::failure_threshold`. After that number of consecutive
+ * failures to connect or connections broken while in use, the breaker is opened and requests fail fast with
+ * `ozo::error::circuit_open` instead of waiting for the connect time-out of a host which is down. After
+ * `connection_pool_config::circuit_open_timeout` a single probe request is let through, its success closes the
+ * breaker and its failure opens it again. The state of the breaker is reported in `connection_pool_metrics`.
+ *
+ * The session state of connections returned to the pool may be reset via `connection_pool_config::session_reset`.
+ * The reset is done asynchronously before the connection becomes available to other requests, and only if the session
+ * is known to be dirty: a transaction left open is rolled back, and with `session_reset_policy::discard_all` or
+ * `session_reset_policy::custom` the reset query is sent if a transaction was left open or the session was marked
+ * via `ozo::mark_session_dirty()`, e.g. after `SET`, temporary tables or `LISTEN`. A connection returned with a query
+ * in progress is closed. If a reset query fails the connection is closed too.
+ *
+ * To avoid connection latency on the first requests the pool may be prefilled with `connection_pool_config::min_idle`
+ * connections via `connection_pool::warm_up()`.
  *
  * `connection_pool` models #ConnectionSource concept itself using underlying #ConnectionSource.
  *
@@ -73,8 +122,16 @@ public:
      * @param config --- pool configuration.
      */
     connection_pool(Source source, const connection_pool_config& config)
-    : impl_(config.capacity, config.queue_capacity, config.idle_timeout),
-      source_(std::move(source)) {}
+    : impl_(std::make_shared<impl::pool_state<Source>>(std::move(source), config)) {}
+
+    connection_pool(connection_pool&&) = default;
+    connection_pool& operator =(connection_pool&&) = default;
+
+    ~connection_pool() {
+        if (impl_) {
+            impl::stop_pool_periodic_tasks(*impl_);
+        }
+    }
 
     /**
      * @brief Type of connection depends on connection type of Source
@@ -87,37 +144,160 @@ public:
      * @brief Provides connection is binded to the given `io_context`
      *
      * In case of success --- the handler will be invoked as operation succeeded.
-     * In case of connection fail, queue timeout or queue full --- the handler will be invoked as operation failed.
+     * In case of connection fail, queue timeout, queue full or open circuit breaker --- the handler will be invoked
+     * as operation failed.
      *
      * @param io --- `io_context` for the connection IO.
      * @param handler --- #Handler.
      * @param timeouts --- connection acquisition related time-outs
+     * @param priority --- priority of the request in the queue
      */
     template <typename Handler>
     void operator ()(io_context& io, Handler&& handler,
-            const connection_pool_timeouts& timeouts = connection_pool_timeouts {}) {
-        impl_.get_auto_recycle(
+            const connection_pool_timeouts& timeouts = connection_pool_timeouts {},
+            connection_priority priority = connection_priority::normal) {
+        const auto shard = impl_->shards.local(std::addressof(io));
+        impl::start_health_check(impl_, io, shard, timeouts.connect, timeouts.queue);
+        auto wrapped = impl::wrap_pooled_connection_handler(
             io,
-            impl::wrap_pooled_connection_handler(
-                io,
-                make_connector(source_, io, timeouts.connect),
-                std::forward<Handler>(handler)
-            ),
-            timeouts.queue
+            make_connector(impl_->source, io, timeouts.connect),
+            std::forward<Handler>(handler),
+            impl::make_connection_lifespan(impl_, io, timeouts.connect, timeouts.queue),
+            impl::pool_metrics_ptr(impl_, std::addressof(impl_->metrics)),
+            impl_->breaker.enabled()
+                ? impl::circuit_breaker_ptr(impl_, std::addressof(impl_->breaker))
+                : impl::circuit_breaker_ptr {},
+            impl::recycling_allocator<void> {
+                std::shared_ptr<impl::block_cache>(impl_, std::addressof(impl_->connections_memory[shard]))
+            },
+            typename connection_type::element_type::session_reset_type {
+                impl::session_reset_config_ptr(impl_, std::addressof(impl_->session_reset)),
+                std::addressof(impl::run_session_reset<typename impl::connection_pool<Source>::handle>)
+            },
+            impl_->unchecked_idle_time()
         );
+        if (!impl_->breaker.allow()) {
+            return asio::post(io, [wrapped = std::move(wrapped)] () mutable {
+                wrapped(error_code {error::circuit_open}, typename impl::connection_pool<Source>::handle {});
+            });
+        }
+        auto [slot, slot_shard] = impl::try_enter_any_shard(impl_, shard);
+        if (!slot.empty()) {
+            wrapped.slot_ = std::move(slot);
+            return impl_->shards[slot_shard].get_auto_recycle(io, std::move(wrapped), timeouts.queue);
+        }
+        impl_->queues[shard].enter(
+            impl::shard_queue(impl_, shard),
+            io,
+            static_cast<std::size_t>(priority),
+            timeouts.queue,
+            [state = impl_, &io, shard, wrapped = std::move(wrapped), queue_timeout = timeouts.queue]
+                    (error_code ec, impl::pool_slot slot) mutable {
+                if (ec) {
+                    return wrapped(std::move(ec), typename impl::connection_pool<Source>::handle {});
+                }
+                wrapped.slot_ = std::move(slot);
+                state->shards[shard].get_auto_recycle(io, std::move(wrapped), queue_timeout);
+            }
+        );
+    }
+
+    /**
+     * @brief Provides connection is binded to the given `io_context` with the given priority
+     *
+     * @param io --- `io_context` for the connection IO.
+     * @param handler --- #Handler.
+     * @param priority --- priority of the request in the queue
+     */
+    template <typename Handler>
+    void operator ()(io_context& io, Handler&& handler, connection_priority priority) {
+        (*this)(io, std::forward<Handler>(handler), connection_pool_timeouts {}, priority);
     }
 
+    /**
+     * @brief Opens connections of the pool in advance
+     *
+     * Opens `connection_pool_config::min_idle` connections of the shard owned by the given `io_context`
+     * in parallel. The handler is invoked when all of them are established, with the first error if any
+     * of them failed. If `connection_pool_config::idle_timeout` is finite, the pool keeps at least
+     * `min_idle` connections of the shard open in background by refreshing them every half of the timeout
+     * until the pool is destroyed. Connections are opened only within free slots of the pool queue and while
+     * the circuit breaker is closed, the handler is invoked with `ozo::error::circuit_open` otherwise.
+     *
+     * @note The pool must outlive the operation.
+     *
+     * @param io --- `io_context` for the connections IO.
+     * @param token --- operation #CompletionToken with `void(ozo::error_code)` signature.
+     * @param timeouts --- connection acquisition related time-outs
+     * @return deduced from #CompletionToken.
+     */
+    template <typename CompletionToken>
+    auto warm_up(io_context& io, CompletionToken&& token,
+            const connection_pool_timeouts& timeouts = connection_pool_timeouts {}) {
+        using signature_t = void (error_code);
+        async_completion<CompletionToken, signature_t> init(token);
+
+        impl::async_warm_up(impl_, io, timeouts.connect, timeouts.queue, init.completion_handler);
+
+        return init.result.get();
+    }
+
+    /**
+     * @brief Metrics of connection requests to the pool
+     *
+     * Returns a snapshot of wait, connect and hold time histograms and event counters. Only requests
+     * via `connection_pool::operator()` are accounted, connections opened in background are not.
+     * Counters and histograms are read without locking of the pool.
+     */
+    connection_pool_metrics metrics() const {
+        auto result = impl_->metrics.snapshot();
+        result.capacity_limit = 0;
+        for (const auto& queue : impl_->queues) {
+            result.capacity_limit += queue.limit();
+        }
+        result.circuit = impl_->breaker.state();
+        result.circuit_trips = impl_->breaker.trips();
+        result.circuit_rejections = impl_->breaker.rejections();
+        return result;
+    }
+
+    /**
+     * @brief Statistics of the pool summed up over all the shards
+     */
     auto stats() const {
-        return impl_.stats();
+        const auto& shards = impl_->shards;
+        auto result = shards[0].stats();
+        for (std::size_t i = 1; i != shards.size(); ++i) {
+            const auto shard = shards[i].stats();
+            result.size += shard.size;
+            result.available += shard.available;
+            result.used += shard.used;
+            result.queue_size += shard.queue_size;
+        }
+        return result;
     }
 
 private:
-    impl::connection_pool<Source> impl_;
-    Source source_;
+    std::shared_ptr<impl::pool_state<Source>> impl_;
 };
 
 static_assert(ConnectionProvider<connector<connection_pool<connection_info<>>>>, "is not a ConnectionProvider");
 
+/**
+ * @brief Marks the session of a pooled connection as dirty
+ * @ingroup group-connection-functions
+ *
+ * The session state of the connection, e.g. parameters changed via `SET`, temporary tables or `LISTEN`
+ * registrations, is reset with the query of `connection_pool_config::session_reset` policy when the connection
+ * is returned to the pool. Without the mark only a transaction left open is treated as a dirty session.
+ *
+ * @param conn --- connection of `ozo::connection_pool`.
+ */
+template <typename Source>
+inline void mark_session_dirty(const impl::pooled_connection_ptr<Source>& conn) noexcept {
+    conn->session_dirty_ = true;
+}
+
 template <typename T>
 struct is_connection_pool : std::false_type {};
 
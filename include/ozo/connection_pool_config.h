@@ -0,0 +1,49 @@
+#pragma once
+
+#include <ozo/time_traits.h>
+
+#include <cstddef>
+#include <string>
+
+namespace ozo {
+
+/**
+ * @brief Reset of the session state of a connection returned to the pool
+ * @ingroup group-connection-types
+ */
+enum class session_reset_policy {
+    none, //!< connections are returned to the pool as is
+    check, //!< a transaction left open is rolled back, a connection with a query in progress is closed
+    discard_all, //!< as `check`, and `DISCARD ALL` is sent if the session is dirty
+    custom, //!< as `check`, and `connection_pool_config::session_reset_query` is sent if the session is dirty
+};
+
+/**
+ * @brief Connection pool configuration
+ * @ingroup group-connection-types
+ *
+ * Configuration of the `ozo::connection_pool`, e.g. how many connection are in the pool,
+ * how many queries can be in wait queue if all connections are used by another queries,
+ * and how long to keep connection open.
+ */
+struct connection_pool_config {
+    std::size_t capacity = 10; //!< maximum number of stored connections
+    std::size_t queue_capacity = 128; //!< maximum number of queued requests to get available connection
+    time_traits::duration idle_timeout = std::chrono::seconds(60); //!< time interval to close connection after last usage
+    std::size_t shards = 1; //!< number of pool shards, each of them is owned by an `io_context`, capacities are split between shards
+    std::size_t min_idle = 0; //!< minimum number of idle connections to be kept open after `connection_pool::warm_up()`, split between shards
+    time_traits::duration lifespan = time_traits::duration::max(); //!< maximum age of a connection, it is closed when returned to the pool after that
+    time_traits::duration lifespan_jitter = time_traits::duration::zero(); //!< maximum random part subtracted from the lifespan of each connection
+    time_traits::duration health_check_interval = time_traits::duration::max(); //!< interval of background liveness checks of idle connections, disabled by default; a connection idle for less time is not checked when acquired
+    std::size_t min_capacity = 0; //!< minimum effective capacity, if it is less than `capacity` the effective capacity is adapted to the database latency
+    double latency_tolerance = 2.0; //!< ratio of a connection hold time to the baseline one which is treated as the database overload
+    std::size_t failure_threshold = 0; //!< number of consecutive connect or connection failures which opens the circuit breaker, 0 disables it
+    time_traits::duration circuit_open_timeout = std::chrono::seconds(5); //!< time the circuit breaker stays open before a probe request
+    time_traits::duration queue_delay_target = time_traits::duration::max(); //!< acceptable queue wait time, if it is exceeded during `queue_delay_interval` the queue sheds load, disabled by default
+    time_traits::duration queue_delay_interval = std::chrono::milliseconds(100); //!< interval the queue wait time is checked over for the load shedding
+    session_reset_policy session_reset = session_reset_policy::none; //!< how the session state of a connection returned to the pool is reset
+    std::string session_reset_query; //!< query to reset the session state with `session_reset_policy::custom`
+    time_traits::duration session_reset_timeout = std::chrono::seconds(1); //!< time-out of each session reset query, the connection is closed if it is exceeded
+};
+
+} // namespace ozo
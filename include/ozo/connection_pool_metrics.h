@@ -0,0 +1,144 @@
+#pragma once
+
+#include <ozo/time_traits.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace ozo {
+
+/**
+ * @brief Histogram of durations
+ * @ingroup group-connection-types
+ *
+ * Durations are counted by buckets with exponential bounds: bucket `i` counts durations which are less than
+ * `upper_bound(i)` and not less than `upper_bound(i - 1)`. The last bucket counts all the rest durations.
+ */
+struct connection_pool_histogram {
+    static constexpr std::size_t buckets_count = 32;
+
+    std::array<std::uint64_t, buckets_count> buckets {}; //!< number of durations per bucket
+    std::uint64_t count = 0; //!< total number of durations
+    time_traits::duration sum = time_traits::duration::zero(); //!< sum of all durations
+
+    /**
+     * @brief Upper bound of the bucket, `1us * 2^i`, the last bucket has no bound
+     */
+    static constexpr time_traits::duration upper_bound(std::size_t i) noexcept {
+        return i + 1 < buckets_count
+            ? time_traits::duration(std::chrono::microseconds(std::int64_t(1) << i))
+            : time_traits::duration::max();
+    }
+
+    /**
+     * @brief Index of the bucket for the duration
+     */
+    static constexpr std::size_t bucket(time_traits::duration value) noexcept {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(value).count();
+        std::size_t i = 0;
+        for (auto v = us; v > 0 && i + 1 < buckets_count; v >>= 1) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+/**
+ * @brief State of the circuit breaker of the connection pool
+ * @ingroup group-connection-types
+ */
+enum class circuit_state {
+    closed, //!< connections are requested as usual
+    open, //!< requests fail fast with `ozo::error::circuit_open`
+    half_open, //!< a single probe request is let through to check the database host
+};
+
+/**
+ * @brief Metrics of the connection pool
+ * @ingroup group-connection-types
+ *
+ * Snapshot of counters and histograms of `ozo::connection_pool` events. The metrics are collected with
+ * atomic counters, so taking of the snapshot does not lock the pool. Counters are monotonic, use a difference
+ * between two snapshots to get a rate.
+ */
+struct connection_pool_metrics {
+    std::uint64_t acquisitions = 0; //!< number of connections provided by the pool
+    std::uint64_t queue_overflows = 0; //!< number of requests rejected because the queue was full
+    std::uint64_t queue_timeouts = 0; //!< number of requests which were not provided with a connection in time
+    std::uint64_t queue_sheds = 0; //!< number of requests failed fast by the overloaded queue
+    std::uint64_t connect_errors = 0; //!< number of failed attempts to establish a new connection
+    std::uint64_t rebinds = 0; //!< number of idle connections provided to another `io_context` than they were bound to
+    std::uint64_t session_resets = 0; //!< number of returned connections with the session state reset
+    connection_pool_histogram wait_time; //!< time to get a connection handle from the pool including the queue wait
+    connection_pool_histogram connect_time; //!< time to establish a new connection
+    connection_pool_histogram hold_time; //!< time a connection is held by a user before it is returned to the pool
+    std::size_t capacity_limit = 0; //!< current effective capacity of the pool
+    circuit_state circuit = circuit_state::closed; //!< current state of the circuit breaker
+    std::uint64_t circuit_trips = 0; //!< number of times the circuit breaker was opened
+    std::uint64_t circuit_rejections = 0; //!< number of requests failed fast by the open circuit breaker
+};
+
+namespace impl {
+
+class atomic_histogram {
+public:
+    void add(time_traits::duration value) noexcept {
+        buckets_[connection_pool_histogram::bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value.count(), std::memory_order_relaxed);
+    }
+
+    connection_pool_histogram snapshot() const noexcept {
+        connection_pool_histogram result;
+        for (std::size_t i = 0; i != result.buckets.size(); ++i) {
+            result.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        result.count = count_.load(std::memory_order_relaxed);
+        result.sum = time_traits::duration(sum_.load(std::memory_order_relaxed));
+        return result;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, connection_pool_histogram::buckets_count> buckets_ {};
+    std::atomic<std::uint64_t> count_ {0};
+    std::atomic<time_traits::duration::rep> sum_ {0};
+};
+
+struct pool_metrics {
+    std::atomic<std::uint64_t> acquisitions {0};
+    std::atomic<std::uint64_t> queue_overflows {0};
+    std::atomic<std::uint64_t> queue_timeouts {0};
+    std::atomic<std::uint64_t> queue_sheds {0};
+    std::atomic<std::uint64_t> connect_errors {0};
+    std::atomic<std::uint64_t> rebinds {0};
+    std::atomic<std::uint64_t> session_resets {0};
+    atomic_histogram wait_time;
+    atomic_histogram connect_time;
+    atomic_histogram hold_time;
+
+    static void increment(std::atomic<std::uint64_t>& counter) noexcept {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    connection_pool_metrics snapshot() const noexcept {
+        connection_pool_metrics result;
+        result.acquisitions = acquisitions.load(std::memory_order_relaxed);
+        result.queue_overflows = queue_overflows.load(std::memory_order_relaxed);
+        result.queue_timeouts = queue_timeouts.load(std::memory_order_relaxed);
+        result.queue_sheds = queue_sheds.load(std::memory_order_relaxed);
+        result.connect_errors = connect_errors.load(std::memory_order_relaxed);
+        result.rebinds = rebinds.load(std::memory_order_relaxed);
+        result.session_resets = session_resets.load(std::memory_order_relaxed);
+        result.wait_time = wait_time.snapshot();
+        result.connect_time = connect_time.snapshot();
+        result.hold_time = hold_time.snapshot();
+        return result;
+    }
+};
+
+using pool_metrics_ptr = std::shared_ptr<pool_metrics>;
+
+} // namespace impl
+} // namespace ozo
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ozo/core/concept.h>
+#include <ozo/detail/uses_allocator.h>
 #include <type_traits>
 #include <memory>
 
@@ -107,8 +108,8 @@ template <typename T, typename = std::void_t<>>
 struct allocate_nullable_impl {
     static_assert(Emplaceable<T>, "default implementation uses emplace() method");
     template <typename Alloc>
-    static void apply(T& out, const Alloc&) {
-        out.emplace();
+    static void apply(T& out, const Alloc& a) {
+        detail::emplace_with_allocator(out, a);
     }
 };
 
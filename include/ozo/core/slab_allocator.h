@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace ozo {
+
+namespace detail {
+
+/**
+* Monotonic memory arena which allocates memory by big slabs and
+* releases it all at once on destruction.
+*/
+class slab_arena {
+public:
+    explicit slab_arena(std::size_t slab_size) : slab_size_(slab_size) {}
+
+    slab_arena(const slab_arena&) = delete;
+    slab_arena& operator = (const slab_arena&) = delete;
+
+    ~slab_arena() {
+        for (auto slab : slabs_) {
+            ::operator delete(slab);
+        }
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment) {
+        if (alignment > alignof(std::max_align_t)) {
+            throw std::bad_alloc();
+        }
+
+        const auto padding = (alignment - reinterpret_cast<std::uintptr_t>(pos_) % alignment) % alignment;
+        if (size + padding <= left_) {
+            const auto result = pos_ + padding;
+            pos_ = result + size;
+            left_ -= size + padding;
+            return result;
+        }
+
+        // Big blocks get a dedicated slab to not waste the current one
+        if (size > slab_size_ / 2) {
+            return new_slab(size);
+        }
+
+        pos_ = new_slab(slab_size_);
+        left_ = slab_size_;
+        return allocate(size, alignment);
+    }
+
+private:
+    char* new_slab(std::size_t size) {
+        slabs_.reserve(slabs_.size() + 1);
+        auto slab = static_cast<char*>(::operator new(size));
+        slabs_.push_back(slab);
+        return slab;
+    }
+
+    std::size_t slab_size_;
+    std::vector<char*> slabs_;
+    char* pos_ = nullptr;
+    std::size_t left_ = 0;
+};
+
+} // namespace detail
+
+/**
+ * @brief Allocator which places objects into shared memory slabs
+ * @ingroup group-core-types
+ *
+ * The allocator is intended to be passed into `ozo::recv_result()` to allocate
+ * pointer nullables like `std::shared_ptr` or `boost::shared_ptr` for a whole
+ * result from a few big memory slabs instead of an allocation per value.
+ *
+ * All copies of the allocator share the same arena. Memory is never released
+ * on deallocation, the arena frees all the slabs once the last copy of the
+ * allocator is destroyed. Since `std::allocate_shared()` stores a copy of
+ * the allocator in the control block, the memory stays valid while any of
+ * shared pointers allocated with it exists.
+ *
+ * @note Allocation is not thread-safe, so the allocator should not be shared
+ * between concurrent decoding operations. Deallocation is safe from any thread.
+ *
+ * ### Example
+ *
+ * @code
+std::vector<std::tuple<std::int64_t, std::shared_ptr<std::string>>> rows;
+ozo::recv_result(result, oid_map, std::back_inserter(rows), ozo::slab_allocator<char>{});
+ * @endcode
+ *
+ * @tparam T --- type of object to allocate
+ */
+template <typename T>
+class slab_allocator {
+public:
+    using value_type = T;
+
+    static constexpr std::size_t default_slab_size = 16 * 1024;
+
+    /**
+     * @brief Construct a new allocator with a new arena
+     *
+     * @param slab_size --- size of a memory slab in bytes
+     */
+    explicit slab_allocator(std::size_t slab_size = default_slab_size)
+        : arena_(std::make_shared<detail::slab_arena>(slab_size)) {}
+
+    template <typename U>
+    slab_allocator(const slab_allocator<U>& other) noexcept : arena_(other.arena_) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept {}
+
+    template <typename U>
+    bool operator == (const slab_allocator<U>& rhs) const noexcept {
+        return arena_ == rhs.arena_;
+    }
+
+    template <typename U>
+    bool operator != (const slab_allocator<U>& rhs) const noexcept {
+        return !(*this == rhs);
+    }
+
+private:
+    template <typename>
+    friend class slab_allocator;
+
+    std::shared_ptr<detail::slab_arena> arena_;
+};
+
+} // namespace ozo
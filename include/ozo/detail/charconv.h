@@ -0,0 +1,116 @@
+#pragma once
+
+#include <ozo/core/concept.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define OZO_HAS_FLOATING_POINT_FROM_CHARS
+#else
+#include <locale.h>
+#include <stdlib.h>
+#if __has_include(<xlocale.h>)
+#include <xlocale.h>
+#endif
+#endif
+
+namespace ozo::detail {
+
+/**
+* Allocation-free and locale-independent text to number conversion
+* with the same contract as std::from_chars. It is used to parse text
+* format values of query results. Own implementation of integers parsing
+* is used since <charconv> is not available with all supported standard
+* libraries. Floating point values are parsed with std::from_chars if the
+* standard library provides it, and with strtod_l() in the "C" locale
+* otherwise.
+*/
+struct from_chars_result {
+    const char* ptr;
+    std::errc ec;
+};
+
+template <typename T>
+inline Require<Integral<T>, from_chars_result> from_chars(const char* first, const char* last, T& value) noexcept {
+    using unsigned_type = std::make_unsigned_t<T>;
+
+    auto i = first;
+    bool negative = false;
+    if constexpr (std::is_signed_v<T>) {
+        if (i != last && *i == '-') {
+            negative = true;
+            ++i;
+        }
+    }
+
+    const unsigned_type limit = negative
+        ? unsigned_type(std::numeric_limits<T>::max()) + 1u
+        : unsigned_type(std::numeric_limits<T>::max());
+
+    unsigned_type result = 0;
+    const auto digits_begin = i;
+    for (; i != last && *i >= '0' && *i <= '9'; ++i) {
+        const unsigned_type digit = unsigned_type(*i - '0');
+        if (result > (limit - digit) / 10u) {
+            return {first, std::errc::result_out_of_range};
+        }
+        result = result * 10u + digit;
+    }
+
+    if (i == digits_begin) {
+        return {first, std::errc::invalid_argument};
+    }
+
+    value = negative ? T(~result + 1u) : T(result);
+    return {i, std::errc{}};
+}
+
+#if defined(OZO_HAS_FLOATING_POINT_FROM_CHARS)
+
+template <typename T>
+inline Require<FloatingPoint<T>, from_chars_result> from_chars(const char* first, const char* last, T& value) noexcept {
+    const auto result = std::from_chars(first, last, value);
+    return {result.ptr, result.ec};
+}
+
+#else
+
+// strtod() follows LC_NUMERIC, so the "C" locale is passed explicitly.
+inline locale_t c_numeric_locale() noexcept {
+    static const locale_t locale = newlocale(LC_NUMERIC_MASK, "C", locale_t(0));
+    return locale;
+}
+
+template <typename T>
+inline Require<FloatingPoint<T>, from_chars_result> from_chars(const char* first, const char* last, T& value) noexcept {
+    // PostgreSQL never sends float values longer than that, so a
+    // stack buffer is enough to get a null-terminated string for strtod.
+    std::array<char, 64> buf;
+    const auto size = std::size_t(last - first);
+    if (size == 0 || size >= buf.size()) {
+        return {first, std::errc::invalid_argument};
+    }
+    std::memcpy(buf.data(), first, size);
+    buf[size] = '\0';
+
+    char* end = nullptr;
+    const auto result = strtod_l(buf.data(), &end, c_numeric_locale());
+    if (end == buf.data()) {
+        return {first, std::errc::invalid_argument};
+    }
+    value = static_cast<T>(result);
+    return {first + (end - buf.data()), std::errc{}};
+}
+
+#endif
+
+} // namespace ozo::detail
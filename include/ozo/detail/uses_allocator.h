@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+
+namespace ozo::detail {
+
+/**
+* Constructs an object via uses-allocator construction if the type
+* supports the allocator, e.g. a string or a tuple of strings with
+* a polymorphic allocator. Otherwise the object is value-initialized.
+*/
+template <typename T, typename Alloc>
+inline T make_with_allocator(const Alloc& alloc) {
+    if constexpr (!std::uses_allocator_v<T, Alloc>) {
+        return T{};
+    } else if constexpr (std::is_constructible_v<T, std::allocator_arg_t, const Alloc&>) {
+        return T(std::allocator_arg, alloc);
+    } else {
+        return T(alloc);
+    }
+}
+
+template <typename T, typename Alloc, typename = std::void_t<>>
+struct emplaces_with_allocator : std::false_type {};
+
+template <typename T, typename Alloc>
+struct emplaces_with_allocator<T, Alloc, std::void_t<typename T::value_type>>
+    : std::uses_allocator<typename T::value_type, Alloc> {};
+
+/**
+* Emplaces a default object into an emplaceable nullable the same way
+* as `make_with_allocator()` constructs it.
+*/
+template <typename T, typename Alloc>
+inline void emplace_with_allocator(T& out, const Alloc& alloc) {
+    if constexpr (!emplaces_with_allocator<T, Alloc>::value) {
+        out.emplace();
+    } else if constexpr (std::is_constructible_v<typename T::value_type, std::allocator_arg_t, const Alloc&>) {
+        out.emplace(std::allocator_arg, alloc);
+    } else {
+        out.emplace(alloc);
+    }
+}
+
+} // namespace ozo::detail
@@ -85,6 +85,10 @@ enum code {
     result_status_empty_query, //!< the string sent to the server was empty
     result_status_bad_response, //!< the server's response was not understood
     oid_request_failed, //!< error during request oids from a database
+    no_suitable_host, //!< no host of the requested role is available
+    circuit_open, //!< the circuit breaker of the connection pool is open after consecutive failures
+    pool_overloaded, //!< the request is shed by the connection pool queue which is overloaded
+    pg_pipeline_failed, //!< libpq pipeline mode function failed
 };
 
 /**
@@ -439,6 +443,14 @@ public:
                 return "result_status_bad_response - the server's response was not understood";
             case oid_request_failed:
                 return "error during request oids from a database";
+            case no_suitable_host:
+                return "no host of the requested role is available";
+            case circuit_open:
+                return "circuit_open - connection pool circuit breaker is open after consecutive failures";
+            case pool_overloaded:
+                return "pool_overloaded - request is shed by the overloaded connection pool queue";
+            case pg_pipeline_failed:
+                return "pg_pipeline_failed - libpq pipeline mode function failed";
         }
         return "no message for value: " + std::to_string(value);
     }
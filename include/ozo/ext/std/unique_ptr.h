@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ozo/type_traits.h>
+#include <ozo/detail/uses_allocator.h>
 #include <memory>
 
 namespace ozo {
@@ -11,8 +12,8 @@ struct is_nullable<std::unique_ptr<T, Deleter>> : std::true_type {};
 template <typename T>
 struct allocate_nullable_impl<std::unique_ptr<T>> {
     template <typename Alloc>
-    static void apply(std::unique_ptr<T>& out, const Alloc&) {
-        out = std::make_unique<T>();
+    static void apply(std::unique_ptr<T>& out, const Alloc& a) {
+        out = std::make_unique<T>(detail::make_with_allocator<T>(a));
     }
 };
 
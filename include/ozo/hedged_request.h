@@ -0,0 +1,107 @@
+#pragma once
+
+#include <ozo/impl/hedged_request.h>
+
+#include <chrono>
+#include <memory>
+
+namespace ozo {
+
+/**
+ * @brief Hedged requests configuration
+ * @ingroup group-requests-types
+ */
+struct hedging_config {
+    double percentile = 0.95; //!< percentile of the request latency after which the request is hedged
+    time_traits::duration initial_delay = std::chrono::milliseconds(10); //!< delay before the hedge until the latency is learned
+    time_traits::duration min_delay = std::chrono::milliseconds(1); //!< lower bound of the delay before the hedge
+    std::size_t window = 1024; //!< number of the last requests the latency percentile is estimated over
+    std::size_t max_pending_cancels = 64; //!< cancels of lost copies waiting to be sent, further ones are dropped
+};
+
+/**
+ * @brief Hedging policy of idempotent requests
+ * @ingroup group-requests-types
+ *
+ * The policy keeps the latency statistics of successful requests, the delay before a hedge is the
+ * `hedging_config::percentile` of the latency. So only the slowest requests, e.g. the 5% with the default
+ * configuration, are sent twice. The policy should be shared by requests of the same kind; copies of the
+ * policy share the statistics. The policy is thread-safe.
+ *
+ * Queries of lost copies are cancelled by a single thread of the policy, which is started by the first cancel
+ * and joined when the last copy of the policy is destroyed. At most `hedging_config::max_pending_cancels` cancels
+ * wait to be sent, further ones are dropped since the connection of a lost copy is closed anyway.
+ */
+class hedging_policy {
+public:
+    /**
+     * @brief Construct a new hedging policy object
+     *
+     * @param config --- hedging configuration.
+     */
+    explicit hedging_policy(const hedging_config& config = hedging_config {})
+    : impl_(std::make_shared<impl::hedge_delay_estimator>(
+            config.percentile, config.initial_delay, config.min_delay, config.window)),
+      cancels_(std::make_shared<impl::query_cancel_queue>(config.max_pending_cancels)) {}
+
+    /**
+     * @brief Current delay before a hedge
+     */
+    time_traits::duration delay() const noexcept { return impl_->delay(); }
+
+    /**
+     * @brief Adds latency of a successful request to the statistics
+     */
+    void add(time_traits::duration latency) { impl_->add(latency); }
+
+    friend const std::shared_ptr<impl::hedge_delay_estimator>& get_impl(const hedging_policy& policy) noexcept {
+        return policy.impl_;
+    }
+
+    friend const std::shared_ptr<impl::query_cancel_queue>& get_cancel_queue(const hedging_policy& policy) noexcept {
+        return policy.cancels_;
+    }
+
+private:
+    std::shared_ptr<impl::hedge_delay_estimator> impl_;
+    std::shared_ptr<impl::query_cancel_queue> cancels_;
+};
+
+/**
+ * @brief Send idempotent request to a database with a hedge.
+ * @ingroup group-requests-functions
+ *
+ * The function works like `ozo::request` but if the request has not completed within `hedging_policy::delay()`
+ * it sends a second copy of the request via a new connection from the provider. The first successful copy wins,
+ * its result is provided via the out parameter and its connection is passed to the handler. The query of the other
+ * copy is cancelled on the server side with `PQcancel`, and the connection of that copy is closed when the copy
+ * completes, since the cancel request may reach the server after the query and hit the next one on the connection.
+ * A copy which has got its connection after the race is over does not send the query and returns the connection
+ * to its source untouched. If both copies fail the handler gets the error of the last one.
+ *
+ * The provider should give connections to different hosts, e.g. `ozo::connection_cluster` with replicas where
+ * the running request makes its host more loaded for the second choice. The query is sent twice, so it must have
+ * no side effects.
+ *
+ * @param io --- `io_context` for the hedge timer.
+ * @param provider --- #ConnectionProvider to get connections from.
+ * @param query --- #Query or `ozo::query_builder` object to send to a database.
+ * @param timeout --- time-out of each copy of the request.
+ * @param out --- output object like Iterator, #InsertIterator or `ozo::result`.
+ * @param policy --- hedging policy.
+ * @param token --- any valid of #CompletionToken.
+ * @return depends on #CompletionToken.
+ */
+template <typename P, typename Q, typename Out, typename CompletionToken, typename = Require<ConnectionProvider<P>>>
+inline auto hedged_request(io_context& io, P&& provider, Q&& query, const time_traits::duration& timeout, Out out,
+        const hedging_policy& policy, CompletionToken&& token) {
+    using signature_t = void (error_code, connection_type<P>);
+    async_completion<CompletionToken, signature_t> init(token);
+
+    impl::async_hedged_request(io, get_impl(policy), get_cancel_queue(policy), std::forward<P>(provider),
+            std::forward<Q>(query), timeout, std::move(out), init.completion_handler);
+
+    return init.result.get();
+}
+
+} // namespace ozo
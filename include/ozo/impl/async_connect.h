@@ -4,6 +4,7 @@
 #include <ozo/detail/post_handler.h>
 #include <ozo/detail/timeout_handler.h>
 #include <ozo/impl/io.h>
+#include <ozo/impl/oid_map_cache.h>
 #include <ozo/impl/request_oid_map.h>
 #include <ozo/time_traits.h>
 #include <ozo/connection.h>
@@ -68,7 +69,8 @@ template <typename Context>
 struct async_connect_op {
     Context context;
 
-    void perform(const std::string& conninfo, const time_traits::duration& timeout) {
+    template <typename ConnInfo>
+    void perform(const ConnInfo& conninfo, const time_traits::duration& timeout) {
         if (error_code ec = start_connection(get_connection(context), conninfo)) {
             return done(ec);
         }
@@ -141,27 +143,98 @@ inline void request_oid_map(Connection&& conn, Handler&& handler) {
         .perform(std::forward<Connection>(conn));
 }
 
+template <typename Handler>
+struct cache_oid_map_handler {
+    Handler handler_;
+    oid_map_cache_fill fill_;
+
+    template <typename Connection>
+    void operator() (error_code ec, Connection&& conn) {
+        if (!ec) try {
+            fill_.complete(get_oids(get_oid_map(conn)));
+        } catch (const std::exception&) {}
+        fill_.cancel();
+        handler_(std::move(ec), std::forward<Connection>(conn));
+    }
+};
+
+/**
+* Connection waiting for the pending fill of the OIDs cache. It is resumed
+* within the io_context of the connection.
+*/
+template <typename Handler, typename Connection>
+struct oid_map_cache_waiter : oid_map_cache::waiter {
+    Handler handler_;
+    Connection conn_;
+
+    oid_map_cache_waiter(Handler handler, Connection conn)
+    : handler_(std::move(handler)), conn_(std::move(conn)) {}
+
+    void resume() override {
+        auto& io = get_io_context(conn_);
+        asio::post(io, [handler = std::move(handler_), conn = std::move(conn_)] () mutable {
+            handler(error_code {}, std::move(conn));
+        });
+    }
+};
+
 template <typename Handler>
 struct request_oid_map_handler {
     Handler handler_;
+    oid_map_cache* cache_;
+    std::string target_;
 
     template <typename Connection>
     void operator() (error_code ec, Connection&& conn) {
         if (ec || empty(get_oid_map(conn))) {
-            handler_(std::move(ec), std::forward<Connection>(conn));
-        } else {
-            request_oid_map(std::forward<Connection>(conn), std::move(handler_));
+            return handler_(std::move(ec), std::forward<Connection>(conn));
+        }
+        if (!cache_) {
+            return request_oid_map(std::forward<Connection>(conn), std::move(handler_));
+        }
+
+        using waiter = oid_map_cache_waiter<request_oid_map_handler, std::decay_t<Connection>>;
+        oid_map_cache::oids_type oids;
+        const auto result = cache_->lookup(target_, oids, [&] {
+            return std::make_unique<waiter>(std::move(*this), std::forward<Connection>(conn));
+        });
+
+        switch (result) {
+            case oid_map_cache::lookup_result::wait:
+                return;
+            case oid_map_cache::lookup_result::fill: {
+                auto fill = oid_map_cache_fill {*cache_, target_};
+                return request_oid_map(std::forward<Connection>(conn),
+                    cache_oid_map_handler<Handler> {std::move(handler_), std::move(fill)});
+            }
+            case oid_map_cache::lookup_result::found:
+                break;
+        }
+
+        try {
+            set_oid_map(get_oid_map(conn), oids);
+        } catch (const std::exception&) {
+            cache_->invalidate(target_);
+            return (*this)(std::move(ec), std::forward<Connection>(conn));
         }
+        handler_(std::move(ec), std::forward<Connection>(conn));
     }
 };
 
 template <typename Handler>
 inline auto make_request_oid_map_handler(Handler&& handler) {
-    return request_oid_map_handler<std::decay_t<Handler>> {std::forward<Handler>(handler)};
+    return request_oid_map_handler<std::decay_t<Handler>> {std::forward<Handler>(handler), nullptr, std::string {}};
 }
 
-template <typename ConnectionT, typename Handler>
-inline Require<Connection<ConnectionT>> async_connect(std::string conninfo, const time_traits::duration& timeout,
+template <typename Handler>
+inline auto make_request_oid_map_handler(Handler&& handler, oid_map_cache& cache, std::string target) {
+    return request_oid_map_handler<std::decay_t<Handler>> {
+        std::forward<Handler>(handler), std::addressof(cache), std::move(target)
+    };
+}
+
+template <typename ConnInfo, typename ConnectionT, typename Handler>
+inline Require<Connection<ConnectionT>> async_connect(const ConnInfo& conninfo, const time_traits::duration& timeout,
         ConnectionT&& connection, Handler&& handler) {
     make_async_connect_op(
         make_connect_operation_context(
@@ -175,5 +248,28 @@ inline Require<Connection<ConnectionT>> async_connect(std::string conninfo, cons
     ).perform(conninfo, timeout);
 }
 
+/**
+* Same as above but OIDs of the custom types are taken from the cache if
+* they are already resolved for the target, otherwise resolved OIDs are
+* stored into the cache. Concurrent connects to the same target wait for
+* OIDs requested by the first of them.
+*/
+template <typename ConnInfo, typename ConnectionT, typename Handler>
+inline Require<Connection<ConnectionT>> async_connect(const ConnInfo& conninfo, const time_traits::duration& timeout,
+        ConnectionT&& connection, oid_map_cache& cache, std::string target, Handler&& handler) {
+    make_async_connect_op(
+        make_connect_operation_context(
+            std::forward<ConnectionT>(connection),
+            make_request_oid_map_handler(
+                detail::make_cancel_timer_handler(
+                    detail::make_post_handler(std::forward<Handler>(handler))
+                ),
+                cache,
+                std::move(target)
+            )
+        )
+    ).perform(conninfo, timeout);
+}
+
 } // namespace impl
 } // namespace ozo
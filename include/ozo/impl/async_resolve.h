@@ -0,0 +1,146 @@
+#pragma once
+
+#include <ozo/asio.h>
+#include <ozo/error.h>
+#include <ozo/time_traits.h>
+#include <ozo/detail/bind.h>
+#include <ozo/impl/conninfo.h>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Returns the host name from the connection parameters if it should be
+* resolved before the connection start, or an empty string otherwise.
+* Unix-domain socket paths, numeric addresses, multiple hosts and connection
+* parameters with `hostaddr` are left to libpq.
+*/
+inline std::string get_resolvable_host(const parsed_conninfo& conninfo) {
+    if (!conninfo.get("hostaddr").empty()) {
+        return {};
+    }
+
+    const std::string host(conninfo.get("host"));
+    if (host.empty() || host.front() == '/' || host.find(',') != std::string::npos) {
+        return {};
+    }
+
+    error_code ec;
+    asio::ip::make_address(host, ec);
+    return ec ? host : std::string {};
+}
+
+/**
+* Returns the connection parameters with the `hostaddr` parameter overridden
+* by the list of the host addresses, so libpq does not resolve the host name
+* itself but still uses it for authentication and SSL certificate verification.
+* The host is repeated for each address, so libpq tries all of them in order
+* like it does with the addresses it resolves itself.
+*/
+inline parsed_conninfo add_hostaddr(parsed_conninfo conninfo, const std::vector<std::string>& hostaddrs) {
+    const std::string host(conninfo.get("host"));
+    std::string hosts;
+    std::string addresses;
+    for (const auto& hostaddr : hostaddrs) {
+        if (!addresses.empty()) {
+            hosts += ',';
+            addresses += ',';
+        }
+        hosts += host;
+        addresses += hostaddr;
+    }
+    if (hostaddrs.size() > 1) {
+        conninfo.set("host", std::move(hosts));
+    }
+    conninfo.set("hostaddr", std::move(addresses));
+    return conninfo;
+}
+
+template <typename Handler>
+struct resolve_conninfo_context {
+    asio::ip::tcp::resolver resolver;
+    asio::steady_timer timer;
+    ozo::strand<io_context> strand;
+    parsed_conninfo conninfo;
+    time_traits::time_point deadline;
+    Handler handler;
+    bool done = false;
+
+    resolve_conninfo_context(io_context& io, parsed_conninfo conninfo, time_traits::time_point deadline, Handler handler)
+    : resolver(io), timer(io), strand(io), conninfo(std::move(conninfo)),
+      deadline(deadline), handler(std::move(handler)) {}
+};
+
+/**
+* Asynchronous resolving of the host name of the connection parameters. The
+* handler signature is `void(error_code, parsed_conninfo conninfo, time_traits::duration timeout)`
+* where `conninfo` contains the resolved `hostaddr` and `timeout` is the
+* remaining part of the given time-out.
+*/
+template <typename Handler>
+inline void async_resolve_conninfo(io_context& io, parsed_conninfo conninfo, const time_traits::duration& timeout,
+        Handler&& handler) {
+    auto host = get_resolvable_host(conninfo);
+    if (host.empty()) {
+        return handler(error_code {}, std::move(conninfo), timeout);
+    }
+
+    const auto now = time_traits::time_point::clock::now();
+    const auto deadline = timeout < time_traits::time_point::max() - now
+        ? now + timeout : time_traits::time_point::max();
+
+    using context_type = resolve_conninfo_context<std::decay_t<Handler>>;
+    auto ctx = std::make_shared<context_type>(io, std::move(conninfo), deadline, std::forward<Handler>(handler));
+
+    const auto finish = [] (const std::shared_ptr<context_type>& ctx, error_code ec, parsed_conninfo conninfo) {
+        if (std::exchange(ctx->done, true)) {
+            return;
+        }
+        ctx->timer.cancel();
+        ctx->resolver.cancel();
+        const auto left = ctx->deadline == time_traits::time_point::max()
+            ? time_traits::duration::max()
+            : std::max(ctx->deadline - time_traits::time_point::clock::now(), time_traits::duration::zero());
+        ctx->handler(std::move(ec), std::move(conninfo), left);
+    };
+
+    if (deadline != time_traits::time_point::max()) {
+        ctx->timer.expires_at(deadline);
+        ctx->timer.async_wait(asio::bind_executor(ctx->strand, [ctx, finish] (error_code ec) {
+            if (ec != asio::error::operation_aborted) {
+                finish(ctx, asio::error::timed_out, ctx->conninfo);
+            }
+        }));
+    }
+
+    ctx->resolver.async_resolve(host, std::string {}, asio::bind_executor(ctx->strand,
+        [ctx, finish] (error_code ec, asio::ip::tcp::resolver::results_type results) {
+            if (ec) {
+                return finish(ctx, ec, ctx->conninfo);
+            }
+            if (results.empty()) {
+                return finish(ctx, asio::error::host_not_found, ctx->conninfo);
+            }
+            std::vector<std::string> addresses;
+            for (const auto& entry : results) {
+                auto address = entry.endpoint().address().to_string();
+                if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+                    addresses.push_back(std::move(address));
+                }
+            }
+            finish(ctx, error_code {}, add_hostaddr(std::move(ctx->conninfo), addresses));
+        }));
+}
+
+} // namespace ozo::impl
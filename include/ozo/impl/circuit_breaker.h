@@ -0,0 +1,97 @@
+#pragma once
+
+#include <ozo/connection_pool_metrics.h>
+#include <ozo/time_traits.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace ozo::impl {
+
+/**
+* Circuit breaker of a database host. It is opened after the given number of
+* consecutive failures, so requests fail fast instead of waiting for
+* the connect time-out. After the open time-out it lets a single probe request
+* through (half-open state), and the result of the probe closes or opens it
+* again. A probe which reports nothing, e.g. timed out in the queue, is
+* replaced by another one after the open time-out. The threshold of zero
+* disables the breaker.
+*/
+class circuit_breaker {
+public:
+    circuit_breaker(std::size_t failure_threshold, time_traits::duration open_timeout)
+    : threshold_(failure_threshold), open_timeout_(open_timeout) {}
+
+    bool enabled() const noexcept { return threshold_ != 0; }
+
+    /**
+    * Returns true if a request may go to the host.
+    */
+    bool allow(time_traits::time_point now = time_traits::time_point::clock::now()) {
+        if (state_.load(std::memory_order_acquire) == circuit_state::closed) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto state = state_.load(std::memory_order_relaxed);
+        if (state == circuit_state::closed) {
+            return true;
+        }
+        if (now - changed_at_ < open_timeout_) {
+            pool_metrics::increment(rejections_);
+            return false;
+        }
+        if (state == circuit_state::open) {
+            state_.store(circuit_state::half_open, std::memory_order_release);
+        }
+        changed_at_ = now;
+        return true;
+    }
+
+    void success() {
+        if (state_.load(std::memory_order_acquire) == circuit_state::closed) {
+            failures_.store(0, std::memory_order_relaxed);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        failures_.store(0, std::memory_order_relaxed);
+        state_.store(circuit_state::closed, std::memory_order_release);
+    }
+
+    void failure(time_traits::time_point now = time_traits::time_point::clock::now()) {
+        if (!enabled()) {
+            return;
+        }
+        const auto failures = failures_.fetch_add(1, std::memory_order_relaxed) + 1;
+        const auto state = state_.load(std::memory_order_acquire);
+        if (state == circuit_state::closed && failures < threshold_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_.load(std::memory_order_relaxed) != circuit_state::open) {
+            state_.store(circuit_state::open, std::memory_order_release);
+            changed_at_ = now;
+            pool_metrics::increment(trips_);
+        }
+    }
+
+    circuit_state state() const noexcept { return state_.load(std::memory_order_acquire); }
+
+    std::uint64_t trips() const noexcept { return trips_.load(std::memory_order_relaxed); }
+
+    std::uint64_t rejections() const noexcept { return rejections_.load(std::memory_order_relaxed); }
+
+private:
+    const std::size_t threshold_;
+    const time_traits::duration open_timeout_;
+    std::mutex mutex_;
+    std::atomic<circuit_state> state_ {circuit_state::closed};
+    std::atomic<std::size_t> failures_ {0};
+    time_traits::time_point changed_at_;
+    std::atomic<std::uint64_t> trips_ {0};
+    std::atomic<std::uint64_t> rejections_ {0};
+};
+
+using circuit_breaker_ptr = std::shared_ptr<circuit_breaker>;
+
+} // namespace ozo::impl
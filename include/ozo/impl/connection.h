@@ -2,6 +2,7 @@
 
 #include <ozo/native_conn_handle.h>
 #include <ozo/asio.h>
+#include <ozo/time_traits.h>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/asio/steady_timer.hpp>
@@ -25,12 +26,18 @@ struct connection_impl {
     Statistics statistics_; // statistics metatypes to be defined - counter, duration, whatever?
     std::string error_context_;
     asio::steady_timer timer_;
+    time_traits::time_point expires_at_ = time_traits::time_point::max(); // time to close the connection by a pool
+    time_traits::time_point idle_since_ = time_traits::time_point::max(); // time the connection was returned to a pool
 };
 
 inline bool connection_status_bad(PGconn* handle) noexcept {
     return !handle || PQstatus(handle) == CONNECTION_BAD;
 }
 
+inline PGTransactionStatusType connection_transaction_status(PGconn* handle) noexcept {
+    return handle ? PQtransactionStatus(handle) : PQTRANS_UNKNOWN;
+}
+
 template <typename NativeHandleType>
 inline auto connection_error_message(NativeHandleType handle) {
     std::string_view v(PQerrorMessage(handle));
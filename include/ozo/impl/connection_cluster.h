@@ -0,0 +1,511 @@
+#pragma once
+
+#include <ozo/connection.h>
+#include <ozo/error.h>
+#include <ozo/query.h>
+#include <ozo/request.h>
+#include <ozo/shortcuts.h>
+#include <ozo/time_traits.h>
+#include <ozo/detail/bind.h>
+#include <ozo/impl/host_load.h>
+
+#include <yamail/resource_pool/async/pool.hpp>
+
+#include <boost/asio/post.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace ozo {
+
+/**
+ * @brief Role of a database host which a connection is requested for
+ * @ingroup group-connection-types
+ */
+enum class target_role {
+    primary, //!< read-write host only
+    replica, //!< any hot standby host only
+    prefer_replica, //!< hot standby host if any is available, primary otherwise
+};
+
+} // namespace ozo
+
+namespace ozo::impl {
+
+enum class host_role {
+    unknown,
+    primary,
+    standby,
+    unavailable,
+};
+
+/**
+* Requests a WAL position as a number of bytes via the connection. The handler
+* signature is `void(error_code, Connection, std::uint64_t lsn)`.
+*/
+template <typename Connection, typename Query, typename Handler>
+inline void async_request_lsn(Connection&& conn, Query&& query, const time_traits::duration& timeout,
+        Handler&& handler) {
+    auto rows = std::make_shared<std::vector<std::tuple<std::int64_t>>>();
+    request(std::forward<Connection>(conn), std::forward<Query>(query), timeout, into(*rows),
+        [rows, handler = std::forward<Handler>(handler)] (error_code ec, auto conn) mutable {
+            if (!ec && rows->size() != 1) {
+                ec = error::bad_result_process;
+            }
+            const auto lsn = ec ? std::uint64_t(0) : static_cast<std::uint64_t>(std::get<0>(rows->front()));
+            handler(std::move(ec), std::move(conn), lsn);
+        });
+}
+
+/**
+* Default way to learn a role of a host: `SELECT pg_is_in_recovery()` via
+* the connection to it. The handler signature is
+* `void(error_code, Connection, bool in_recovery)`. The WAL position replayed
+* by a standby is requested via `replay_lsn()`.
+*/
+struct recovery_status_probe {
+    template <typename Connection, typename Handler>
+    void operator ()(Connection&& conn, const time_traits::duration& timeout, Handler&& handler) const {
+        auto rows = std::make_shared<std::vector<std::tuple<bool>>>();
+        request(std::forward<Connection>(conn), make_query("SELECT pg_is_in_recovery()"), timeout, into(*rows),
+            [rows, handler = std::forward<Handler>(handler)] (error_code ec, auto conn) mutable {
+                if (!ec && rows->size() != 1) {
+                    ec = error::bad_result_process;
+                }
+                const bool in_recovery = !ec && std::get<0>(rows->front());
+                handler(std::move(ec), std::move(conn), in_recovery);
+            });
+    }
+
+    template <typename Connection, typename Handler>
+    void replay_lsn(Connection&& conn, const time_traits::duration& timeout, Handler&& handler) const {
+        async_request_lsn(std::forward<Connection>(conn),
+            make_query("SELECT COALESCE(pg_last_wal_replay_lsn() - '0/0'::pg_lsn, 0)::bigint"),
+            timeout, std::forward<Handler>(handler));
+    }
+};
+
+/**
+* Passes the host load to a connection which reports its return to the load,
+* see `pooled_connection`. The latency is recorded on the return. Returns
+* false for connections which do not report their return.
+*/
+template <typename T>
+inline auto track_host_load(std::shared_ptr<T>& conn, host_load_ptr load, time_traits::duration latency)
+        -> decltype(conn->host_load_ = std::move(load), conn->host_latency_ = latency, bool()) {
+    if (!conn) {
+        return false;
+    }
+    load->acquire();
+    conn->host_load_ = std::move(load);
+    conn->host_latency_ = latency;
+    return true;
+}
+
+template <typename Connection>
+inline bool track_host_load(Connection&, const host_load_ptr&, time_traits::duration) {
+    return false;
+}
+
+/**
+* Returns false for errors of a connection source which say nothing about
+* the host itself, e.g. a request which has timed out in the queue of a pool,
+* so the host is not marked as unavailable because of them.
+*/
+inline bool host_failure(const error_code& ec) noexcept {
+    return ec != yamail::resource_pool::error::get_resource_timeout
+        && ec != yamail::resource_pool::error::request_queue_overflow
+        && ec != error::pool_overloaded
+        && ec != error::circuit_open
+        && ec != asio::error::operation_aborted;
+}
+
+/**
+* Database host of a cluster with its role learned by the probe. The role is
+* trusted until the check interval elapses, then it is checked again on the
+* next connection to the host. A host which failed is unavailable for the
+* same interval, it is tried only after all the others. The last known WAL
+* position replayed by a standby only grows, so it is trusted without
+* an interval. Only one role probe of the host is in flight, requests which
+* get a connection to the host meanwhile wait for its result.
+*/
+template <typename Source>
+struct cluster_host {
+    Source source;
+    std::atomic<host_role> role {host_role::unknown};
+    std::atomic<time_traits::time_point::rep> checked_at {0};
+    std::atomic<std::uint64_t> replay_lsn {0};
+    host_load load;
+
+    cluster_host(Source source, time_traits::duration latency_decay)
+    : source(std::move(source)), load(latency_decay) {}
+
+    /**
+    * Returns true if the caller has to probe the role, otherwise the waiter
+    * is called as `waiter(role)` with the result of the probe in flight.
+    */
+    template <typename Waiter>
+    bool start_probe(Waiter&& waiter) {
+        std::lock_guard<std::mutex> lock(probe_mutex_);
+        if (!probing_) {
+            probing_ = true;
+            return true;
+        }
+        probe_waiters_.emplace_back(std::forward<Waiter>(waiter));
+        return false;
+    }
+
+    void finish_probe(host_role value, time_traits::time_point now) {
+        std::vector<std::function<void(host_role)>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(probe_mutex_);
+            set_role(value, now);
+            probing_ = false;
+            waiters.swap(probe_waiters_);
+        }
+        for (auto& waiter : waiters) {
+            waiter(value);
+        }
+    }
+
+    host_role known_role(time_traits::time_point now, time_traits::duration check_interval) const noexcept {
+        const auto value = role.load(std::memory_order_acquire);
+        if (value == host_role::unknown) {
+            return value;
+        }
+        const time_traits::time_point at {time_traits::duration(checked_at.load(std::memory_order_relaxed))};
+        return now - at < check_interval ? value : host_role::unknown;
+    }
+
+    void set_role(host_role value, time_traits::time_point now) noexcept {
+        checked_at.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        role.store(value, std::memory_order_release);
+    }
+
+    void advance_replay_lsn(std::uint64_t value) noexcept {
+        auto current = replay_lsn.load(std::memory_order_relaxed);
+        while (current < value && !replay_lsn.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    bool replayed(std::uint64_t lsn) const noexcept {
+        return replay_lsn.load(std::memory_order_relaxed) >= lsn;
+    }
+
+private:
+    std::mutex probe_mutex_;
+    bool probing_ = false;
+    std::vector<std::function<void(host_role)>> probe_waiters_;
+};
+
+inline bool accepts(target_role target, host_role role) noexcept {
+    switch (target) {
+        case target_role::primary:
+            return role == host_role::primary;
+        case target_role::replica:
+        case target_role::prefer_replica:
+            return role == host_role::standby;
+    }
+    return false;
+}
+
+/**
+* Rank of a host of the role for the target role, hosts are tried in order
+* of the rank, a negative rank excludes a host. Hosts with an unknown role
+* are tried first so their roles are learned once per check interval, and
+* for `prefer_replica` the primary is the last resort.
+*/
+inline int rank(target_role target, host_role role) noexcept {
+    switch (role) {
+        case host_role::unknown:
+            return 0;
+        case host_role::primary:
+            return target == target_role::primary ? 1 : target == target_role::prefer_replica ? 2 : -1;
+        case host_role::standby:
+            return target == target_role::primary ? -1 : 1;
+        case host_role::unavailable:
+            return 3;
+    }
+    return -1;
+}
+
+template <typename Source, typename RoleProbe>
+struct cluster_state {
+    std::vector<std::unique_ptr<cluster_host<Source>>> hosts;
+    RoleProbe probe;
+    time_traits::duration role_check_interval;
+    time_traits::duration role_check_timeout;
+    time_traits::duration latency_decay;
+    std::atomic<std::size_t> next {0};
+
+    cluster_state(std::vector<Source> sources, RoleProbe probe,
+            time_traits::duration role_check_interval, time_traits::duration role_check_timeout,
+            time_traits::duration latency_decay)
+    : probe(std::move(probe)), role_check_interval(role_check_interval), role_check_timeout(role_check_timeout),
+      latency_decay(latency_decay) {
+        hosts.reserve(sources.size());
+        for (auto& source : sources) {
+            hosts.push_back(std::make_unique<cluster_host<Source>>(std::move(source), latency_decay));
+        }
+    }
+
+    /**
+    * Returns indexes of hosts to try for the target role in order. The first
+    * of hosts of the same rank is the less loaded one of two random hosts
+    * (power of two choices), the rest are rotated.
+    */
+    std::vector<std::size_t> candidates(target_role target, time_traits::time_point now) {
+        const auto count = hosts.size();
+        const auto offset = count ? next.fetch_add(1, std::memory_order_relaxed) % count : 0;
+        std::vector<std::pair<int, std::size_t>> ranked;
+        ranked.reserve(count);
+        for (std::size_t n = 0; n != count; ++n) {
+            const auto i = (offset + n) % count;
+            const auto r = rank(target, hosts[i]->known_role(now, role_check_interval));
+            if (r >= 0) {
+                ranked.emplace_back(r, i);
+            }
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [] (const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+        });
+        std::vector<std::size_t> result;
+        result.reserve(ranked.size());
+        for (const auto& v : ranked) {
+            result.push_back(v.second);
+        }
+        for (auto first = ranked.begin(); first != ranked.end();) {
+            const auto last = std::find_if(first, ranked.end(), [&] (const auto& v) { return v.first != first->first; });
+            const auto begin = result.begin() + (first - ranked.begin());
+            choose_of_two(begin, begin + (last - first), now);
+            first = last;
+        }
+        return result;
+    }
+
+    template <typename Iterator>
+    void choose_of_two(Iterator begin, Iterator end, time_traits::time_point now) const {
+        const auto size = static_cast<std::size_t>(end - begin);
+        if (size < 2) {
+            return;
+        }
+        thread_local std::minstd_rand random {std::random_device {}()};
+        std::uniform_int_distribution<std::size_t> distribution(0, size - 1);
+        const auto a = distribution(random);
+        auto b = distribution(random);
+        if (a == b) {
+            b = (a + 1) % size;
+        }
+        const auto cost = [&] (std::size_t i) { return hosts[begin[i]]->load.cost(now); };
+        std::iter_swap(begin, begin + (cost(b) < cost(a) ? b : a));
+    }
+};
+
+/**
+* Operation of getting a connection to a host of the target role. Hosts are
+* tried in order of candidates, a host which failed to provide a connection
+* or to report its role is skipped. A connection to a host with an unknown
+* role is probed first. With a minimal WAL position a standby is accepted only
+* if it has replayed that position, otherwise the primary is used.
+*/
+template <typename State, typename Handler, typename ... Args>
+struct cluster_connect_context {
+    using connection_type = ozo::connection_type<decltype(std::declval<State&>().hosts.front()->source)>;
+    using handler_type = Handler;
+
+    std::shared_ptr<State> state;
+    io_context& io;
+    Handler handler;
+    target_role target;
+    std::uint64_t min_lsn = 0;
+    std::tuple<Args ...> args;
+    std::vector<std::size_t> candidates;
+    std::size_t tried = 0;
+    error_code error;
+    connection_type fallback;
+    std::size_t fallback_host = 0;
+    time_traits::duration fallback_latency {};
+
+    cluster_connect_context(std::shared_ptr<State> state, io_context& io, Handler handler, target_role target,
+            std::uint64_t min_lsn, std::tuple<Args ...> args)
+    : state(std::move(state)), io(io), handler(std::move(handler)), target(target), min_lsn(min_lsn),
+      args(std::move(args)) {}
+};
+
+template <typename Context>
+struct cluster_connect_op {
+    std::shared_ptr<Context> ctx_;
+    std::size_t host_ = 0;
+    time_traits::time_point tried_at_ {};
+
+    using connection_type = typename Context::connection_type;
+
+    void perform() {
+        ctx_->candidates = ctx_->state->candidates(ctx_->target, time_traits::time_point::clock::now());
+        if (ctx_->candidates.empty()) {
+            return asio::post(ctx_->io, [ctx = ctx_] () mutable {
+                ctx->handler(error_code {error::no_suitable_host}, connection_type {});
+            });
+        }
+        try_next();
+    }
+
+    void try_next() {
+        if (ctx_->tried == ctx_->candidates.size()) {
+            return done();
+        }
+        host_ = ctx_->candidates[ctx_->tried++];
+        tried_at_ = time_traits::time_point::clock::now();
+        auto& source = ctx_->state->hosts[host_]->source;
+        std::apply([&] (const auto& ... args) {
+            source(ctx_->io, *this, args ...);
+        }, ctx_->args);
+    }
+
+    void operator ()(error_code ec, connection_type conn) {
+        auto& host = *ctx_->state->hosts[host_];
+        const auto now = time_traits::time_point::clock::now();
+        if (ec) {
+            return fail(std::move(ec));
+        }
+
+        const auto role = host.known_role(now, ctx_->state->role_check_interval);
+        if (role == host_role::primary || role == host_role::standby) {
+            return accept(role, std::move(conn));
+        }
+
+        auto held = std::make_shared<connection_type>(std::move(conn));
+        const bool probe = host.start_probe([op = *this, held] (host_role role) mutable {
+            asio::post(op.ctx_->io, [op, held, role] () mutable {
+                op.probed(role, std::move(*held));
+            });
+        });
+        if (!probe) {
+            return;
+        }
+
+        ctx_->state->probe(std::move(*held), ctx_->state->role_check_timeout,
+            [op = *this] (error_code ec, connection_type conn, bool in_recovery) mutable {
+                auto& host = *op.ctx_->state->hosts[op.host_];
+                const auto now = time_traits::time_point::clock::now();
+                if (ec) {
+                    host.finish_probe(host_failure(ec) ? host_role::unavailable : host_role::unknown, now);
+                    op.ctx_->error = std::move(ec);
+                    return op.try_next();
+                }
+                const auto role = in_recovery ? host_role::standby : host_role::primary;
+                host.finish_probe(role, now);
+                op.accept(role, std::move(conn));
+            });
+    }
+
+    // The role is learned by a probe of another request
+    void probed(host_role role, connection_type conn) {
+        if (role == host_role::primary || role == host_role::standby) {
+            return accept(role, std::move(conn));
+        }
+        try_next();
+    }
+
+    void fail(error_code ec) {
+        if (host_failure(ec)) {
+            ctx_->state->hosts[host_]->set_role(host_role::unavailable, time_traits::time_point::clock::now());
+        }
+        ctx_->error = std::move(ec);
+        try_next();
+    }
+
+    void accept(host_role role, connection_type conn) {
+        if (accepts(ctx_->target, role)) {
+            if (role == host_role::standby && !ctx_->state->hosts[host_]->replayed(ctx_->min_lsn)) {
+                return check_replay_lsn(std::move(conn));
+            }
+            return provide(host_, std::move(conn), time_traits::time_point::clock::now() - tried_at_);
+        }
+        if (ctx_->target == target_role::prefer_replica && role == host_role::primary && !ctx_->fallback) {
+            ctx_->fallback = std::move(conn);
+            ctx_->fallback_host = host_;
+            ctx_->fallback_latency = time_traits::time_point::clock::now() - tried_at_;
+        }
+        try_next();
+    }
+
+    void check_replay_lsn(connection_type conn) {
+        ctx_->state->probe.replay_lsn(std::move(conn), ctx_->state->role_check_timeout,
+            [op = *this] (error_code ec, connection_type conn, std::uint64_t lsn) mutable {
+                auto& host = *op.ctx_->state->hosts[op.host_];
+                if (ec) {
+                    return op.fail(std::move(ec));
+                }
+                host.advance_replay_lsn(lsn);
+                if (host.replayed(op.ctx_->min_lsn)) {
+                    return op.provide(op.host_, std::move(conn), time_traits::time_point::clock::now() - op.tried_at_);
+                }
+                op.try_next();
+            });
+    }
+
+    // The latency is the time from the request to the host to the connection
+    // which is ready, i.e. the connect and the role probe if any.
+    void provide(std::size_t host, connection_type conn, time_traits::duration latency) {
+        auto& state = ctx_->state;
+        track_host_load(conn, host_load_ptr(state, std::addressof(state->hosts[host]->load)), latency);
+        ctx_->handler(error_code {}, std::move(conn));
+    }
+
+    void done() {
+        if (ctx_->fallback) {
+            return provide(ctx_->fallback_host, std::move(ctx_->fallback), ctx_->fallback_latency);
+        }
+        auto ec = ctx_->error ? std::move(ctx_->error) : error_code {error::no_suitable_host};
+        ctx_->handler(std::move(ec), connection_type {});
+    }
+
+    using executor_type = decltype(asio::get_associated_executor(std::declval<const typename Context::handler_type&>()));
+
+    auto get_executor() const noexcept {
+        return asio::get_associated_executor(ctx_->handler);
+    }
+
+    template <typename Func>
+    friend void asio_handler_invoke(Func&& f, cluster_connect_op* op) {
+        using boost::asio::asio_handler_invoke;
+        asio_handler_invoke(std::forward<Func>(f), std::addressof(op->ctx_->handler));
+    }
+};
+
+template <typename State, typename Handler, typename ... Args>
+inline void async_cluster_connect(std::shared_ptr<State> state, io_context& io, target_role target,
+        Handler&& handler, const Args& ... args) {
+    using context_type = cluster_connect_context<State, std::decay_t<Handler>, Args ...>;
+    cluster_connect_op<context_type> {
+        std::make_shared<context_type>(std::move(state), io, std::forward<Handler>(handler), target,
+            std::uint64_t(0), std::make_tuple(args ...)),
+        0
+    }.perform();
+}
+
+/**
+* Connects to a standby which has replayed the WAL position, or to the primary
+* if there is no such standby.
+*/
+template <typename State, typename Handler, typename ... Args>
+inline void async_session_connect(std::shared_ptr<State> state, io_context& io, std::uint64_t min_lsn,
+        Handler&& handler, const Args& ... args) {
+    using context_type = cluster_connect_context<State, std::decay_t<Handler>, Args ...>;
+    cluster_connect_op<context_type> {
+        std::make_shared<context_type>(std::move(state), io, std::forward<Handler>(handler),
+            target_role::prefer_replica, min_lsn, std::make_tuple(args ...)),
+        0
+    }.perform();
+}
+
+} // namespace ozo::impl
@@ -0,0 +1,537 @@
+#pragma once
+
+#include <ozo/asio.h>
+#include <ozo/connection.h>
+#include <ozo/error.h>
+#include <ozo/time_traits.h>
+#include <ozo/detail/bind.h>
+#include <ozo/impl/async_request.h>
+#include <ozo/impl/io.h>
+
+#include <yamail/resource_pool/async/pool.hpp>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Shared state of a multiplexed connection. Requests are queued in FIFO order
+* and sent via a single connection of the provider.
+*
+* If libpq supports pipeline mode, see `OZO_HAS_PIPELINING`, the connection
+* is switched to it and each request is sent as soon as it is queued, followed
+* by a sync point, so a failed query does not abort the next ones. Results are
+* received in the order the queries were sent and dispatched to the requests.
+* Only one thread at a time reads and writes the connection, see `pump()`.
+* If the connection fails, all the requests sent via it fail and the next
+* request gets a new connection from the provider.
+*
+* Without pipeline mode requests are sent one by one: the next request is sent
+* when the previous one completes.
+*
+* Each request has a timer which covers both its wait in the queue and the
+* query itself. The handler is invoked once by whichever of the request and
+* its timer completes first; a result of a query which has timed out already
+* is dropped without touching the request output. Results are received in
+* order, so a timed out query which is the first one in the pipeline would
+* hold the results of the next ones back. Then the connection is closed, the
+* requests sent via it fail with `asio::error::connection_aborted` and the
+* next request gets a new connection.
+*/
+template <typename Provider>
+class multiplexer_state : public std::enable_shared_from_this<multiplexer_state<Provider>> {
+public:
+    using connection_type = ozo::connection_type<Provider>;
+
+    static_assert(std::is_same_v<connection_type, std::shared_ptr<typename connection_type::element_type>>,
+        "connection of multiplexed provider must be std::shared_ptr");
+
+    multiplexer_state(io_context& io, Provider provider, std::size_t queue_capacity)
+    : io_(io), provider_(std::move(provider)), queue_capacity_(queue_capacity) {}
+
+    multiplexer_state(const multiplexer_state&) = delete;
+    multiplexer_state& operator =(const multiplexer_state&) = delete;
+
+    ~multiplexer_state() {
+#ifdef OZO_HAS_PIPELINING
+        // The connection is returned to the provider in the regular mode, or
+        // closed if there are results which are not received.
+        if (conn_ && !exit_pipeline_mode(conn_)) {
+            close_connection(conn_);
+        }
+#endif
+    }
+
+    /**
+    * Queues the request. The handler signature is
+    * `void(error_code, connection_type)`, the `OutHandler` is called as
+    * `out(result, conn)` for a result of the query.
+    */
+    template <typename Query, typename OutHandler, typename Handler>
+    void request(Query&& query, time_traits::duration timeout, OutHandler&& out, Handler&& handler) {
+        using request_type = request_impl<std::decay_t<Query>, std::decay_t<OutHandler>, std::decay_t<Handler>>;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queued_.size() + in_flight_.size() >= queue_capacity_) {
+            lock.unlock();
+            return asio::post(io_, detail::bind(std::forward<Handler>(handler),
+                error_code {yamail::resource_pool::error::request_queue_overflow}, connection_type {}));
+        }
+        auto r = std::make_shared<request_type>(io_, timeout, std::forward<Query>(query),
+            std::forward<OutHandler>(out), std::forward<Handler>(handler));
+        r->timer_.expires_after(timeout);
+        r->timer_.async_wait([self = this->shared_from_this(), r] (error_code ec) {
+            self->on_timeout(r, ec);
+        });
+        queued_.push_back(std::move(r));
+        dispatch(std::move(lock));
+    }
+
+    /**
+    * Number of requests which are queued or wait for results.
+    */
+    std::size_t waiting() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queued_.size() + in_flight_.size();
+    }
+
+private:
+    using result_type = std::decay_t<decltype(get_result(std::declval<connection_type&>()))>;
+
+    struct request_base {
+        asio::steady_timer timer_;
+        std::atomic<bool> done_ {false};
+        time_traits::time_point deadline_;
+        bool result_received_ = false;
+
+        request_base(io_context& io, time_traits::duration timeout)
+        : timer_(io), deadline_(make_deadline(timeout)) {}
+
+        virtual ~request_base() = default;
+
+#ifdef OZO_HAS_PIPELINING
+        // Sends the query in pipeline mode
+        virtual bool send(connection_type& conn) = 0;
+
+        // Passes a result of the query to the output, may throw
+        virtual void process(result_type res, const connection_type& conn) = 0;
+#else
+        // Performs the request on the connection exclusively
+        virtual void start(const std::shared_ptr<multiplexer_state>& self,
+            const std::shared_ptr<request_base>& r, connection_type conn) = 0;
+#endif
+
+        virtual void run(error_code ec, connection_type conn) = 0;
+    };
+
+    // The handler is destroyed after it is invoked, so the state it holds
+    // is not kept alive by a request which is still in the pipeline.
+    template <typename Query, typename OutHandler, typename Handler>
+    struct request_impl : request_base {
+        Query query_;
+        OutHandler out_;
+        std::optional<Handler> handler_;
+
+        template <typename Q, typename O, typename H>
+        request_impl(io_context& io, time_traits::duration timeout, Q&& query, O&& out, H&& handler)
+        : request_base(io, timeout), query_(std::forward<Q>(query)), out_(std::forward<O>(out)),
+          handler_(std::forward<H>(handler)) {}
+
+#ifdef OZO_HAS_PIPELINING
+        bool send(connection_type& conn) override {
+            return send_query_params(conn, make_binary_query(query_, get_oid_map(conn)));
+        }
+
+        void process(result_type res, const connection_type& conn) override {
+            out_(std::move(res), conn);
+        }
+#else
+        void start(const std::shared_ptr<multiplexer_state>& self, const std::shared_ptr<request_base>& r,
+                connection_type conn) override {
+            make_async_request_op(std::move(query_), time_left(this->deadline_), std::move(out_),
+                [self, r] (error_code ec, connection_type conn) {
+                    self->release(conn);
+                    self->finish(r, std::move(ec), std::move(conn));
+                })(error_code {}, std::move(conn));
+        }
+#endif
+
+        void run(error_code ec, connection_type conn) override {
+            auto handler = std::move(*handler_);
+            handler_.reset();
+            handler(std::move(ec), std::move(conn));
+        }
+    };
+
+    static time_traits::time_point make_deadline(time_traits::duration timeout) noexcept {
+        const auto now = time_traits::time_point::clock::now();
+        return timeout < time_traits::time_point::max() - now ? now + timeout : time_traits::time_point::max();
+    }
+
+    static time_traits::duration time_left(time_traits::time_point deadline) noexcept {
+        if (deadline == time_traits::time_point::max()) {
+            return time_traits::duration::max();
+        }
+        return std::max(deadline - time_traits::time_point::clock::now(), time_traits::duration::zero());
+    }
+
+    void finish(std::shared_ptr<request_base> r, error_code ec, connection_type conn) noexcept {
+        try {
+            asio::post(io_, [r = std::move(r), ec = std::move(ec), conn = std::move(conn)] () mutable {
+                r->timer_.cancel();
+                r->run(std::move(ec), std::move(conn));
+            });
+        } catch (...) {}
+    }
+
+    void on_timeout(const std::shared_ptr<request_base>& r, error_code ec) {
+        if (ec == asio::error::operation_aborted || r->done_.exchange(true)) {
+            return;
+        }
+        connection_type conn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto it = std::find(queued_.begin(), queued_.end(), r);
+            if (it != queued_.end()) {
+                queued_.erase(it);
+            }
+            conn = conn_;
+#ifdef OZO_HAS_PIPELINING
+            if (conn_ && head_timed_out()) {
+                fail(asio::error::connection_aborted);
+            }
+#endif
+        }
+        finish(r, error_code {asio::error::timed_out}, std::move(conn));
+    }
+
+#ifdef OZO_HAS_PIPELINING
+    enum class pump_event {scheduled, readable, writable};
+
+    // A failure of sending via a new connection makes the rest of the queue
+    // wait for the next connection.
+    void dispatch(std::unique_lock<std::mutex> lock) {
+        if (conn_) {
+            send_queued();
+            if (conn_) {
+                return schedule_pump();
+            }
+        }
+        if (connecting_ || queued_.empty()) {
+            return;
+        }
+        connecting_ = true;
+        lock.unlock();
+        try {
+            async_get_connection(provider_, [self = this->shared_from_this()] (error_code ec, connection_type conn) {
+                self->on_connected(std::move(ec), std::move(conn));
+            });
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            connecting_ = false;
+            throw;
+        }
+    }
+
+    void on_connected(error_code ec, connection_type conn) {
+        if (!ec) {
+            ec = set_nonblocking(conn);
+        }
+        if (!ec) {
+            ec = enter_pipeline_mode(conn);
+        }
+        std::deque<std::shared_ptr<request_base>> failed;
+        std::unique_lock<std::mutex> lock(mutex_);
+        connecting_ = false;
+        if (!ec) {
+            conn_ = conn;
+            return dispatch(std::move(lock));
+        }
+        failed.swap(queued_);
+        lock.unlock();
+        for (auto& r : failed) {
+            if (!r->done_.exchange(true)) {
+                finish(std::move(r), ec, conn);
+            }
+        }
+    }
+
+    // Called with the mutex locked
+    void send_queued() {
+        while (conn_ && !queued_.empty()) {
+            auto r = std::move(queued_.front());
+            queued_.pop_front();
+            if (r->done_) {
+                continue;
+            }
+            in_flight_.push_back(r);
+            if (!r->send(conn_)) {
+                return fail(error::pg_send_query_params_failed);
+            }
+            if (auto ec = pipeline_sync(conn_)) {
+                return fail(ec);
+            }
+        }
+    }
+
+    // Called with the mutex locked
+    void schedule_pump() {
+        if (!conn_ || pump_scheduled_) {
+            return;
+        }
+        asio::post(io_, [self = this->shared_from_this(), conn = conn_] {
+            self->pump(conn, pump_event::scheduled);
+        });
+        pump_scheduled_ = true;
+    }
+
+    /**
+    * Flushes the queries and receives the results. Only one thread performs it
+    * at a time, an event which occurs meanwhile makes that thread repeat it.
+    * The results are processed without the mutex locked, so new requests are
+    * sent meanwhile, but before the next read, so results are dispatched in order.
+    */
+    void pump(const connection_type& conn, pump_event event, error_code ec = {}) {
+        std::vector<std::pair<std::shared_ptr<request_base>, result_type>> received;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (conn != conn_) {
+            return;
+        }
+        switch (event) {
+            case pump_event::scheduled: pump_scheduled_ = false; break;
+            case pump_event::readable: reading_ = false; break;
+            case pump_event::writable: writing_ = false; break;
+        }
+        if (ec) {
+            return fail(ec);
+        }
+        if (pumping_) {
+            repump_ = true;
+            return;
+        }
+        pumping_ = true;
+        do {
+            repump_ = false;
+            if (auto err = consume_input(conn_)) {
+                return fail(err);
+            }
+            const auto state = flush_output(conn_);
+            if (state == query_state::error) {
+                return fail(error::pg_flush_failed);
+            }
+            flushing_ = state == query_state::send_in_progress;
+            receive(received);
+            if (!received.empty()) {
+                lock.unlock();
+                for (auto& [r, res] : received) {
+                    complete(r, std::move(res), conn);
+                }
+                received.clear();
+                lock.lock();
+                if (conn != conn_) {
+                    return;
+                }
+            }
+        } while (repump_);
+        pumping_ = false;
+        if (head_timed_out()) {
+            return fail(asio::error::connection_aborted);
+        }
+        wait();
+    }
+
+    // Called with the mutex locked. The first query in the pipeline has timed
+    // out before its result is received, so the next ones are stalled.
+    bool head_timed_out() const noexcept {
+        return !in_flight_.empty() && in_flight_.front()->done_ && !in_flight_.front()->result_received_;
+    }
+
+    // Called with the mutex locked
+    void wait() {
+        if (flushing_ && !writing_) {
+            write_poll(conn_, asio::bind_executor(io_,
+                [self = this->shared_from_this(), conn = conn_] (error_code ec, std::size_t = 0) {
+                    self->pump(conn, pump_event::writable, ec);
+                }));
+            writing_ = true;
+        }
+        if (!in_flight_.empty() && !reading_) {
+            read_poll(conn_, asio::bind_executor(io_,
+                [self = this->shared_from_this(), conn = conn_] (error_code ec, std::size_t = 0) {
+                    self->pump(conn, pump_event::readable, ec);
+                }));
+            reading_ = true;
+        }
+    }
+
+    // Called with the mutex locked. Each query yields its result, a null
+    // result and a sync point result, so a request leaves the pipeline on
+    // the sync point. The results of the same query after the first one are
+    // dropped. A null result which does not end the results of a query means
+    // there is nothing to receive yet.
+    template <typename Received>
+    void receive(Received& received) {
+        bool ended = false;
+        while (!in_flight_.empty() && !is_busy(conn_)) {
+            auto res = get_result(conn_);
+            auto& r = in_flight_.front();
+            if (!res) {
+                if (ended || !r->result_received_) {
+                    break;
+                }
+                ended = true;
+                continue;
+            }
+            ended = false;
+            if (result_status(*res) == PGRES_PIPELINE_SYNC) {
+                if (!r->result_received_) {
+                    received.emplace_back(std::move(r), std::move(res));
+                }
+                in_flight_.pop_front();
+                continue;
+            }
+            if (!r->result_received_) {
+                r->result_received_ = true;
+                received.emplace_back(r, std::move(res));
+            }
+        }
+    }
+
+    // The error context is not set since the connection is shared by requests.
+    void complete(std::shared_ptr<request_base> r, result_type res, const connection_type& conn) {
+        if (r->done_.exchange(true)) {
+            return;
+        }
+        error_code ec;
+        switch (result_status(*res)) {
+            case PGRES_SINGLE_TUPLE:
+            case PGRES_TUPLES_OK:
+                try {
+                    r->process(std::move(res), conn);
+                } catch (const std::exception&) {
+                    ec = error::bad_result_process;
+                }
+                break;
+            case PGRES_COMMAND_OK:
+                break;
+            case PGRES_BAD_RESPONSE:
+                ec = error::result_status_bad_response;
+                break;
+            case PGRES_EMPTY_QUERY:
+                ec = error::result_status_empty_query;
+                break;
+            case PGRES_FATAL_ERROR:
+                ec = result_error(*res);
+                break;
+            default:
+                ec = error::result_status_unexpected;
+                break;
+        }
+        finish(std::move(r), std::move(ec), conn);
+    }
+
+    // Called with the mutex locked. The connection is closed, so it is not
+    // reused by the provider in pipeline mode, and the waits on its socket
+    // are aborted.
+    void fail(error_code ec) {
+        auto conn = std::move(conn_);
+        conn_.reset();
+        pump_scheduled_ = reading_ = writing_ = flushing_ = pumping_ = repump_ = false;
+        auto failed = std::move(in_flight_);
+        in_flight_.clear();
+        close_connection(conn);
+        for (auto& r : failed) {
+            if (!r->done_.exchange(true)) {
+                finish(std::move(r), ec, conn);
+            }
+        }
+    }
+#else
+    void dispatch(std::unique_lock<std::mutex> lock) {
+        lock.unlock();
+        run_next();
+    }
+
+    void run_next() noexcept {
+        std::shared_ptr<request_base> r;
+        connection_type conn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (busy_) {
+                return;
+            }
+            while (!r && !queued_.empty()) {
+                r = std::move(queued_.front());
+                queued_.pop_front();
+                if (r->done_.exchange(true)) {
+                    r.reset();
+                }
+            }
+            if (!r) {
+                return;
+            }
+            busy_ = true;
+            conn = conn_;
+        }
+        try {
+            if (conn) {
+                return r->start(this->shared_from_this(), r, std::move(conn));
+            }
+            async_get_connection(provider_,
+                [self = this->shared_from_this(), r] (error_code ec, connection_type conn) {
+                    if (ec) {
+                        self->release(nullptr);
+                        return self->finish(r, std::move(ec), std::move(conn));
+                    }
+                    r->start(self, r, std::move(conn));
+                });
+        } catch (...) {
+            // An asynchronous operation initiation throws on the lack of memory only
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_ = false;
+            }
+            finish(std::move(r), error_code {asio::error::no_memory}, std::move(conn));
+        }
+    }
+
+    // A bad connection is dropped and a new one is requested from the provider for the next request
+    void release(const connection_type& conn) noexcept {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            conn_ = conn && !connection_bad(conn) ? conn : connection_type {};
+            busy_ = false;
+        }
+        run_next();
+    }
+#endif
+
+    io_context& io_;
+    Provider provider_;
+    std::size_t queue_capacity_;
+    mutable std::mutex mutex_;
+    connection_type conn_;
+    std::deque<std::shared_ptr<request_base>> queued_;
+    std::deque<std::shared_ptr<request_base>> in_flight_;
+    bool connecting_ = false;
+    bool busy_ = false;
+    bool pump_scheduled_ = false;
+    bool reading_ = false;
+    bool writing_ = false;
+    bool flushing_ = false;
+    bool pumping_ = false;
+    bool repump_ = false;
+};
+
+} // namespace ozo::impl
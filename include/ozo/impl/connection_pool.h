@@ -1,9 +1,31 @@
 #pragma once
 
 #include <ozo/connection.h>
+#include <ozo/connection_pool_config.h>
+#include <ozo/connection_pool_metrics.h>
+#include <ozo/impl/async_execute.h>
+#include <ozo/impl/circuit_breaker.h>
+#include <ozo/impl/host_load.h>
+#include <ozo/impl/io.h>
+#include <ozo/impl/pool_queue.h>
+#include <ozo/impl/recycling_allocator.h>
 #include <yamail/resource_pool/async/pool.hpp>
 #include <ozo/asio.h>
 
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 namespace ozo::impl {
 
 template <typename Source>
@@ -14,37 +36,452 @@ struct get_connection_pool {
 template <typename Source>
 using connection_pool = typename get_connection_pool<Source>::type;
 
+/**
+* Opens a replacement of an expired connection. It refers to the pool weakly
+* via a plain function, so it is copied with every request to the pool
+* without an allocation, unlike a type-erased function.
+*/
+struct connection_expiry {
+    using reopen_type = void (*)(std::shared_ptr<void>, io_context&, time_traits::duration, time_traits::duration);
+
+    std::weak_ptr<void> state;
+    io_context* io = nullptr;
+    time_traits::duration connect_timeout = time_traits::duration::max();
+    time_traits::duration queue_timeout = time_traits::duration::max();
+    reopen_type reopen = nullptr;
+
+    explicit operator bool() const noexcept { return reopen != nullptr; }
+
+    void operator ()() const {
+        if (auto locked = state.lock()) {
+            reopen(std::move(locked), *io, connect_timeout, queue_timeout);
+        }
+    }
+};
+
+/**
+* Limits the time a pooled connection is kept open. Each connection gets its
+* own random jitter subtracted from the maximum age, so connections opened
+* at once, e.g. after a failover, are not closed at once.
+*/
+struct connection_lifespan {
+    time_traits::duration max = time_traits::duration::max();
+    time_traits::duration jitter = time_traits::duration::zero();
+    connection_expiry on_expiry;
+
+    bool finite() const noexcept { return max != time_traits::duration::max(); }
+
+    time_traits::time_point expires_at(time_traits::time_point now) const {
+        if (!finite() || max >= time_traits::time_point::max() - now) {
+            return time_traits::time_point::max();
+        }
+        const auto jitter_limit = std::min(std::max(jitter, time_traits::duration::zero()), max);
+        if (jitter_limit == time_traits::duration::zero()) {
+            return now + max;
+        }
+        thread_local std::minstd_rand random {std::random_device {}()};
+        std::uniform_int_distribution<time_traits::duration::rep> distribution(0, jitter_limit.count());
+        return now + max - time_traits::duration(distribution(random));
+    }
+};
+
+/**
+* Session reset settings of a pool. The query is empty for the policies which
+* only roll back a transaction left open.
+*/
+struct session_reset_config {
+    session_reset_policy policy = session_reset_policy::none;
+    std::string query;
+    time_traits::duration timeout = std::chrono::seconds(1);
+
+    session_reset_config() = default;
+
+    session_reset_config(session_reset_policy policy, std::string custom_query, time_traits::duration timeout)
+    : policy(policy), timeout(timeout) {
+        if (policy == session_reset_policy::discard_all) {
+            query = "DISCARD ALL";
+        } else if (policy == session_reset_policy::custom) {
+            query = std::move(custom_query);
+        }
+    }
+};
+
+using session_reset_config_ptr = std::shared_ptr<const session_reset_config>;
+
+/**
+* Session reset of a connection returned to the pool. The run function takes
+* the handle and the slot of the connection and sends `ROLLBACK` if the
+* rollback flag is set, then the reset query if the reset flag is set.
+*/
+template <typename Handle>
+struct session_reset {
+    using run_type = void (*)(Handle&, pool_slot&, const session_reset_config_ptr&, bool rollback, bool reset);
+
+    session_reset_config_ptr config;
+    run_type run = nullptr;
+
+    explicit operator bool() const noexcept {
+        return config && run && config->policy != session_reset_policy::none;
+    }
+};
+
+/**
+* Connection taken from the pool. The connection the handle refers to is
+* unwrapped once and cached, so access to it does not go through the handle
+* and the underlying pointer on every call.
+*/
 template <typename Source>
 struct pooled_connection {
     using handle_type = typename connection_pool<Source>::handle;
     using underlying_type = typename handle_type::value_type;
+    using unwrapped_type = std::remove_reference_t<decltype(unwrap_connection(*std::declval<const handle_type&>()))>;
+    using session_reset_type = session_reset<handle_type>;
 
+    pool_slot slot_; // released after the handle is returned to the pool
     handle_type handle_;
+    connection_expiry on_expiry_;
+    pool_metrics_ptr metrics_;
+    circuit_breaker_ptr breaker_;
+    session_reset_type session_reset_;
+    host_load_ptr host_load_; // set by a cluster, the latency is recorded on return
+    time_traits::duration host_latency_ {};
+    time_traits::time_point acquired_at_;
+    mutable unwrapped_type* unwrapped_ = nullptr;
+    bool session_dirty_ = false;
+
+    pooled_connection(handle_type&& handle, connection_expiry on_expiry = {},
+            pool_metrics_ptr metrics = nullptr, pool_slot slot = pool_slot {},
+            circuit_breaker_ptr breaker = nullptr, session_reset_type session_reset = {})
+    : slot_(std::move(slot)), handle_(std::move(handle)), on_expiry_(std::move(on_expiry)),
+      metrics_(std::move(metrics)), breaker_(std::move(breaker)), session_reset_(std::move(session_reset)) {}
 
-    pooled_connection(handle_type&& handle) : handle_(std::move(handle)) {}
+    void acquired(time_traits::time_point now) noexcept {
+        acquired_at_ = now;
+        if (metrics_) {
+            pool_metrics::increment(metrics_->acquisitions);
+        }
+    }
 
     bool empty() const {return handle_.empty();}
 
     void reset(underlying_type&& v) {
+        unwrapped_ = nullptr;
         handle_.reset(std::move(v));
     }
 
+    unwrapped_type& unwrap() const {
+        if (!unwrapped_) {
+            unwrapped_ = std::addressof(unwrap_connection(*handle_));
+        }
+        return *unwrapped_;
+    }
+
+    bool expired(time_traits::time_point now = time_traits::time_point::clock::now()) const {
+        return unwrap().expires_at_ <= now;
+    }
+
     ~pooled_connection() {
-        if (!empty() && connection_bad(*this)) {
+        const auto now = time_traits::time_point::clock::now();
+        if (metrics_ && acquired_at_ != time_traits::time_point {}) {
+            metrics_->hold_time.add(now - acquired_at_);
+        }
+        if (host_load_) {
+            host_load_->release(host_latency_, now);
+        }
+        if (empty()) {
+            return;
+        }
+        const bool bad = connection_bad(*this);
+        if (breaker_ && acquired_at_ != time_traits::time_point {}) {
+            bad ? breaker_->failure() : breaker_->success();
+        }
+        if (bad) {
             handle_.waste();
+        } else if (expired(now)) {
+            handle_.waste();
+            if (on_expiry_) {
+                try {
+                    on_expiry_();
+                } catch (...) {}
+            }
+        } else {
+            unwrap().idle_since_ = now;
+            if (session_reset_ && acquired_at_ != time_traits::time_point {}) {
+                reset_session();
+            }
+        }
+    }
+
+    // The session is reset only if it is known to be dirty: a transaction is
+    // left open or the session is marked by the user. A connection with a query
+    // in progress can not be reused, so it is closed.
+    void reset_session() noexcept {
+        const auto status = connection_transaction_status(get_native_handle(*this));
+        if (status == PQTRANS_ACTIVE || status == PQTRANS_UNKNOWN) {
+            return handle_.waste();
+        }
+        const bool rollback = status != PQTRANS_IDLE;
+        const bool reset = !session_reset_.config->query.empty() && (rollback || session_dirty_);
+        if (!rollback && !reset) {
+            return;
+        }
+        if (metrics_) {
+            pool_metrics::increment(metrics_->session_resets);
+        }
+        try {
+            session_reset_.run(handle_, slot_, session_reset_.config, rollback, reset);
+        } catch (...) {
+            if (!handle_.empty()) {
+                handle_.waste();
+            }
         }
     }
 };
 template <typename Source>
 using pooled_connection_ptr = std::shared_ptr<pooled_connection<Source>>;
 
+/**
+* Sends the session reset queries via a connection returned to the pool. The
+* handle is returned to the pool after the queries succeed, the connection
+* is closed if any of them fails.
+*/
+template <typename Handle>
+struct session_reset_op {
+    struct context {
+        pool_slot slot; // released after the handle is returned to the pool
+        Handle handle;
+        session_reset_config_ptr config;
+    };
+
+    std::shared_ptr<context> ctx_;
+    bool rollback_;
+    bool reset_;
+
+    void perform() {
+        if (std::exchange(rollback_, false)) {
+            return execute(make_query("ROLLBACK"));
+        }
+        if (std::exchange(reset_, false)) {
+            return execute(make_query(std::string_view(ctx_->config->query)));
+        }
+    }
+
+    template <typename Query>
+    void execute(Query&& query) {
+        auto conn = *ctx_->handle;
+        async_execute(conn, std::forward<Query>(query), ctx_->config->timeout, std::move(*this));
+    }
+
+    template <typename Connection>
+    void operator ()(error_code ec, Connection&& conn) {
+        if (ec || connection_bad(conn)) {
+            return ctx_->handle.waste();
+        }
+        perform();
+    }
+};
+
+template <typename Handle>
+void run_session_reset(Handle& handle, pool_slot& slot, const session_reset_config_ptr& config,
+        bool rollback, bool reset) {
+    using context = typename session_reset_op<Handle>::context;
+    auto ctx = std::make_shared<context>();
+    ctx->slot = std::move(slot);
+    ctx->handle = std::move(handle);
+    ctx->config = config;
+    session_reset_op<Handle> {std::move(ctx), rollback, reset}.perform();
+}
+
+/**
+* Set of underlying pools (shards). Each shard is owned by an io_context which
+* requested a connection from it first, so connections stay affine to their
+* io_context and threads do not contend for a single pool. If there are more
+* io_contexts than shards, the rest of io_contexts share shards by hash.
+* A connection is stolen from another shard only when the local shard is
+* exhausted, i.e. it has no idle connections and no room for a new one.
+*/
+template <typename Pool>
+class pool_shards {
+public:
+    using pool_type = Pool;
+
+    pool_shards(std::size_t count, std::size_t capacity, std::size_t queue_capacity,
+            time_traits::duration idle_timeout, std::size_t min_idle = 0)
+    : count_(std::max<std::size_t>(1, std::min(count, capacity))),
+      shards_(std::make_unique<shard[]>(count_)),
+      idle_timeout_(idle_timeout) {
+        for (std::size_t i = 0; i != count_; ++i) {
+            shards_[i].pool = std::make_unique<pool_type>(
+                split(capacity, i), split(queue_capacity, i), idle_timeout);
+            shards_[i].min_idle = std::min(split(min_idle, i), split(capacity, i));
+        }
+    }
+
+    std::size_t size() const noexcept { return count_; }
+
+    pool_type& operator [](std::size_t i) noexcept { return *shards_[i].pool; }
+
+    const pool_type& operator [](std::size_t i) const noexcept { return *shards_[i].pool; }
+
+    time_traits::duration idle_timeout() const noexcept { return idle_timeout_; }
+
+    std::size_t min_idle(std::size_t i) const noexcept { return shards_[i].min_idle; }
+
+    /**
+    * Marks the shard as kept at its minimum of idle connections. Returns true
+    * only for the first call for the shard.
+    */
+    bool start_keeping_min_idle(std::size_t i) noexcept {
+        return start_once(shards_[i].keeping_min_idle);
+    }
+
+    /**
+    * Marks idle connections of the shard as checked in background. Returns
+    * true only for the first call for the shard.
+    */
+    bool start_health_check(std::size_t i) noexcept {
+        return start_once(shards_[i].health_checked);
+    }
+
+    /**
+    * Returns index of the shard owned by the key.
+    */
+    std::size_t local(const void* key) noexcept {
+        if (count_ == 1) {
+            return 0;
+        }
+        for (std::size_t i = 0; i != count_; ++i) {
+            const void* owner = shards_[i].owner.load(std::memory_order_acquire);
+            if (owner == nullptr) {
+                shards_[i].owner.compare_exchange_strong(owner, key, std::memory_order_acq_rel);
+                owner = shards_[i].owner.load(std::memory_order_acquire);
+            }
+            if (owner == key) {
+                return i;
+            }
+        }
+        return std::hash<const void*>{}(key) % count_;
+    }
+
+    pool_type& get(const void* key) noexcept {
+        auto& own = (*this)[local(key)];
+        if (!exhausted(own)) {
+            return own;
+        }
+        for (std::size_t i = 0; i != count_; ++i) {
+            auto& other = (*this)[i];
+            if (&other != &own && other.available()) {
+                return other;
+            }
+        }
+        return own;
+    }
+
+    /**
+    * Returns part of the value which belongs to the shard.
+    */
+    std::size_t split(std::size_t value, std::size_t i) const noexcept {
+        return value / count_ + (i < value % count_);
+    }
+
+private:
+    struct shard {
+        std::unique_ptr<pool_type> pool;
+        std::size_t min_idle = 0;
+        std::atomic<const void*> owner {nullptr};
+        std::atomic<bool> keeping_min_idle {false};
+        std::atomic<bool> health_checked {false};
+    };
+
+    static bool start_once(std::atomic<bool>& started) noexcept {
+        return !started.load(std::memory_order_relaxed) && !started.exchange(true);
+    }
+
+    static bool exhausted(const pool_type& pool) noexcept {
+        return !pool.available() && pool.size() >= pool.capacity();
+    }
+
+    std::size_t count_;
+    std::unique_ptr<shard[]> shards_;
+    time_traits::duration idle_timeout_;
+};
+
+/**
+* Shared state of a connection pool. It is shared with background operations
+* like keeping of minimum idle connections, which must not outlive the pool.
+*/
+template <typename Source>
+struct pool_state {
+    pool_shards<connection_pool<Source>> shards;
+    Source source;
+    connection_lifespan lifespan;
+    time_traits::duration health_check_interval;
+    pool_metrics metrics;
+    std::deque<pool_queue> queues; // per shard, limited by the shard capacity
+    circuit_breaker breaker;
+    std::deque<block_cache> connections_memory; // per shard, so shards do not contend for it
+    session_reset_config session_reset;
+    std::mutex mutex;
+    std::vector<std::weak_ptr<asio::steady_timer>> timers;
+
+    /**
+    * Idle connections are checked in background every health check interval,
+    * so a connection idle for less time is not checked when it is acquired.
+    */
+    time_traits::duration unchecked_idle_time() const noexcept {
+        if (health_check_interval <= time_traits::duration::zero()
+                || health_check_interval == time_traits::duration::max()) {
+            return time_traits::duration::zero();
+        }
+        return health_check_interval;
+    }
+
+    pool_state(Source source, const connection_pool_config& config)
+    : shards(config.shards, config.capacity, config.queue_capacity, config.idle_timeout, config.min_idle),
+      source(std::move(source)), lifespan {config.lifespan, config.lifespan_jitter, {}},
+      health_check_interval(config.health_check_interval),
+      breaker(config.failure_threshold, config.circuit_open_timeout),
+      session_reset(config.session_reset, config.session_reset_query, config.session_reset_timeout) {
+        for (std::size_t i = 0; i != shards.size(); ++i) {
+            queues.emplace_back(shards[i].capacity(), shards.split(config.queue_capacity, i),
+                shards.split(config.min_capacity, i), config.latency_tolerance,
+                config.queue_delay_target, config.queue_delay_interval);
+            connections_memory.emplace_back(shards[i].capacity());
+        }
+    }
+};
+
+template <typename Source>
+std::shared_ptr<pool_queue> shard_queue(const std::shared_ptr<pool_state<Source>>& state, std::size_t shard) {
+    return std::shared_ptr<pool_queue>(state, std::addressof(state->queues[shard]));
+}
+
+/**
+* Takes a free slot of the local shard or, if it has none, of another shard,
+* so a request does not wait while other shards have room. Returns the slot
+* along with index of its shard, the slot is empty if all the shards are busy.
+*/
+template <typename Source>
+std::pair<pool_slot, std::size_t> try_enter_any_shard(const std::shared_ptr<pool_state<Source>>& state,
+        std::size_t local) {
+    const auto count = state->queues.size();
+    for (std::size_t i = 0; i != count; ++i) {
+        const auto shard = (local + i) % count;
+        auto slot = state->queues[shard].try_enter(shard_queue(state, shard), true);
+        if (!slot.empty()) {
+            return {std::move(slot), shard};
+        }
+    }
+    return {pool_slot {}, local};
+}
+
 } // namespace ozo::impl
 namespace ozo {
 template <typename T>
 struct unwrap_connection_impl<impl::pooled_connection<T>> {
     template <typename Conn>
     static constexpr decltype(auto) apply(Conn&& conn) noexcept {
-        return unwrap_connection(*(conn.handle_));
+        return conn.unwrap();
     }
 };
 } // namespace ozo
@@ -56,6 +493,14 @@ struct pooled_connection_wrapper {
     IoContext& io_;
     Provider provider_;
     Handler handler_;
+    connection_lifespan lifespan_;
+    pool_metrics_ptr metrics_;
+    time_traits::time_point requested_at_;
+    pool_slot slot_;
+    circuit_breaker_ptr breaker_;
+    recycling_allocator<void> allocator_;
+    typename pooled_connection<typename Provider::source_type>::session_reset_type session_reset_;
+    time_traits::duration unchecked_idle_time_;
 
     using connection = pooled_connection<typename Provider::source_type>;
     using connection_ptr = pooled_connection_ptr<typename Provider::source_type>;
@@ -63,13 +508,28 @@ struct pooled_connection_wrapper {
     struct wrapper {
         Handler handler_;
         connection_ptr conn_;
+        time_traits::time_point expires_at_;
+        time_traits::time_point connect_started_at_;
 
         template <typename Conn>
         void operator () (error_code ec, Conn&& conn) {
             static_assert(std::is_same_v<connection_type<Provider>, std::decay_t<Conn>>,
                 "Conn must connectiable type of Provider");
+            const auto now = time_traits::time_point::clock::now();
+            if (auto& metrics = conn_->metrics_) {
+                if (ec) {
+                    pool_metrics::increment(metrics->connect_errors);
+                } else {
+                    metrics->connect_time.add(now - connect_started_at_);
+                }
+            }
+            if (auto& breaker = conn_->breaker_) {
+                ec ? breaker->failure(now) : breaker->success();
+            }
             if (!ec) {
+                unwrap_connection(conn).expires_at_ = expires_at_;
                 conn_->reset(std::move(conn));
+                conn_->acquired(now);
             }
             handler_(std::move(ec), std::move(conn_));
         }
@@ -89,17 +549,63 @@ struct pooled_connection_wrapper {
 
     template <typename Handle>
     void operator ()(error_code ec, Handle&& handle) {
+        const auto now = time_traits::time_point::clock::now();
+        if (metrics_) {
+            metrics_->wait_time.add(now - requested_at_);
+            if (ec == yamail::resource_pool::error::request_queue_overflow) {
+                pool_metrics::increment(metrics_->queue_overflows);
+            } else if (ec == yamail::resource_pool::error::get_resource_timeout) {
+                pool_metrics::increment(metrics_->queue_timeouts);
+            } else if (ec == error::pool_overloaded) {
+                pool_metrics::increment(metrics_->queue_sheds);
+            }
+        }
+
         if (ec) {
             return handler_(std::move(ec), connection_ptr{});
         }
 
-        auto conn = std::make_shared<connection>(std::forward<Handle>(handle));
-        if (!conn->empty() && connection_good(conn)) {
-            ec = rebind_io_context(conn, io_);
+        auto conn = std::allocate_shared<connection>(allocator_, std::forward<Handle>(handle),
+            std::move(lifespan_.on_expiry), std::move(metrics_), std::move(slot_), std::move(breaker_), std::move(session_reset_));
+        // An expired or dead idle connection is replaced with a new one in the same slot
+        if (!conn->empty() && !conn->expired(now) && idle_connection_usable(*conn, now)) {
+            ec = bind_io_context(*conn);
+            if (!ec) {
+                conn->acquired(now);
+                if (conn->breaker_) {
+                    conn->breaker_->success();
+                }
+            }
             return handler_(std::move(ec), std::move(conn));
         }
 
-        async_get_connection(provider_, wrapper{std::move(handler_), std::move(conn)});
+        async_get_connection(provider_, wrapper{std::move(handler_), std::move(conn), lifespan_.expires_at(now), now});
+    }
+
+    // The liveness check costs a syscall, so it is skipped for a connection
+    // which has been idle for less than the health check interval.
+    bool idle_connection_usable(connection& conn, time_traits::time_point now) const {
+        const auto idle_since = conn.unwrap().idle_since_;
+        if (idle_since != time_traits::time_point::max() && now - idle_since < unchecked_idle_time_) {
+            return !connection_bad(conn);
+        }
+        return idle_connection_alive(conn);
+    }
+
+    // Rebinding re-registers the socket within the reactor, so it is done
+    // only for a connection which is bound to another io_context.
+    error_code bind_io_context(connection& conn) {
+        const void* bound_to = std::addressof(get_io_context(conn));
+        if (bound_to == std::addressof(io_)) {
+            return {};
+        }
+        if (error_code ec = rebind_io_context(conn, io_)) {
+            return ec;
+        }
+        if (conn.metrics_) {
+            pool_metrics::increment(conn.metrics_->rebinds);
+        }
+        return {};
     }
 
     using executor_type = decltype(asio::get_associated_executor(handler_));
@@ -116,12 +622,19 @@ struct pooled_connection_wrapper {
 };
 
 template <typename P, typename IoContext, typename Handler>
-auto wrap_pooled_connection_handler(IoContext& io, P&& provider, Handler&& handler) {
+auto wrap_pooled_connection_handler(IoContext& io, P&& provider, Handler&& handler,
+        connection_lifespan lifespan = connection_lifespan {}, pool_metrics_ptr metrics = nullptr,
+        circuit_breaker_ptr breaker = nullptr, recycling_allocator<void> allocator = {},
+        typename pooled_connection<typename std::decay_t<P>::source_type>::session_reset_type session_reset = {},
+        time_traits::duration unchecked_idle_time = time_traits::duration::zero()) {
 
     static_assert(ConnectionProvider<P>, "is not a ConnectionProvider");
 
+    const auto requested_at = metrics ? time_traits::time_point::clock::now() : time_traits::time_point {};
     return pooled_connection_wrapper<IoContext, std::decay_t<P>, std::decay_t<Handler>> {
-        io, std::forward<P>(provider), std::forward<Handler>(handler)
+        io, std::forward<P>(provider), std::forward<Handler>(handler), std::move(lifespan),
+        std::move(metrics), requested_at, pool_slot {}, std::move(breaker), std::move(allocator),
+        std::move(session_reset), unchecked_idle_time
     };
 }
 
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <libpq-fe.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Connection string parsed by libpq once. The parameters are passed to
+* `PQconnectStartParams()` as keyword/value arrays, so libpq does not parse
+* the string on every connect. Parameters may be overridden per copy without
+* the string rebuilding, the parsed parameters are shared between copies.
+* If the string is invalid the parsing error is kept and the connect goes
+* through `PQconnectStart()` with the original string, so the connection
+* gets the error of libpq.
+*/
+class parsed_conninfo {
+public:
+    explicit parsed_conninfo(std::string str)
+    : params_(std::make_shared<params>(std::move(str))) {}
+
+    bool valid() const noexcept { return params_->error.empty(); }
+
+    const std::string& error() const noexcept { return params_->error; }
+
+    const std::string& str() const noexcept { return params_->str; }
+
+    /**
+    * Returns the value of the parameter or an empty string if the parameter
+    * is not specified.
+    */
+    std::string_view get(std::string_view keyword) const noexcept {
+        const auto overridden = find_override(keyword);
+        if (overridden != overrides_.end()) {
+            return overridden->second;
+        }
+        const auto& keywords = params_->keywords;
+        const auto i = std::find(keywords.begin(), keywords.end(), keyword);
+        return i == keywords.end() ? std::string_view {} : params_->values[std::size_t(i - keywords.begin())];
+    }
+
+    /**
+    * Overrides the parameter value, e.g. `application_name` or `hostaddr`.
+    */
+    parsed_conninfo& set(std::string keyword, std::string value) {
+        const auto overridden = find_override(keyword);
+        if (overridden != overrides_.end()) {
+            overridden->second = std::move(value);
+        } else {
+            overrides_.emplace_back(std::move(keyword), std::move(value));
+        }
+        return *this;
+    }
+
+    /**
+    * Calls `f(const char* const* keywords, const char* const* values)` with
+    * the null-terminated arrays of the parameters for `PQconnectStartParams()`.
+    */
+    template <typename F>
+    decltype(auto) apply(F&& f) const {
+        if (overrides_.empty()) {
+            return f(params_->keyword_ptrs.data(), params_->value_ptrs.data());
+        }
+        std::vector<const char*> keywords(params_->keyword_ptrs.begin(), std::prev(params_->keyword_ptrs.end()));
+        std::vector<const char*> values(params_->value_ptrs.begin(), std::prev(params_->value_ptrs.end()));
+        for (const auto& [keyword, value] : overrides_) {
+            const auto i = std::find_if(keywords.begin(), keywords.end(),
+                [&, &keyword = keyword] (const char* v) { return keyword == v; });
+            if (i == keywords.end()) {
+                keywords.push_back(keyword.c_str());
+                values.push_back(value.c_str());
+            } else {
+                values[std::size_t(i - keywords.begin())] = value.c_str();
+            }
+        }
+        keywords.push_back(nullptr);
+        values.push_back(nullptr);
+        return f(keywords.data(), values.data());
+    }
+
+private:
+    struct params {
+        std::string str;
+        std::string error;
+        std::vector<std::string> keywords;
+        std::vector<std::string> values;
+        std::vector<const char*> keyword_ptrs;
+        std::vector<const char*> value_ptrs;
+
+        explicit params(std::string v) : str(std::move(v)) {
+            char* errmsg = nullptr;
+            std::unique_ptr<PQconninfoOption, decltype(&PQconninfoFree)> options(
+                PQconninfoParse(str.c_str(), &errmsg), &PQconninfoFree);
+            if (errmsg) {
+                error = errmsg;
+                PQfreemem(errmsg);
+            }
+            if (!options) {
+                if (error.empty()) {
+                    error = "out of memory";
+                }
+                return;
+            }
+            for (auto option = options.get(); option->keyword; ++option) {
+                if (option->val) {
+                    keywords.emplace_back(option->keyword);
+                    values.emplace_back(option->val);
+                }
+            }
+            for (std::size_t i = 0; i != keywords.size(); ++i) {
+                keyword_ptrs.push_back(keywords[i].c_str());
+                value_ptrs.push_back(values[i].c_str());
+            }
+            keyword_ptrs.push_back(nullptr);
+            value_ptrs.push_back(nullptr);
+        }
+    };
+
+    using overrides_type = std::vector<std::pair<std::string, std::string>>;
+
+    overrides_type::const_iterator find_override(std::string_view keyword) const noexcept {
+        return std::find_if(overrides_.begin(), overrides_.end(), [&] (const auto& v) { return v.first == keyword; });
+    }
+
+    overrides_type::iterator find_override(std::string_view keyword) noexcept {
+        return std::find_if(overrides_.begin(), overrides_.end(), [&] (const auto& v) { return v.first == keyword; });
+    }
+
+    std::shared_ptr<const params> params_;
+    overrides_type overrides_;
+};
+
+/**
+* Appends the parameter to the connection string as `keyword='value'` with
+* quotes and backslashes of the value escaped, so the value can not be taken
+* for other parameters.
+*/
+inline void append_conninfo_param(std::string& conninfo, std::string_view keyword, std::string_view value) {
+    if (!conninfo.empty()) {
+        conninfo += ' ';
+    }
+    conninfo += keyword;
+    conninfo += "='";
+    for (const char c : value) {
+        if (c == '\'' || c == '\\') {
+            conninfo += '\\';
+        }
+        conninfo += c;
+    }
+    conninfo += '\'';
+}
+
+} // namespace ozo::impl
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <ozo/impl/async_request.h>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <libpq-fe.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Estimation of a latency percentile over a sliding window of the last
+* latency samples. The estimation is recalculated every `window / 16` samples,
+* so reading the delay is a single atomic load.
+*/
+class hedge_delay_estimator {
+public:
+    hedge_delay_estimator(double percentile, time_traits::duration initial_delay,
+            time_traits::duration min_delay, std::size_t window)
+    : percentile_(std::clamp(percentile, 0.0, 1.0)),
+      min_delay_(min_delay),
+      samples_(std::max<std::size_t>(window, 1)),
+      period_(std::max<std::size_t>(samples_.size() / 16, 1)),
+      delay_(std::max(initial_delay, min_delay).count()) {}
+
+    time_traits::duration delay() const noexcept {
+        return time_traits::duration {delay_.load(std::memory_order_relaxed)};
+    }
+
+    void add(time_traits::duration latency) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        samples_[next_] = latency;
+        next_ = (next_ + 1) % samples_.size();
+        size_ = std::min(size_ + 1, samples_.size());
+        if (++added_ % period_ == 0) {
+            update();
+        }
+    }
+
+private:
+    void update() {
+        sorted_.assign(samples_.begin(), samples_.begin() + size_);
+        const auto n = std::min(static_cast<std::size_t>(std::ceil(percentile_ * size_)), size_);
+        const auto nth = sorted_.begin() + (n ? n - 1 : 0);
+        std::nth_element(sorted_.begin(), nth, sorted_.end());
+        delay_.store(std::max(*nth, min_delay_).count(), std::memory_order_relaxed);
+    }
+
+    const double percentile_;
+    const time_traits::duration min_delay_;
+    std::mutex mutex_;
+    std::vector<time_traits::duration> samples_;
+    std::vector<time_traits::duration> sorted_;
+    std::size_t next_ = 0;
+    std::size_t size_ = 0;
+    std::size_t added_ = 0;
+    const std::size_t period_;
+    std::atomic<time_traits::duration::rep> delay_;
+};
+
+struct native_cancel_handle_deleter {
+    void operator ()(PGcancel* handle) const noexcept { PQfreeCancel(handle); }
+};
+
+using native_cancel_handle = std::shared_ptr<PGcancel>;
+
+/**
+* Bounded queue of requests to cancel queries which are sent by a single
+* worker thread. `PQcancel` blocks until the server accepts the request, so
+* it is not called from threads of io_contexts. The worker is started by the
+* first request and joined on destruction. A request is dropped if the queue
+* is full: the cancel is best effort, the connection of a cancelled attempt
+* is closed anyway.
+*/
+class query_cancel_queue {
+public:
+    explicit query_cancel_queue(std::size_t capacity) : capacity_(capacity) {}
+
+    query_cancel_queue(const query_cancel_queue&) = delete;
+    query_cancel_queue& operator =(const query_cancel_queue&) = delete;
+
+    ~query_cancel_queue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            pending_.clear();
+        }
+        cv_.notify_one();
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+    /**
+    * Puts the request into the queue. Returns false if the request is dropped.
+    */
+    bool push(native_cancel_handle handle) noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_ || pending_.size() >= capacity_) {
+            return false;
+        }
+        try {
+            if (!worker_.joinable()) {
+                worker_ = std::thread([this] { run(); });
+            }
+            pending_.push_back(std::move(handle));
+        } catch (const std::exception&) {
+            return false;
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+private:
+    void run() noexcept {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return stopped_ || !pending_.empty(); });
+            if (stopped_) {
+                return;
+            }
+            auto handle = std::move(pending_.front());
+            pending_.pop_front();
+            lock.unlock();
+            char errbuf[256];
+            PQcancel(handle.get(), errbuf, sizeof(errbuf));
+            handle.reset();
+            lock.lock();
+        }
+    }
+
+    const std::size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<native_cancel_handle> pending_;
+    bool stopped_ = false;
+    std::thread worker_;
+};
+
+/**
+* Returns a function which asks the server to cancel the query currently
+* running on the connection via the queue, so the server does not waste its
+* resources on the query of a lost attempt.
+*/
+template <typename Connection>
+inline std::function<void()> make_query_canceller(Connection& conn, std::shared_ptr<query_cancel_queue> queue) {
+    if (!queue) {
+        return {};
+    }
+    native_cancel_handle handle(PQgetCancel(get_native_handle(conn)), native_cancel_handle_deleter {});
+    if (!handle) {
+        return {};
+    }
+    return [handle = std::move(handle), queue = std::move(queue)] {
+        queue->push(handle);
+    };
+}
+
+template <typename Handler, typename Attempt>
+struct hedged_request_context {
+    asio::steady_timer timer;
+    Handler handler;
+    Attempt attempt;
+    std::shared_ptr<hedge_delay_estimator> estimator;
+    std::mutex mutex;
+    bool done = false;
+    std::size_t started = 0;
+    std::array<bool, 2> completed {};
+    std::array<bool, 2> cancelled {};
+    std::array<std::function<void()>, 2> cancel;
+    std::array<time_traits::time_point, 2> started_at {};
+
+    hedged_request_context(io_context& io, Handler handler, Attempt attempt,
+            std::shared_ptr<hedge_delay_estimator> estimator)
+    : timer(io), handler(std::move(handler)), attempt(std::move(attempt)), estimator(std::move(estimator)) {}
+};
+
+/**
+* Race of a request and its hedge. The `Attempt` is called as
+* `attempt(index, op)` to send a copy of the request; it reports the query
+* start via `op.on_start(index, cancel)` and the completion via
+* `op.on_complete(index, ec, conn, commit, discard)`, where `commit(conn)`
+* moves the result of the attempt to the user's output and is called for
+* the winner only.
+*
+* If `op.on_start()` returns false the race is already over and the attempt
+* must not send its query. The query of the attempt which is running when
+* the other one wins is cancelled, and `discard(conn)` is called for its
+* connection on completion: the cancel request may reach the server at any
+* time later, so the connection can not be reused by other requests.
+*/
+template <typename Context>
+struct hedged_request_op {
+    std::shared_ptr<Context> ctx_;
+
+    void perform() {
+        const auto delay = ctx_->estimator->delay();
+        ctx_->timer.expires_after(delay);
+        ctx_->timer.async_wait([op = *this] (error_code ec) mutable {
+            if (ec != asio::error::operation_aborted) {
+                op.launch(1);
+            }
+        });
+        launch(0);
+    }
+
+    void launch(std::size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(ctx_->mutex);
+            if (ctx_->done || ctx_->started != index) {
+                return;
+            }
+            ctx_->started = index + 1;
+            ctx_->started_at[index] = time_traits::time_point::clock::now();
+        }
+        ctx_->attempt(index, *this);
+    }
+
+    bool on_start(std::size_t index, std::function<void()> cancel) {
+        std::lock_guard<std::mutex> lock(ctx_->mutex);
+        if (ctx_->done) {
+            return false;
+        }
+        ctx_->cancel[index] = std::move(cancel);
+        return true;
+    }
+
+    template <typename Connection, typename Commit, typename Discard>
+    void on_complete(std::size_t index, error_code ec, Connection&& conn, Commit&& commit, Discard&& discard) {
+        std::function<void()> cancel;
+        {
+            std::unique_lock<std::mutex> lock(ctx_->mutex);
+            ctx_->completed[index] = true;
+            if (ctx_->done) {
+                const bool cancelled = ctx_->cancelled[index];
+                lock.unlock();
+                if (cancelled) {
+                    discard(conn);
+                }
+                return;
+            }
+            const auto other = 1 - index;
+            const bool other_running = other < ctx_->started && !ctx_->completed[other];
+            if (ec && other_running) {
+                return;
+            }
+            ctx_->done = true;
+            if (other_running) {
+                cancel = std::move(ctx_->cancel[other]);
+                ctx_->cancelled[other] = true;
+            }
+        }
+
+        ctx_->timer.cancel();
+        if (cancel) {
+            cancel();
+        }
+        if (!ec) {
+            ctx_->estimator->add(time_traits::time_point::clock::now() - ctx_->started_at[index]);
+            ec = commit(conn);
+        }
+        ctx_->handler(std::move(ec), std::forward<Connection>(conn));
+    }
+};
+
+template <typename Out>
+struct hedged_request_commit {
+    std::shared_ptr<native_result_handle> result;
+    Out out;
+
+    template <typename Connection>
+    error_code operator ()(Connection& conn) {
+        if (!*result) {
+            return {};
+        }
+        try {
+            auto res = ozo::make_result(std::move(*result));
+            ozo::recv_result(res, get_oid_map(conn), out);
+        } catch (const std::exception& e) {
+            set_error_context(conn, e.what());
+            return error::bad_result_process;
+        }
+        return {};
+    }
+};
+
+struct hedged_request_out_handler {
+    std::shared_ptr<native_result_handle> result;
+
+    template <typename Handle, typename Connection>
+    void operator ()(Handle&& h, Connection&) {
+        *result = std::forward<Handle>(h);
+    }
+};
+
+/**
+* Sends a copy of the request via a connection of the provider. Each copy
+* keeps the raw result, only the result of the winner is converted into
+* the user's output.
+*/
+template <typename Provider, typename Query, typename Out>
+struct hedged_request_attempt {
+    Provider provider;
+    Query query;
+    time_traits::duration timeout;
+    Out out;
+    std::shared_ptr<query_cancel_queue> cancels;
+
+    template <typename Op>
+    void operator ()(std::size_t index, Op op) const {
+        auto result = std::make_shared<native_result_handle>();
+        auto provider_copy = provider;
+        async_get_connection(provider_copy,
+            [op, index, result, query = query, timeout = timeout, out = out, cancels = cancels]
+                    (error_code ec, auto conn) mutable {
+                // The connection of an attempt which lost before its query is sent is returned as is
+                if (!ec && !op.on_start(index, make_query_canceller(conn, std::move(cancels)))) {
+                    return;
+                }
+                auto commit = hedged_request_commit<Out> {result, std::move(out)};
+                make_async_request_op(std::move(query), timeout, hedged_request_out_handler {result},
+                    [op, index, commit = std::move(commit)] (error_code ec, auto conn) mutable {
+                        op.on_complete(index, std::move(ec), std::move(conn), commit,
+                            [] (auto& conn) { close_connection(conn); });
+                    })(std::move(ec), std::move(conn));
+            });
+    }
+};
+
+template <typename Attempt, typename Handler>
+inline void async_hedged(io_context& io, std::shared_ptr<hedge_delay_estimator> estimator,
+        Attempt&& attempt, Handler&& handler) {
+    using context_type = hedged_request_context<std::decay_t<Handler>, std::decay_t<Attempt>>;
+    hedged_request_op<context_type> {
+        std::make_shared<context_type>(io, std::forward<Handler>(handler),
+            std::forward<Attempt>(attempt), std::move(estimator))
+    }.perform();
+}
+
+template <typename P, typename Q, typename Out, typename Handler>
+inline void async_hedged_request(io_context& io, std::shared_ptr<hedge_delay_estimator> estimator,
+        std::shared_ptr<query_cancel_queue> cancels, P&& provider, Q&& query, const time_traits::duration& timeout,
+        Out&& out, Handler&& handler) {
+    static_assert(ConnectionProvider<P>, "is not a ConnectionProvider");
+    static_assert(Query<Q> || QueryBuilder<Q>, "is neither Query nor QueryBuilder");
+    using attempt_type = hedged_request_attempt<std::decay_t<P>, std::decay_t<Q>, std::decay_t<Out>>;
+    async_hedged(io, std::move(estimator),
+        attempt_type {std::forward<P>(provider), std::forward<Q>(query), timeout, std::forward<Out>(out),
+            std::move(cancels)},
+        std::forward<Handler>(handler));
+}
+
+} // namespace ozo::impl
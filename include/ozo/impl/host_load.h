@@ -0,0 +1,75 @@
+#pragma once
+
+#include <ozo/time_traits.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+
+namespace ozo::impl {
+
+/**
+* Load of a host: number of connections in use and a moving average of the
+* time to get a connection from the host ready for a request, i.e. the connect
+* and the first response of the host. The time the connection is held by its
+* user is not taken into account. The average is weighted by time and jumps
+* up to a greater sample at once (peak EWMA), so a host which gets slow is
+* avoided immediately. It decays to zero while there are no samples, so a host
+* which was slow once gets requests again later.
+*/
+class host_load {
+public:
+    explicit host_load(time_traits::duration decay = std::chrono::seconds(10)) noexcept : decay_(decay) {}
+
+    void acquire() noexcept {
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(time_traits::duration latency, time_traits::time_point now) noexcept {
+        const auto sample = static_cast<double>(latency.count());
+        const auto weight = decay_weight(now);
+        auto average = latency_.load(std::memory_order_relaxed);
+        while (!latency_.compare_exchange_weak(average,
+                sample > average ? sample : average * weight + sample * (1 - weight),
+                std::memory_order_relaxed)) {}
+        updated_at_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::size_t in_flight() const noexcept {
+        return in_flight_.load(std::memory_order_relaxed);
+    }
+
+    double latency(time_traits::time_point now) const noexcept {
+        return latency_.load(std::memory_order_relaxed) * decay_weight(now);
+    }
+
+    /**
+    * Expected time of a request to the host: the average latency for each
+    * request in flight and the new one.
+    */
+    double cost(time_traits::time_point now) const noexcept {
+        return (latency(now) + 1) * static_cast<double>(in_flight() + 1);
+    }
+
+private:
+    double decay_weight(time_traits::time_point now) const noexcept {
+        const time_traits::time_point at {time_traits::duration(updated_at_.load(std::memory_order_relaxed))};
+        if (at == time_traits::time_point {} || decay_ <= time_traits::duration::zero()) {
+            return 0;
+        }
+        const auto elapsed = std::max(now - at, time_traits::duration::zero());
+        return std::exp(-std::chrono::duration<double>(elapsed) / std::chrono::duration<double>(decay_));
+    }
+
+    const time_traits::duration decay_;
+    std::atomic<std::size_t> in_flight_ {0};
+    std::atomic<double> latency_ {0};
+    std::atomic<time_traits::time_point::rep> updated_at_ {0};
+};
+
+using host_load_ptr = std::shared_ptr<host_load>;
+
+} // namespace ozo::impl
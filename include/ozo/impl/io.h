@@ -5,6 +5,7 @@
 #include <ozo/error.h>
 #include <ozo/io/binary_query.h>
 #include <ozo/detail/bind.h>
+#include <ozo/impl/conninfo.h>
 #include <ozo/impl/result_status.h>
 #include <ozo/impl/result.h>
 
@@ -12,6 +13,16 @@
 
 #include <libpq-fe.h>
 
+#include <poll.h>
+
+/**
+* Pipeline mode of libpq is available since PostgreSQL 14. It can be disabled
+* explicitly to send requests of a multiplexed connection one by one.
+*/
+#if defined(LIBPQ_HAS_PIPELINING) && !defined(OZO_DISABLE_PIPELINING)
+#define OZO_HAS_PIPELINING
+#endif
+
 namespace ozo::impl {
 
 /**
@@ -44,6 +55,21 @@ inline error_code pq_start_connection(T& conn, const std::string& conninfo) {
     return {};
 }
 
+template <typename T>
+inline error_code pq_start_connection(T& conn, const parsed_conninfo& conninfo) {
+    static_assert(Connection<T>, "T must be a Connection");
+    native_conn_handle handle(conninfo.valid()
+        ? conninfo.apply([] (const char* const* keywords, const char* const* values) {
+            return PQconnectStartParams(keywords, values, 0);
+        })
+        : PQconnectStart(conninfo.str().c_str()));
+    if (!handle) {
+        return make_error_code(error::pq_connection_start_failed);
+    }
+    get_handle(conn) = std::move(handle);
+    return {};
+}
+
 template <typename T>
 inline error_code pq_assign_socket(T& conn) {
     static_assert(Connection<T>, "T must be a Connection");
@@ -77,7 +103,7 @@ inline int pq_send_query_params(T& conn, const binary_query<Ts...>& q) noexcept
                 q.values(),
                 q.lengths(),
                 q.formats(),
-                int(result_format::binary)
+                int(q.result_format())
             );
 }
 
@@ -93,6 +119,13 @@ inline int pq_consume_input(T& conn) noexcept {
     return PQconsumeInput(get_native_handle(conn));
 }
 
+template <typename T>
+inline bool pq_input_pending(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    pollfd fd {PQsocket(get_native_handle(conn)), POLLIN, 0};
+    return ::poll(&fd, 1, 0) > 0;
+}
+
 template <typename T>
 inline bool pq_is_busy(T& conn) noexcept {
     static_assert(Connection<T>, "T must be a Connection");
@@ -111,6 +144,28 @@ inline native_result_handle pq_get_result(T& conn) noexcept {
     return native_result_handle(PQgetResult(get_native_handle(conn)));
 }
 
+#ifdef OZO_HAS_PIPELINING
+
+template <typename T>
+inline int pq_enter_pipeline_mode(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    return PQenterPipelineMode(get_native_handle(conn));
+}
+
+template <typename T>
+inline int pq_exit_pipeline_mode(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    return PQexitPipelineMode(get_native_handle(conn));
+}
+
+template <typename T>
+inline int pq_pipeline_sync(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    return PQpipelineSync(get_native_handle(conn));
+}
+
+#endif
+
 inline ExecStatusType pq_result_status(const PGresult& res) noexcept {
     return PQresultStatus(std::addressof(res));
 }
@@ -124,8 +179,8 @@ inline error_code pq_result_error(const PGresult& res) noexcept {
 
 } // namespace pq
 
-template <typename T>
-inline error_code start_connection(T& conn, const std::string& conninfo) {
+template <typename T, typename ConnInfo>
+inline error_code start_connection(T& conn, const ConnInfo& conninfo) {
     static_assert(Connection<T>, "T must be a Connection");
     using pq::pq_start_connection;
     return pq_start_connection(unwrap_connection(conn), conninfo);
@@ -190,6 +245,25 @@ inline error_code consume_input(T& conn) noexcept {
     return {};
 }
 
+/**
+* Checks liveness of an idle connection without a round trip to the server.
+* A socket of an idle connection becomes readable only if the server has
+* closed the connection or sent an asynchronous message, so the input is
+* consumed only in that case.
+*/
+template <typename T>
+inline bool idle_connection_alive(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    using pq::pq_input_pending;
+    if (connection_bad(conn)) {
+        return false;
+    }
+    if (pq_input_pending(unwrap_connection(conn)) && consume_input(conn)) {
+        return false;
+    }
+    return connection_good(conn);
+}
+
 template <typename T>
 inline bool is_busy(T& conn) noexcept {
     static_assert(Connection<T>, "T must be a Connection");
@@ -211,6 +285,40 @@ inline decltype(auto) get_result(T& conn) noexcept {
     return pq_get_result(unwrap_connection(conn));
 }
 
+#ifdef OZO_HAS_PIPELINING
+
+template <typename T>
+inline error_code enter_pipeline_mode(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    using pq::pq_enter_pipeline_mode;
+    if (!pq_enter_pipeline_mode(unwrap_connection(conn))) {
+        return error::pg_pipeline_failed;
+    }
+    return {};
+}
+
+/**
+* Exits pipeline mode, it fails if results of sent queries are not received yet.
+*/
+template <typename T>
+inline bool exit_pipeline_mode(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    using pq::pq_exit_pipeline_mode;
+    return pq_exit_pipeline_mode(unwrap_connection(conn));
+}
+
+template <typename T>
+inline error_code pipeline_sync(T& conn) noexcept {
+    static_assert(Connection<T>, "T must be a Connection");
+    using pq::pq_pipeline_sync;
+    if (!pq_pipeline_sync(unwrap_connection(conn))) {
+        return error::pg_pipeline_failed;
+    }
+    return {};
+}
+
+#endif
+
 template <typename T>
 inline ExecStatusType result_status(T&& res) noexcept {
     using pq::pq_result_status;
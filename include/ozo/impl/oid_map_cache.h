@@ -0,0 +1,175 @@
+#pragma once
+
+#include <ozo/type_traits.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Thread-safe cache of custom types OIDs resolved for connection targets.
+* OIDs are stored in the order of the #OidMap keys, so a cache instance
+* must be used with a single #OidMap type, see `get_oid_map_cache()`.
+*
+* The cache is filled once per target: while OIDs are being requested for
+* a target, other lookups of the target wait for the pending fill instead
+* of requesting the same OIDs, e.g. on reconnection of all connections.
+*/
+class oid_map_cache {
+public:
+    using oids_type = std::vector<oid_t>;
+
+    /**
+    * Lookup waiting for a pending fill. It is resumed when the fill is
+    * finished either way, so it has to look the target up again.
+    */
+    struct waiter {
+        virtual ~waiter() = default;
+        virtual void resume() = 0;
+    };
+
+    enum class lookup_result {
+        found, //!< OIDs are taken from the cache
+        fill, //!< the caller has to request OIDs and put them, or cancel the fill
+        wait, //!< the waiter is resumed when the pending fill is finished
+    };
+
+    template <typename MakeWaiter>
+    lookup_result lookup(const std::string& target, oids_type& oids, MakeWaiter&& make_waiter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto i = entries_.find(target);
+        if (i != entries_.end()) {
+            oids = i->second;
+            return lookup_result::found;
+        }
+        const auto pending = pending_.find(target);
+        if (pending == pending_.end()) {
+            pending_.emplace(target, std::vector<std::unique_ptr<waiter>> {});
+            return lookup_result::fill;
+        }
+        pending->second.push_back(make_waiter());
+        return lookup_result::wait;
+    }
+
+    bool get(const std::string& target, oids_type& oids) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto i = entries_.find(target);
+        if (i == entries_.end()) {
+            return false;
+        }
+        oids = i->second;
+        return true;
+    }
+
+    void put(const std::string& target, oids_type oids) {
+        std::vector<std::unique_ptr<waiter>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_[target] = std::move(oids);
+            take_waiters(target, waiters);
+        }
+        resume(waiters);
+    }
+
+    void cancel_fill(const std::string& target) {
+        std::vector<std::unique_ptr<waiter>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            take_waiters(target, waiters);
+        }
+        resume(waiters);
+    }
+
+    void invalidate(const std::string& target) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(target);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+private:
+    void take_waiters(const std::string& target, std::vector<std::unique_ptr<waiter>>& waiters) {
+        const auto pending = pending_.find(target);
+        if (pending != pending_.end()) {
+            waiters = std::move(pending->second);
+            pending_.erase(pending);
+        }
+    }
+
+    static void resume(std::vector<std::unique_ptr<waiter>>& waiters) noexcept {
+        for (auto& w : waiters) {
+            try {
+                w->resume();
+            } catch (...) {}
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, oids_type> entries_;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<waiter>>> pending_;
+};
+
+/**
+* Pending fill of the cache for a target. The fill is cancelled if it is not
+* completed, so lookups waiting for it are not left waiting forever.
+*/
+class oid_map_cache_fill {
+public:
+    oid_map_cache_fill(oid_map_cache& cache, std::string target)
+    : cache_(std::addressof(cache)), target_(std::move(target)) {}
+
+    oid_map_cache_fill(oid_map_cache_fill&& other) noexcept
+    : cache_(std::exchange(other.cache_, nullptr)), target_(std::move(other.target_)) {}
+
+    oid_map_cache_fill& operator =(oid_map_cache_fill&&) = delete;
+
+    ~oid_map_cache_fill() { cancel(); }
+
+    void complete(oid_map_cache::oids_type oids) {
+        if (cache_) {
+            cache_->put(target_, std::move(oids));
+            cache_ = nullptr;
+        }
+    }
+
+    void cancel() noexcept {
+        if (auto cache = std::exchange(cache_, nullptr)) {
+            try {
+                cache->cancel_fill(target_);
+            } catch (...) {}
+        }
+    }
+
+private:
+    oid_map_cache* cache_;
+    std::string target_;
+};
+
+/**
+* Process-wide OIDs cache for the #OidMap type.
+*/
+template <typename OidMap>
+inline oid_map_cache& get_oid_map_cache() {
+    static oid_map_cache instance;
+    return instance;
+}
+
+template <typename Impl>
+inline oid_map_cache::oids_type get_oids(const oid_map_t<Impl>& oid_map) {
+    oid_map_cache::oids_type retval;
+    retval.reserve(hana::length(oid_map.impl));
+    hana::for_each(hana::values(oid_map.impl), [&] (oid_t oid) {
+        retval.push_back(oid);
+    });
+    return retval;
+}
+
+} // namespace ozo::impl
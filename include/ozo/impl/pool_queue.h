@@ -0,0 +1,456 @@
+#pragma once
+
+#include <ozo/asio.h>
+#include <ozo/error.h>
+#include <ozo/impl/recycling_allocator.h>
+#include <ozo/time_traits.h>
+#include <ozo/detail/bind.h>
+
+#include <yamail/resource_pool/async/pool.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace ozo::impl {
+
+class pool_queue;
+
+/**
+* AIMD controller of the effective capacity of the pool. The capacity is
+* updated once per window of released slots, the window size is equal to
+* the current capacity. If a slot was held longer than the baseline latency
+* multiplied by the tolerance, the capacity is decreased multiplicatively,
+* otherwise if requests were waiting in the queue it is increased by one.
+* The baseline follows the minimum observed latency and slowly drifts to
+* the current one, so a persistent change of the latency is accepted.
+*/
+class adaptive_capacity {
+public:
+    adaptive_capacity(std::size_t min, std::size_t max, double latency_tolerance) noexcept
+    : min_(std::min(std::max<std::size_t>(min, 1), max)), max_(max), limit_(max),
+      tolerance_(latency_tolerance) {}
+
+    bool enabled() const noexcept { return min_ < max_; }
+
+    std::size_t limit() const noexcept { return limit_; }
+
+    std::size_t update(time_traits::duration latency, bool queued) noexcept {
+        if (!enabled()) {
+            return limit_;
+        }
+        if (baseline_ == time_traits::duration::zero() || latency < baseline_) {
+            baseline_ = latency;
+        } else {
+            baseline_ += (latency - baseline_) / 64;
+        }
+        overloaded_ = overloaded_ || latency.count() > baseline_.count() * tolerance_;
+        queued_ = queued_ || queued;
+        if (++samples_ < limit_) {
+            return limit_;
+        }
+        if (overloaded_) {
+            limit_ = std::max(min_, std::min(limit_ - 1, static_cast<std::size_t>(limit_ * decrease_factor)));
+        } else if (queued_) {
+            limit_ = std::min(max_, limit_ + 1);
+        }
+        samples_ = 0;
+        overloaded_ = false;
+        queued_ = false;
+        return limit_;
+    }
+
+private:
+    static constexpr double decrease_factor = 0.9;
+
+    std::size_t min_;
+    std::size_t max_;
+    std::size_t limit_;
+    double tolerance_;
+    time_traits::duration baseline_ = time_traits::duration::zero();
+    std::size_t samples_ = 0;
+    bool overloaded_ = false;
+    bool queued_ = false;
+};
+
+/**
+* CoDel-like detector of the queue overload. The queue is overloaded if
+* the minimum time requests waited in the queue during the last interval
+* exceeded the target, i.e. the queue has not been drained once during
+* the interval. A request which got a slot without waiting resets the minimum.
+* The target of `duration::max()` disables the detector.
+*/
+class queue_delay_controller {
+public:
+    queue_delay_controller(time_traits::duration target, time_traits::duration interval) noexcept
+    : target_(target), interval_(interval) {}
+
+    bool enabled() const noexcept { return target_ != time_traits::duration::max(); }
+
+    time_traits::duration target() const noexcept { return target_; }
+
+    void sample(time_traits::duration delay, time_traits::time_point now, bool queued) noexcept {
+        if (enabled()) {
+            roll(now, queued);
+            min_delay_ = std::min(min_delay_, delay);
+        }
+    }
+
+    bool overloaded(time_traits::time_point now, bool queued) noexcept {
+        if (enabled()) {
+            roll(now, queued);
+        }
+        return overloaded_;
+    }
+
+private:
+    void roll(time_traits::time_point now, bool queued) noexcept {
+        if (now - started_at_ < interval_) {
+            return;
+        }
+        overloaded_ = min_delay_ == time_traits::duration::max() ? queued : min_delay_ > target_;
+        min_delay_ = time_traits::duration::max();
+        started_at_ = now;
+    }
+
+    time_traits::duration target_;
+    time_traits::duration interval_;
+    time_traits::time_point started_at_ = time_traits::time_point::clock::now();
+    time_traits::duration min_delay_ = time_traits::duration::max();
+    bool overloaded_ = false;
+};
+
+/**
+* State shared by copies of a slot. The queue preallocates a state for each
+* slot of its capacity, so a slot is taken and returned without allocation.
+*/
+struct pool_slot_state {
+    std::atomic<std::size_t> refs {0};
+    std::shared_ptr<pool_queue> queue; // keeps the queue alive while the slot is held
+    time_traits::time_point started_at;
+    bool measured = true;
+};
+
+/**
+* Permission to acquire a connection from the pool. It is shared by copies
+* and returned to the queue when the last copy is destroyed, then it is
+* passed to the first of waiting requests. The time a not measured slot is
+* held is not taken into account by the capacity controller.
+*/
+class pool_slot {
+public:
+    pool_slot() = default;
+
+    pool_slot(const pool_slot& other) noexcept : state_(other.state_) {
+        if (state_) {
+            state_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    pool_slot(pool_slot&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+
+    pool_slot& operator =(pool_slot other) noexcept {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    ~pool_slot() { release(); }
+
+    bool empty() const noexcept { return !state_; }
+
+    inline void release() noexcept;
+
+private:
+    friend class pool_queue;
+
+    explicit pool_slot(pool_slot_state* state) noexcept : state_(state) {}
+
+    pool_slot_state* state_ = nullptr;
+};
+
+/**
+* Queue of requests to the pool with priorities. It limits number of
+* requests which are acquiring or holding a connection by the effective
+* capacity of the pool, see `adaptive_capacity`.
+* Other requests wait in the queue and get a slot released by a previous
+* request in the order of priority, requests of the same priority are served
+* in FIFO order. A waiting request fails with the resource pool errors on
+* the queue overflow or timeout, just like requests to the pool itself.
+* If the queue is overloaded, see `queue_delay_controller`, requests are
+* served in LIFO order and a request which waits longer than the target delay
+* fails fast with `error::pool_overloaded`, so fresh requests are served
+* in time instead of all requests timing out.
+*/
+class pool_queue {
+public:
+    static constexpr std::size_t priorities_count = 3;
+
+    pool_queue(std::size_t capacity, std::size_t queue_capacity, std::size_t min_capacity = 0,
+            double latency_tolerance = 2.0, time_traits::duration delay_target = time_traits::duration::max(),
+            time_traits::duration delay_interval = std::chrono::milliseconds(100))
+    : capacity_(min_capacity, capacity, latency_tolerance), delay_(delay_target, delay_interval),
+      queue_capacity_(queue_capacity), slots_(std::make_unique<pool_slot_state[]>(capacity)),
+      waiters_memory_(std::make_shared<block_cache>(queue_capacity)) {
+        free_slots_.reserve(capacity);
+        for (std::size_t i = capacity; i != 0; --i) {
+            free_slots_.push_back(std::addressof(slots_[i - 1]));
+        }
+    }
+
+    pool_queue(const pool_queue&) = delete;
+    pool_queue& operator =(const pool_queue&) = delete;
+
+    /**
+    * Invokes the handler with a slot immediately if there is a free one, or
+    * puts the request into the queue. The handler signature is
+    * `void(error_code, pool_slot)`.
+    */
+    template <typename Handler>
+    void enter(const std::shared_ptr<pool_queue>& self, io_context& io, std::size_t priority,
+            time_traits::duration timeout, Handler&& handler) {
+        const auto now = time_traits::time_point::clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (in_flight_ < capacity_.limit() && waiting_ == 0) {
+            ++in_flight_;
+            delay_.sample(time_traits::duration::zero(), now, false);
+            auto slot = take_slot(self, now);
+            lock.unlock();
+            return handler(error_code {}, std::move(slot));
+        }
+
+        if (waiting_ >= queue_capacity_) {
+            lock.unlock();
+            return asio::post(io, [handler = std::forward<Handler>(handler)] () mutable {
+                handler(error_code {yamail::resource_pool::error::request_queue_overflow}, pool_slot {});
+            });
+        }
+
+        const bool shed = delay_.overloaded(now, waiting_ != 0) && delay_.target() < timeout;
+        using waiter_type = waiter_impl<std::decay_t<Handler>>;
+        auto w = std::allocate_shared<waiter_type>(recycling_allocator<waiter_type> {waiters_memory_},
+            io, std::forward<Handler>(handler), now);
+        waiters_[std::min(priority, priorities_count - 1)].push_back(w);
+        ++waiting_;
+        w->timer_.expires_after(shed ? delay_.target() : timeout);
+        w->timer_.async_wait([self, w, shed] (error_code ec) {
+            if (ec == asio::error::operation_aborted || w->done_.exchange(true)) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(self->mutex_);
+                self->erase_waiter(w);
+                --self->waiting_;
+            }
+            w->run(shed ? error_code {error::pool_overloaded}
+                : error_code {yamail::resource_pool::error::get_resource_timeout});
+        });
+    }
+
+    /**
+    * Returns a free slot if there is one and no request is waiting for it,
+    * otherwise returns an empty slot. A not measured slot suits short
+    * background tasks which must not affect the effective capacity.
+    */
+    pool_slot try_enter(const std::shared_ptr<pool_queue>& self, bool measured = false) {
+        const auto now = time_traits::time_point::clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (in_flight_ >= capacity_.limit() || waiting_ != 0) {
+            return pool_slot {};
+        }
+        ++in_flight_;
+        if (measured) {
+            delay_.sample(time_traits::duration::zero(), now, false);
+        }
+        return take_slot(self, now, measured);
+    }
+
+    std::size_t limit() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_.limit();
+    }
+
+    std::size_t in_flight() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return in_flight_;
+    }
+
+    std::size_t waiting() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return waiting_;
+    }
+
+private:
+    friend class pool_slot;
+
+    // Takes a preallocated state for a new slot, must be called under the
+    // lock. There are no more slots in flight than the capacity, so there is
+    // always a free state.
+    pool_slot take_slot(const std::shared_ptr<pool_queue>& self, time_traits::time_point now,
+            bool measured = true) noexcept {
+        const auto state = free_slots_.back();
+        free_slots_.pop_back();
+        state->refs.store(1, std::memory_order_relaxed);
+        state->queue = self;
+        state->started_at = now;
+        state->measured = measured;
+        return pool_slot {state};
+    }
+
+    // Returns the state of the last destroyed copy of a slot. The queue is
+    // kept alive by the state until the release is done.
+    static void release_slot(pool_slot_state& state) noexcept {
+        const auto self = std::move(state.queue);
+        self->release(self, state);
+    }
+
+    // Frees the slot and passes free slots to the waiting requests with the
+    // highest priority. Waiters are woken one at a time, the lock is released
+    // while a waiter is posted to its io_context, so nothing is collected.
+    void release(const std::shared_ptr<pool_queue>& self, pool_slot_state& state) noexcept {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const auto now = time_traits::time_point::clock::now();
+        const auto held = now - state.started_at;
+        const auto measured = state.measured;
+        free_slots_.push_back(std::addressof(state));
+        --in_flight_;
+        if (measured) {
+            capacity_.update(held, waiting_ != 0);
+        }
+        const bool overloaded = delay_.overloaded(now, waiting_ != 0);
+        if (overloaded) {
+            while (auto w = pop_stale_waiter(now - delay_.target())) {
+                --waiting_;
+                lock.unlock();
+                wake(std::move(w), error_code {error::pool_overloaded});
+                lock.lock();
+            }
+        }
+        while (in_flight_ < capacity_.limit()) {
+            auto w = pop_waiter(overloaded);
+            if (!w) {
+                break;
+            }
+            delay_.sample(now - w->enqueued_at_, now, true);
+            w->slot_ = take_slot(self, now);
+            ++in_flight_;
+            --waiting_;
+            lock.unlock();
+            wake(std::move(w), error_code {});
+            lock.lock();
+        }
+    }
+
+    struct waiter {
+        io_context& io_;
+        asio::steady_timer timer_;
+        std::atomic<bool> done_ {false};
+        pool_slot slot_;
+        time_traits::time_point enqueued_at_;
+
+        waiter(io_context& io, time_traits::time_point enqueued_at)
+        : io_(io), timer_(io), enqueued_at_(enqueued_at) {}
+
+        virtual ~waiter() = default;
+
+        virtual void run(error_code ec) = 0;
+    };
+
+    // The handler is destroyed after it is invoked, so the state it holds
+    // is not kept alive by the waiter, e.g. by a post to the io_context.
+    template <typename Handler>
+    struct waiter_impl : waiter {
+        std::optional<Handler> handler_;
+
+        waiter_impl(io_context& io, Handler handler, time_traits::time_point enqueued_at)
+        : waiter(io, enqueued_at), handler_(std::move(handler)) {}
+
+        void run(error_code ec) override {
+            auto handler = std::move(*handler_);
+            handler_.reset();
+            handler(std::move(ec), std::move(this->slot_));
+        }
+    };
+
+    // Must be called without the lock, since a waiter which is failed to be
+    // posted is destroyed along with its slot.
+    static void wake(std::shared_ptr<waiter> w, error_code ec) noexcept {
+        try {
+            auto& io = w->io_;
+            asio::post(io, [w = std::move(w), ec] {
+                w->timer_.cancel();
+                w->run(ec);
+            });
+        } catch (...) {}
+    }
+
+    // Removes a timed out waiter, so the queue does not hold it until it
+    // is reached by a released slot.
+    void erase_waiter(const std::shared_ptr<waiter>& w) noexcept {
+        for (auto& waiters : waiters_) {
+            const auto it = std::find(waiters.begin(), waiters.end(), w);
+            if (it != waiters.end()) {
+                waiters.erase(it);
+                return;
+            }
+        }
+    }
+
+    std::shared_ptr<waiter> pop_waiter(bool lifo = false) noexcept {
+        for (auto i = priorities_count; i != 0; --i) {
+            auto& waiters = waiters_[i - 1];
+            while (!waiters.empty()) {
+                auto w = std::move(lifo ? waiters.back() : waiters.front());
+                lifo ? waiters.pop_back() : waiters.pop_front();
+                if (!w->done_.exchange(true)) {
+                    return w;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // Waiters are ordered by the enqueue time within a priority, so stale
+    // ones are at the front.
+    std::shared_ptr<waiter> pop_stale_waiter(time_traits::time_point enqueued_before) noexcept {
+        for (auto& waiters : waiters_) {
+            while (!waiters.empty() && waiters.front()->enqueued_at_ < enqueued_before) {
+                auto w = std::move(waiters.front());
+                waiters.pop_front();
+                if (!w->done_.exchange(true)) {
+                    return w;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    mutable std::mutex mutex_;
+    adaptive_capacity capacity_;
+    queue_delay_controller delay_;
+    std::size_t queue_capacity_;
+    std::size_t in_flight_ = 0;
+    std::size_t waiting_ = 0;
+    std::array<std::deque<std::shared_ptr<waiter>>, priorities_count> waiters_;
+    std::unique_ptr<pool_slot_state[]> slots_;
+    std::vector<pool_slot_state*> free_slots_;
+    std::shared_ptr<block_cache> waiters_memory_;
+};
+
+inline void pool_slot::release() noexcept {
+    const auto state = std::exchange(state_, nullptr);
+    if (state && state->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        pool_queue::release_slot(*state);
+    }
+}
+
+} // namespace ozo::impl
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <ozo/impl/connection_pool.h>
+#include <ozo/connector.h>
+#include <ozo/detail/bind.h>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Joins parallel connection acquisitions of a warm up. An idle connection is
+* returned to the pool at once, which renews its idle time. A newly opened
+* connection is held until all of the acquisitions are done, so the rest of
+* them open new connections instead of reusing a just opened one.
+*/
+template <typename Source, typename Handler>
+class warm_up_join {
+    struct context {
+        Handler handler;
+        std::atomic<std::size_t> pending;
+        std::shared_ptr<void> guard;
+        std::mutex mutex;
+        error_code error;
+        std::vector<pooled_connection_ptr<Source>> connections;
+
+        context(Handler&& handler, std::size_t pending, std::shared_ptr<void> guard)
+        : handler(std::move(handler)), pending(pending), guard(std::move(guard)) {
+            connections.reserve(pending);
+        }
+    };
+
+    std::shared_ptr<context> ctx_;
+
+public:
+    warm_up_join(Handler handler, std::size_t pending, std::shared_ptr<void> guard)
+    : ctx_(std::make_shared<context>(std::move(handler), pending, std::move(guard))) {}
+
+    void operator ()(error_code ec, pooled_connection_ptr<Source> conn) {
+        {
+            std::lock_guard<std::mutex> lock(ctx_->mutex);
+            if (ec && !ctx_->error) {
+                ctx_->error = std::move(ec);
+            }
+            // A connection which has never been returned to the pool is a new one
+            if (conn && unwrap_connection(conn).idle_since_ == time_traits::time_point::max()) {
+                ctx_->connections.push_back(std::move(conn));
+            }
+        }
+        if (ctx_->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ctx_->connections.clear();
+            ctx_->handler(std::move(ctx_->error));
+        }
+    }
+
+    using executor_type = decltype(asio::get_associated_executor(std::declval<const Handler&>()));
+
+    auto get_executor() const noexcept {
+        return asio::get_associated_executor(ctx_->handler);
+    }
+};
+
+template <typename Source, typename Handler>
+void open_connections(std::shared_ptr<pool_state<Source>> state, io_context& io, std::size_t shard,
+        std::size_t count, time_traits::duration connect_timeout, time_traits::duration queue_timeout,
+        Handler&& handler);
+
+/**
+* Opens a replacement of an expired connection if the shard has room for it.
+* The pool gives out idle connections before empty slots, so all the idle
+* connections are acquired along with an empty slot. The idle ones are
+* returned at once, see `warm_up_join`.
+*/
+template <typename Source>
+void reopen_expired_connection(std::shared_ptr<void> state, io_context& io,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout) {
+    auto pool_state = std::static_pointer_cast<impl::pool_state<Source>>(std::move(state));
+    const auto shard = pool_state->shards.local(std::addressof(io));
+    const auto& pool = pool_state->shards[shard];
+    if (pool.size() >= pool.capacity()) {
+        return;
+    }
+    const auto count = pool.available() + 1;
+    open_connections(std::move(pool_state), io, shard, count, connect_timeout, queue_timeout, [] (error_code) {});
+}
+
+/**
+* Returns lifespan of the pool connections which opens a replacement of an
+* expired connection in background when the connection is closed.
+*/
+template <typename Source>
+connection_lifespan make_connection_lifespan(const std::shared_ptr<pool_state<Source>>& state, io_context& io,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout) {
+    auto result = state->lifespan;
+    if (result.finite()) {
+        result.on_expiry = connection_expiry {state, std::addressof(io), connect_timeout, queue_timeout,
+            std::addressof(reopen_expired_connection<Source>)};
+    }
+    return result;
+}
+
+/**
+* Acquires up to count connections from the shard in parallel. It does not
+* acquire more than the shard has available or may open without waiting.
+* Each acquisition takes a free slot of the pool queue like a health check,
+* so it does not take connections over the effective capacity and does not
+* delay waiting requests. Nothing is acquired unless the circuit breaker is
+* closed, connect errors are counted by the breaker.
+*/
+template <typename Source, typename Handler>
+void open_connections(std::shared_ptr<pool_state<Source>> state, io_context& io, std::size_t shard,
+        std::size_t count, time_traits::duration connect_timeout, time_traits::duration queue_timeout,
+        Handler&& handler) {
+    const bool breaker_enabled = state->breaker.enabled();
+    if (breaker_enabled && state->breaker.state() != circuit_state::closed) {
+        return asio::post(io, detail::bind(std::forward<Handler>(handler), error_code {error::circuit_open}));
+    }
+
+    auto& pool = state->shards[shard];
+    count = std::min(count, pool.available() + (pool.capacity() - std::min(pool.size(), pool.capacity())));
+
+    std::vector<pool_slot> slots;
+    const auto queue = shard_queue(state, shard);
+    while (slots.size() != count) {
+        auto slot = state->queues[shard].try_enter(queue);
+        if (slot.empty()) {
+            break;
+        }
+        slots.push_back(std::move(slot));
+    }
+
+    if (slots.empty()) {
+        return asio::post(io, detail::bind(std::forward<Handler>(handler), error_code {}));
+    }
+
+    warm_up_join<Source, std::decay_t<Handler>> join {std::forward<Handler>(handler), slots.size(), state};
+    for (auto& slot : slots) {
+        auto wrapped = wrap_pooled_connection_handler(
+            io,
+            make_connector(state->source, io, connect_timeout),
+            join,
+            make_connection_lifespan(state, io, connect_timeout, queue_timeout),
+            nullptr,
+            breaker_enabled ? circuit_breaker_ptr(state, std::addressof(state->breaker)) : circuit_breaker_ptr {}
+        );
+        wrapped.slot_ = std::move(slot);
+        pool.get_auto_recycle(io, std::move(wrapped), queue_timeout);
+    }
+}
+
+/**
+* Acquires connections from the shard in parallel to open connections up to the
+* shard minimum of idle ones. Acquisition of already idle connections renews
+* their idle time, so they are not closed by the idle timeout.
+*/
+template <typename Source, typename Handler>
+void fill_min_idle(std::shared_ptr<pool_state<Source>> state, io_context& io, std::size_t shard,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout, Handler&& handler) {
+    const auto count = state->shards.min_idle(shard);
+    open_connections(std::move(state), io, shard, count, connect_timeout, queue_timeout,
+        std::forward<Handler>(handler));
+}
+
+/**
+* Runs a task of the pool periodically. It is stopped when the pool is destroyed.
+*/
+template <typename Source, typename Task>
+struct pool_periodic_task {
+    std::weak_ptr<pool_state<Source>> state_;
+    std::shared_ptr<asio::steady_timer> timer_;
+    time_traits::duration period_;
+    Task task_;
+
+    void operator ()(error_code ec = error_code {}) {
+        if (ec) {
+            return;
+        }
+        auto state = state_.lock();
+        if (!state) {
+            return;
+        }
+        task_(std::move(state));
+        timer_->expires_after(period_);
+        timer_->async_wait(*this);
+    }
+};
+
+template <typename Source, typename Task>
+void start_pool_periodic_task(const std::shared_ptr<pool_state<Source>>& state, io_context& io,
+        time_traits::duration period, Task&& task) {
+    auto timer = std::make_shared<asio::steady_timer>(io);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->timers.push_back(timer);
+    }
+    timer->expires_after(period);
+    timer->async_wait(pool_periodic_task<Source, std::decay_t<Task>> {
+        state, timer, period, std::forward<Task>(task)
+    });
+}
+
+template <typename Source>
+void stop_pool_periodic_tasks(pool_state<Source>& state) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (auto& weak_timer : state.timers) {
+        if (auto timer = weak_timer.lock()) {
+            asio::post(timer->get_executor(), [timer] { timer->cancel(); });
+        }
+    }
+    state.timers.clear();
+}
+
+/**
+* Starts periodic refill of the shard up to its minimum of idle connections
+* every half of the idle timeout.
+*/
+template <typename Source>
+void start_keeping_min_idle(const std::shared_ptr<pool_state<Source>>& state, io_context& io, std::size_t shard,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout) {
+    const auto idle_timeout = state->shards.idle_timeout();
+    if (state->shards.min_idle(shard) == 0
+            || idle_timeout <= time_traits::duration::zero()
+            || idle_timeout == time_traits::duration::max()
+            || !state->shards.start_keeping_min_idle(shard)) {
+        return;
+    }
+
+    start_pool_periodic_task(state, io, idle_timeout / 2,
+        [&io, shard, connect_timeout, queue_timeout] (std::shared_ptr<pool_state<Source>> state) {
+            fill_min_idle(std::move(state), io, shard, connect_timeout, queue_timeout, [] (error_code) {});
+        });
+}
+
+/**
+* Checks an idle connection taken from the pool. A dead connection is closed
+* and a replacement is opened in background. Taking the connection renews its
+* idle time within the pool, so a connection which has been idle for the idle
+* timeout since it was returned by a user is closed by the check instead.
+*/
+template <typename Source>
+struct health_check_handler {
+    std::shared_ptr<pool_state<Source>> state_;
+    io_context& io_;
+    std::size_t shard_;
+    time_traits::duration connect_timeout_;
+    time_traits::duration queue_timeout_;
+    pool_slot slot_;
+
+    template <typename Handle>
+    void operator ()(error_code ec, Handle&& h) {
+        // The slot is released after the handle is returned to the pool
+        const auto slot = std::move(slot_);
+        std::decay_t<Handle> handle = std::move(h);
+        if (ec) {
+            return;
+        }
+        // There was no idle connection to check
+        if (handle.empty()) {
+            return handle.waste();
+        }
+        if (idle_expired(unwrap_connection(*handle).idle_since_)) {
+            return handle.waste();
+        }
+        if (idle_connection_alive(*handle)) {
+            return;
+        }
+        handle.waste();
+        open_connections(std::move(state_), io_, shard_, 1, connect_timeout_, queue_timeout_, [] (error_code) {});
+    }
+
+    bool idle_expired(time_traits::time_point idle_since) const {
+        const auto idle_timeout = state_->shards.idle_timeout();
+        if (idle_timeout <= time_traits::duration::zero() || idle_timeout == time_traits::duration::max()
+                || idle_since == time_traits::time_point::max()) {
+            return false;
+        }
+        return time_traits::time_point::clock::now() - idle_since >= idle_timeout;
+    }
+};
+
+/**
+* Takes idle connections of the shard and checks their liveness. Each check
+* takes a free slot of the pool queue, so the checks do not take connections
+* over the effective capacity and do not delay waiting requests.
+*/
+template <typename Source>
+void check_idle_connections(std::shared_ptr<pool_state<Source>> state, io_context& io, std::size_t shard,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout) {
+    auto& pool = state->shards[shard];
+    const auto queue = shard_queue(state, shard);
+    for (auto count = pool.available(); count != 0; --count) {
+        auto slot = state->queues[shard].try_enter(queue);
+        if (slot.empty()) {
+            return;
+        }
+        pool.get_auto_recycle(io,
+            health_check_handler<Source> {state, io, shard, connect_timeout, queue_timeout, std::move(slot)},
+            queue_timeout);
+    }
+}
+
+/**
+* Starts periodic liveness checks of idle connections of the shard.
+*/
+template <typename Source>
+void start_health_check(const std::shared_ptr<pool_state<Source>>& state, io_context& io, std::size_t shard,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout) {
+    const auto interval = state->health_check_interval;
+    if (interval <= time_traits::duration::zero()
+            || interval == time_traits::duration::max()
+            || !state->shards.start_health_check(shard)) {
+        return;
+    }
+
+    start_pool_periodic_task(state, io, interval,
+        [&io, shard, connect_timeout, queue_timeout] (std::shared_ptr<pool_state<Source>> state) {
+            check_idle_connections(std::move(state), io, shard, connect_timeout, queue_timeout);
+        });
+}
+
+template <typename Source, typename Handler>
+void async_warm_up(std::shared_ptr<pool_state<Source>> state, io_context& io,
+        time_traits::duration connect_timeout, time_traits::duration queue_timeout, Handler&& handler) {
+    const auto shard = state->shards.local(std::addressof(io));
+    start_keeping_min_idle(state, io, shard, connect_timeout, queue_timeout);
+    start_health_check(state, io, shard, connect_timeout, queue_timeout);
+    fill_min_idle(std::move(state), io, shard, connect_timeout, queue_timeout, std::forward<Handler>(handler));
+}
+
+} // namespace ozo::impl
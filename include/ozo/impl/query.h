@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ozo/type_traits.h>
+#include <ozo/impl/result.h>
 
 #include <boost/hana/tuple.hpp>
 
@@ -24,4 +25,29 @@ const auto& get_query_params(const query<Ts ...>& value) {
     return value.params;
 }
 
+template <class T>
+constexpr result_format get_query_result_format(const T&) noexcept {
+    return result_format::binary;
+}
+
+template <class Query>
+struct text_result_query {
+    Query query;
+};
+
+template <class Query>
+decltype(auto) get_query_text(const text_result_query<Query>& value) {
+    return get_query_text(value.query);
+}
+
+template <class Query>
+decltype(auto) get_query_params(const text_result_query<Query>& value) {
+    return get_query_params(value.query);
+}
+
+template <class Query>
+constexpr result_format get_query_result_format(const text_result_query<Query>&) noexcept {
+    return result_format::text;
+}
+
 } // namespace ozo::impl
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace ozo::impl {
+
+/**
+* Cache of memory blocks of a single size. Blocks are kept for reuse up to
+* the limit, so objects which are created and destroyed on every operation,
+* like pooled connections, do not hit the heap once the cache is warmed up.
+* The size of the cache is the size of the first requested block, blocks of
+* other sizes are not cached.
+*/
+class block_cache {
+public:
+    explicit block_cache(std::size_t limit) : limit_(limit) {}
+
+    block_cache(const block_cache&) = delete;
+    block_cache& operator =(const block_cache&) = delete;
+
+    ~block_cache() {
+        for (auto block : blocks_) {
+            ::operator delete(block);
+        }
+    }
+
+    void* allocate(std::size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (size_ == 0) {
+                size_ = size;
+            }
+            if (size == size_ && !blocks_.empty()) {
+                const auto block = blocks_.back();
+                blocks_.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* block, std::size_t size) noexcept {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (size == size_ && blocks_.size() < limit_) {
+                try {
+                    blocks_.push_back(block);
+                    return;
+                } catch (const std::bad_alloc&) {}
+            }
+        }
+        ::operator delete(block);
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return blocks_.size();
+    }
+
+private:
+    const std::size_t limit_;
+    mutable std::mutex mutex_;
+    std::size_t size_ = 0;
+    std::vector<void*> blocks_;
+};
+
+/**
+* Allocator of single objects from a shared `block_cache`, intended for
+* `std::allocate_shared()`. The control block keeps a copy of the allocator,
+* so the cache outlives all the objects allocated from it. Allocator without
+* a cache uses the heap.
+*/
+template <typename T>
+class recycling_allocator {
+public:
+    using value_type = T;
+
+    recycling_allocator() = default;
+
+    explicit recycling_allocator(std::shared_ptr<block_cache> cache) noexcept : cache_(std::move(cache)) {}
+
+    template <typename U>
+    recycling_allocator(const recycling_allocator<U>& other) noexcept : cache_(other.cache_) {}
+
+    T* allocate(std::size_t n) {
+        if (cache_ && n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+            return static_cast<T*>(cache_->allocate(sizeof(T)));
+        }
+        return std::allocator<T> {}.allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (cache_ && n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+            return cache_->deallocate(p, sizeof(T));
+        }
+        std::allocator<T> {}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator ==(const recycling_allocator<U>& rhs) const noexcept {
+        return cache_ == rhs.cache_;
+    }
+
+    template <typename U>
+    bool operator !=(const recycling_allocator<U>& rhs) const noexcept {
+        return !(*this == rhs);
+    }
+
+private:
+    template <typename>
+    friend class recycling_allocator;
+
+    std::shared_ptr<block_cache> cache_;
+};
+
+} // namespace ozo::impl
@@ -15,6 +15,10 @@ inline const char* get_result_status_name(ExecStatusType status) {
         __OZO_CASE_RETURN(PGRES_BAD_RESPONSE)
         __OZO_CASE_RETURN(PGRES_EMPTY_QUERY)
         __OZO_CASE_RETURN(PGRES_FATAL_ERROR)
+#ifdef LIBPQ_HAS_PIPELINING
+        __OZO_CASE_RETURN(PGRES_PIPELINE_SYNC)
+        __OZO_CASE_RETURN(PGRES_PIPELINE_ABORTED)
+#endif
     }
 #undef __OZO_CASE_RETURN
     return "unknown";
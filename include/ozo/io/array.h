@@ -84,6 +84,49 @@ struct send_array_impl {
 template <typename T>
 struct send_impl_dispatcher<T, Require<Array<T>>> { using type = send_array_impl<std::decay_t<T>>; };
 
+template <typename Out, typename = std::void_t<>>
+struct has_recv_verified : std::false_type {};
+
+template <typename Out>
+struct has_recv_verified<Out, std::void_t<typename get_recv_impl<Out>::verified_state>> : std::true_type {};
+
+template <typename T, typename = std::void_t<>>
+struct has_get_allocator : std::false_type {};
+
+template <typename T>
+struct has_get_allocator<T, std::void_t<decltype(std::declval<const T&>().get_allocator())>> : std::true_type {};
+
+/**
+* Returns the allocator the items of an array are allocated with. It is the
+* allocator of the array container, e.g. the one the container has been
+* constructed with by `recv_result()`, so nullable items use it too.
+*/
+template <typename T>
+inline auto array_allocator(const T& array) {
+    if constexpr (has_get_allocator<T>::value) {
+        return array.get_allocator();
+    } else {
+        return std::allocator<char>{};
+    }
+}
+
+/**
+* Receives an item data frame of an array and verifies oids of its parts
+* only until they are verified via previous items. It is used for composites
+* to skip per field oid checks, since all items of an array have the same
+* fields. The state is shared by all the items of the array.
+*/
+template <typename M, typename Out, typename State, typename Alloc>
+inline istream& recv_verified_data_frame(istream& in, const oid_map_t<M>& oids, Out& out, State& verified,
+        const Alloc& alloc) {
+    size_type size = 0;
+    read(in, size);
+    if (prepare_recv(null_oid, size == null_state_size, oids, out, alloc)) {
+        get_recv_impl<Out>::apply_verified(in, oids, unwrap(out), verified);
+    }
+    return in;
+}
+
 template <typename T>
 struct recv_array_impl {
     using out_type = T;
@@ -120,8 +163,16 @@ struct recv_array_impl {
 
         out.resize(dim_header.size);
 
-        for (auto& item : out) {
-            recv_data_frame(in, oids, item);
+        const auto alloc = array_allocator(out);
+        if constexpr (has_recv_verified<typename out_type::value_type>::value) {
+            typename get_recv_impl<typename out_type::value_type>::verified_state verified {};
+            for (auto& item : out) {
+                recv_verified_data_frame(in, oids, item, verified, alloc);
+            }
+        } else {
+            for (auto& item : out) {
+                recv_data_frame(in, oids, item, alloc);
+            }
         }
         return in;
     }
@@ -37,8 +37,9 @@ public:
 
     static constexpr auto params_count = decltype(hana::length(std::declval<params_type>()))::value;
 
-    binary_query(text_type text, const params_type& params, const buffer_allocator_type& buffer_allocator, const oid_map_type& oid_map)
-        : impl(make_impl(std::move(text), params, oid_map, buffer_allocator)) {}
+    binary_query(text_type text, const params_type& params, const buffer_allocator_type& buffer_allocator,
+            const oid_map_type& oid_map, impl::result_format result_format = impl::result_format::binary)
+        : impl(make_impl(std::move(text), params, oid_map, buffer_allocator)), result_format_(result_format) {}
 
     constexpr const char* text() const noexcept {
         return to_const_char(impl->text);
@@ -60,6 +61,10 @@ public:
         return std::data(impl->values);
     }
 
+    constexpr impl::result_format result_format() const noexcept {
+        return result_format_;
+    }
+
 private:
     static constexpr auto binary_format = 1;
 
@@ -111,6 +116,7 @@ private:
     };
 
     std::shared_ptr<impl_type> impl;
+    impl::result_format result_format_;
 
     static auto make_impl(text_type text, const params_type& params,
             const oid_map_type& oid_map, const buffer_allocator_type& buffer_allocator) {
@@ -162,14 +168,16 @@ template <class Text, class Params, class M = empty_oid_map, class Alloc = std::
         class = Require<QueryText<Text> && HanaTuple<Params>>
 >
 auto make_binary_query(Text&& text, const Params& params,
-            const M& oid_map = M{}, const Alloc& buffer_allocator = Alloc{}) {
+            const M& oid_map = M{}, const Alloc& buffer_allocator = Alloc{},
+            impl::result_format result_format = impl::result_format::binary) {
     using binary_query_type = binary_query<std::decay_t<Text>, Params, M, Alloc>;
-    return binary_query_type(std::forward<Text>(text), params, buffer_allocator, oid_map);
+    return binary_query_type(std::forward<Text>(text), params, buffer_allocator, oid_map, result_format);
 }
 
 template <class T, class M = empty_oid_map, class Alloc = std::allocator<char>, class = Require<Query<T>>>
 auto make_binary_query(const T& query, const M& oid_map = M{}, const Alloc& buffer_allocator = Alloc{}) {
-    return make_binary_query(get_text(query), get_params(query), oid_map, buffer_allocator);
+    return make_binary_query(get_text(query), get_params(query), oid_map, buffer_allocator,
+        get_result_format(query));
 }
 
 template <class Q, class M, class A>
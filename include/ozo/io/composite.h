@@ -4,12 +4,16 @@
 #include <ozo/io/send.h>
 #include <ozo/io/recv.h>
 #include <ozo/io/size_of.h>
+#include <boost/hana/accessors.hpp>
 #include <boost/hana/adapt_struct.hpp>
 #include <boost/hana/members.hpp>
 #include <boost/hana/size.hpp>
 #include <boost/hana/fold.hpp>
 #include <boost/fusion/adapted/struct/adapt_struct.hpp>
 #include <boost/fusion/include/fold.hpp>
+#include <boost/fusion/include/size.hpp>
+
+#include <array>
 
 namespace ozo::detail {
 
@@ -42,6 +46,22 @@ constexpr auto fields_number(const T& v) -> Require<HanaStruct<T>, size_type> {
     return size_type(hana::value(hana::size(hana::members(v))));
 }
 
+template <typename T>
+constexpr std::size_t fields_count() {
+    if constexpr (HanaStruct<T>) {
+        return decltype(hana::size(hana::accessors<T>()))::value;
+    } else {
+        return fusion::result_of::size<T>::value;
+    }
+}
+
+/**
+* Fields of a composite which oids have been verified, e.g. for the previous
+* elements of the same array. A field is verified once it is received not null.
+*/
+template <typename T>
+using verified_fields = std::array<bool, fields_count<T>()>;
+
 template <typename T>
 constexpr auto data_size(const T& v) -> Require<FusionSequence<T>&&!HanaStruct<T>, size_type> {
     using ozo::size_of;
@@ -103,8 +123,26 @@ inline Require<Composite<T>> read_and_verify_header(istream& in, const T& v) {
     }
 }
 
+/**
+* Receives a field frame and checks its oid only if the field has not been
+* verified yet.
+*/
+template <typename M, typename Out>
+inline istream& recv_verified_frame(istream& in, const oid_map_t<M>& oid_map, Out& out, bool& verified) {
+    if (verified) {
+        oid_t oid = null_oid;
+        read(in, oid);
+        return recv_data_frame(in, null_oid, oid_map, out);
+    }
+    recv_frame(in, oid_map, out);
+    verified = !is_null(out);
+    return in;
+}
+
 template <typename T>
 struct recv_fusion_adapted_composite_impl {
+    using verified_state = verified_fields<T>;
+
     template <typename M>
     static istream& apply(istream& in, size_type, const oid_map_t<M>& oid_map, T& out) {
         read_and_verify_header(in, out);
@@ -113,17 +151,41 @@ struct recv_fusion_adapted_composite_impl {
         });
         return in;
     }
+
+    template <typename M>
+    static istream& apply_verified(istream& in, const oid_map_t<M>& oid_map, T& out, verified_state& verified) {
+        read_and_verify_header(in, out);
+        std::size_t i = 0;
+        fusion::for_each(out, [&] (auto& v) {
+            recv_verified_frame(in, oid_map, v, verified[i++]);
+        });
+        return in;
+    }
 };
 
 template <typename T>
 struct recv_hana_adapted_composite_impl {
+    using verified_state = verified_fields<T>;
+
     template <typename M>
     static istream& apply(istream& in, size_type, const oid_map_t<M>& oid_map, T& out) {
+        return recv_members(in, out, [&] (auto& v) { recv_frame(in, oid_map, v); });
+    }
+
+    template <typename M>
+    static istream& apply_verified(istream& in, const oid_map_t<M>& oid_map, T& out, verified_state& verified) {
+        std::size_t i = 0;
+        return recv_members(in, out, [&] (auto& v) { recv_verified_frame(in, oid_map, v, verified[i++]); });
+    }
+
+private:
+    template <typename RecvFrame>
+    static istream& recv_members(istream& in, T& out, RecvFrame&& recv_frame) {
         read_and_verify_header(in, out);
         out = hana::unpack(
             hana::fold(hana::members(out), hana::tuple<>(),
                 [&] (auto&& r, auto&& v) {
-                    recv_frame(in, oid_map, v);
+                    recv_frame(v);
                     return hana::append(std::move(r), std::move(v));
                 }),
             [] (auto&& ... args) { return T {std::move(args) ...}; }
@@ -7,11 +7,15 @@
 #include <ozo/core/concept.h>
 #include <ozo/detail/endian.h>
 #include <ozo/detail/float.h>
+#include <ozo/detail/charconv.h>
+#include <ozo/detail/uses_allocator.h>
 #include <ozo/io/istream.h>
 #include <boost/core/demangle.hpp>
 #include <boost/hana/for_each.hpp>
 #include <boost/hana/members.hpp>
 
+#include <cstring>
+
 namespace ozo {
 template <int... I>
 constexpr std::tuple<boost::mpl::int_<I>...>
@@ -137,6 +141,112 @@ struct recv_impl {
     }
 };
 
+/**
+ * @brief Defines how to receive an object from a text format representation.
+ * @ingroup group-io-types
+ *
+ * This functor is used to deserialize object from a query result value
+ * which has been received in text format (see `ozo::value::is_text()`),
+ * e.g. for types which have no binary send/recv functions in a database
+ * or for queries wrapped with `ozo::text_result()`.
+ *
+ * The default implementation parses integers, floating point numbers and `bool`
+ * without memory allocation and copies data into #DynamicSize raw data writable
+ * objects like `std::string`. Strong typedefs are received as their base type.
+ * For any other type `std::invalid_argument` will be thrown.
+ *
+ * ### Customization point
+ *
+ * This template is a customization point for specializing text format deserialization
+ * of user defined types.
+ *
+ * ### Example
+ *
+ * @code
+namespace ozo {
+template <>
+struct recv_text_impl<demo::point> {
+    template <typename OidMap>
+    static void apply(std::string_view in, const OidMap&, demo::point& out) {
+        // parse "(x,y)" here
+    }
+};
+} // namespace ozo
+ * @endcode
+ *
+ * @tparam Out --- type of an object to apply to
+ * @tparam <anonymous> --- SFINAE-based overloading parameter.
+ */
+template <typename Out, typename = std::void_t<>>
+struct recv_text_impl {
+    /**
+     * @brief Implementation of deserialization object from a text representation.
+     *
+     * @param in --- text representation of the value
+     * @param oid_map_t<M> --- #OidMap to get oid for custom types
+     * @param out --- object to deserialize
+     */
+    template <typename M>
+    static void apply(std::string_view in, const oid_map_t<M>& oids, Out& out) {
+        if constexpr (StrongTypedef<Out>) {
+            recv_text_impl<typename Out::base_type>::apply(in, oids, out.get());
+        } else if constexpr (std::is_same_v<Out, bool>) {
+            if (in == "t") {
+                out = true;
+            } else if (in == "f") {
+                out = false;
+            } else {
+                throw std::invalid_argument("can not parse \"" + std::string(in) + "\" as bool");
+            }
+        } else if constexpr (Integral<Out> && sizeof(Out) == 1) {
+            if (std::size(in) != 1) {
+                throw std::range_error("data size " + std::to_string(std::size(in))
+                    + " does not match type size 1");
+            }
+            out = in.front();
+        } else if constexpr (Integral<Out> || FloatingPoint<Out>) {
+            const auto last = std::data(in) + std::size(in);
+            const auto res = detail::from_chars(std::data(in), last, out);
+            if (res.ec != std::errc{} || res.ptr != last) {
+                throw std::invalid_argument("can not parse \"" + std::string(in) + "\" as "
+                    + boost::core::demangle(typeid(Out).name()));
+            }
+        } else if constexpr (DynamicSize<Out> && RawDataWritable<Out>) {
+            using std::data;
+            out.resize(std::size(in));
+            std::copy(std::begin(in), std::end(in), data(out));
+        } else {
+            (void)in;
+            (void)out;
+            throw std::invalid_argument("text format is not supported for type "
+                + boost::core::demangle(typeid(Out).name()));
+        }
+    }
+};
+
+template <>
+struct recv_text_impl<pg::bytea> {
+    template <typename M>
+    static void apply(std::string_view in, const oid_map_t<M>&, pg::bytea& out) {
+        // Only hex format is supported which is the default one since PostgreSQL 9.0
+        if (std::size(in) % 2 || in.substr(0, 2) != "\\x") {
+            throw std::invalid_argument("unsupported bytea text format");
+        }
+        const auto from_hex = [] (char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            throw std::invalid_argument("unexpected hex digit in bytea text format");
+        };
+        out.get().resize(std::size(in) / 2 - 1);
+        auto i = std::begin(in) + 2;
+        for (auto& v : out.get()) {
+            v = char(from_hex(i[0]) << 4 | from_hex(i[1]));
+            i += 2;
+        }
+    }
+};
+
 namespace detail {
 
 template <typename T, typename = std::void_t<>>
@@ -148,15 +258,21 @@ struct recv_impl_dispatcher<strong_typedef_wrapper<T, Tag>> { using type = recv_
 template <typename T>
 using get_recv_impl = typename recv_impl_dispatcher<unwrap_type<T>>::type;
 
-template <typename M, typename Oid, typename Out>
-inline istream& recv(istream& in, Oid oid, size_type size, const oid_map_t<M>& oids, Out& out) {
+/**
+* Checks incoming oid and null state and prepares output object for
+* the data. Returns false if nothing should be read since the output
+* object has been reset into the null state. Nullables are allocated
+* with the given allocator.
+*/
+template <typename M, typename Oid, typename Out, typename Alloc>
+inline bool prepare_recv(Oid oid, bool is_null, const oid_map_t<M>& oids, Out& out, const Alloc& alloc) {
     static_assert(std::is_same_v<Oid, oid_t>||std::is_same_v<Oid, null_oid_t>,
         "oid must be oid_t or null_oid_t type");
 
     if constexpr (Nullable<Out>) {
-        if (size == null_state_size) {
+        if (is_null) {
             reset_nullable(out);
-            return in;
+            return false;
         }
     }
 
@@ -171,20 +287,38 @@ inline istream& recv(istream& in, Oid oid, size_type size, const oid_map_t<M>& o
     (void)oid; // Dummy GCC
 
     if constexpr (Nullable<Out>) {
-        init_nullable(out);
-    } else if (size == null_state_size) {
+        init_nullable(out, alloc);
+    } else if (is_null) {
         throw std::invalid_argument("unexpected null for type "
             + boost::core::demangle(typeid(out).name()));
     }
 
+    return true;
+}
+
+template <typename M, typename Oid, typename Out, typename Alloc = std::allocator<char>>
+inline istream& recv(istream& in, Oid oid, size_type size, const oid_map_t<M>& oids, Out& out,
+        const Alloc& alloc = Alloc{}) {
+    if (!prepare_recv(oid, size == null_state_size, oids, out, alloc)) {
+        return in;
+    }
     return detail::get_recv_impl<Out>::apply(in, size, oids, unwrap(out));
 }
 
-template <typename M, typename Oid, typename Out>
-inline istream& recv_data_frame(istream& in, Oid oid, const oid_map_t<M>& oids, Out& out) {
+template <typename M, typename Out, typename Alloc>
+inline void recv_text(std::string_view in, oid_t oid, bool is_null, const oid_map_t<M>& oids, Out& out,
+        const Alloc& alloc) {
+    if (prepare_recv(oid, is_null, oids, out, alloc)) {
+        recv_text_impl<std::decay_t<unwrap_type<Out>>>::apply(in, oids, unwrap(out));
+    }
+}
+
+template <typename M, typename Oid, typename Out, typename Alloc = std::allocator<char>>
+inline istream& recv_data_frame(istream& in, Oid oid, const oid_map_t<M>& oids, Out& out,
+        const Alloc& alloc = Alloc{}) {
     size_type size = 0;
     read(in, size);
-    return recv(in, oid, size, oids, out);
+    return recv(in, oid, size, oids, out, alloc);
 }
 
 } // namespace detail
@@ -235,11 +369,12 @@ inline istream& recv(istream& in, oid_t oid, size_type size, const oid_map_t<M>&
  * @param in --- input stream
  * @param oids --- #OidMap to determine possible nested object's oid
  * @param out --- object to receive
+ * @param alloc --- allocator to allocate nullables with
  * @return ostream& --- reference to the input stream
  */
-template <typename M, typename Out>
-inline istream& recv_data_frame(istream& in, const oid_map_t<M>& oids, Out& out) {
-    return detail::recv_data_frame(in, null_oid, oids, out);
+template <typename M, typename Out, typename Alloc = std::allocator<char>>
+inline istream& recv_data_frame(istream& in, const oid_map_t<M>& oids, Out& out, const Alloc& alloc = Alloc{}) {
+    return detail::recv_data_frame(in, null_oid, oids, out, alloc);
 }
 
 /**
@@ -265,27 +400,103 @@ inline istream& recv_frame(istream& in, const oid_map_t<M>& oids, Out& out) {
     return detail::recv_data_frame(in, oid, oids, out);
 }
 
-template <typename T, typename M, typename Out>
-void recv(const value<T>& in, const oid_map_t<M>& oids, Out& out) {
+/**
+ * @brief Receive object from a query result value
+ * @ingroup group-io-functions
+ *
+ * Dispatches deserialization according to the value format: binary values
+ * are received via `ozo::recv_impl`, text values --- via `ozo::recv_text_impl`.
+ * So a result may contain columns in both of the formats.
+ *
+ * Nullable output object is allocated via `ozo::init_nullable()` with the given allocator,
+ * so it is possible to place the whole decoded result into a request-scoped memory arena,
+ * e.g. with a polymorphic allocator.
+ *
+ * @param in --- query result value
+ * @param oids --- #OidMap to get oid for custom types from
+ * @param out --- object to deserialize into
+ * @param alloc --- allocator to allocate nullables with
+ */
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
+void recv(const value<T>& in, const oid_map_t<M>& oids, Out& out, const Alloc& alloc = Alloc{}) {
+    if (in.is_text()) {
+        return detail::recv_text(std::string_view(in.data(), in.size()),
+            in.oid(), in.is_null(), oids, out, alloc);
+    }
     detail::istreambuf_view sbuf(in.data(), in.size());
     istream s(&sbuf);
-    recv(s, in.oid(), (in.is_null() ? null_state_size : in.size()), oids, out);
+    detail::recv(s, in.oid(), (in.is_null() ? null_state_size : in.size()), oids, out, alloc);
+}
+
+namespace detail {
+
+/**
+* Column has a fixed binary layout if it is a non-nullable arithmetic type
+* with `bytes<N>` size equal to the size of the type. Such a column may be
+* received by a direct big-endian load from a value without the istream
+* machinery.
+*/
+template <typename T>
+constexpr auto FixedLayoutColumn = (Integral<T> || FloatingPoint<T>)
+    && std::is_same_v<typename type_traits<std::decay_t<T>>::size, bytes<sizeof(T)>>;
+
+template <typename Out, std::size_t ... I>
+constexpr bool is_fixed_layout_row(std::index_sequence<I ...>) {
+    return (FixedLayoutColumn<typename fusion::result_of::value_at_c<Out, I>::type> && ...);
 }
 
+/**
+* Row has a fixed binary layout if all of its members have it, so the layout
+* of the whole row is known at compile time.
+*/
+template <typename Out>
+constexpr auto FixedLayoutRow = is_fixed_layout_row<Out>(
+    std::make_index_sequence<fusion::result_of::size<Out>::value>{});
+
 template <typename T, typename M, typename Out>
+inline void recv_fixed_layout(const value<T>& in, const oid_map_t<M>& oids, Out& out) {
+    if (in.is_text() || in.is_null() || in.size() != sizeof(Out)
+            || !accepts_oid(oids, out, in.oid())) {
+        // Generic implementation handles text format and reports errors
+        return recv(in, oids, out);
+    }
+
+    if constexpr (sizeof(Out) == 1) {
+        out = *in.data();
+    } else if constexpr (FloatingPoint<Out>) {
+        floating_point_integral_t<Out> tmp;
+        std::memcpy(std::addressof(tmp), in.data(), sizeof(tmp));
+        tmp = convert_from_big_endian(tmp);
+        out = to_floating_point(tmp);
+    } else {
+        Out tmp;
+        std::memcpy(std::addressof(tmp), in.data(), sizeof(tmp));
+        out = convert_from_big_endian(tmp);
+    }
+}
+
+template <typename T, typename M, typename Out, std::size_t ... I>
+inline void recv_fixed_layout_row(const row<T>& in, const oid_map_t<M>& oids, Out& out,
+        std::index_sequence<I ...>) {
+    (recv_fixed_layout(in[int(I)], oids, fusion::at_c<I>(out)), ...);
+}
+
+} // namespace detail
+
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
 Require<!FusionSequence<Out> && !FusionAdaptedStruct<Out>>
-recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out) {
+recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out, const Alloc& alloc = Alloc{}) {
     if (std::size(in) != 1) {
         throw std::range_error("row size " + std::to_string(std::size(in))
             + " does not equal 1 for single column result");
     }
 
-    recv(*(in.begin()), oid_map, out);
+    recv(*(in.begin()), oid_map, out, alloc);
 }
 
-template <typename T, typename M, typename Out>
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
 Require<FusionSequence<Out> && !FusionAdaptedStruct<Out>>
-recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out) {
+recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out, const Alloc& alloc = Alloc{}) {
 
     if (static_cast<std::size_t>(fusion::size(out)) != std::size(in)) {
         throw std::range_error("row size " + std::to_string(std::size(in))
@@ -293,16 +504,21 @@ recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out) {
             + " size " + std::to_string(fusion::size(out)));
     }
 
-    auto i = in.begin();
-    fusion::for_each(out, [&](auto& item) {
-        recv(*i, oid_map, item);
-        ++i;
-    });
+    if constexpr (detail::FixedLayoutRow<Out>) {
+        detail::recv_fixed_layout_row(in, oid_map, out,
+            std::make_index_sequence<fusion::result_of::size<Out>::value>{});
+    } else {
+        auto i = in.begin();
+        fusion::for_each(out, [&](auto& item) {
+            recv(*i, oid_map, item, alloc);
+            ++i;
+        });
+    }
 }
 
-template <typename T, typename M, typename Out>
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
 Require<FusionAdaptedStruct<Out>>
-recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out) {
+recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out, const Alloc& alloc = Alloc{}) {
 
     if (static_cast<std::size_t>(fusion::size(out)) != std::size(in)) {
         throw std::range_error("row size " + std::to_string(std::size(in))
@@ -316,27 +532,30 @@ recv_row(const row<T>& in, const oid_map_t<M>& oid_map, Out& out) {
             throw std::range_error(std::string("row does not contain \"")
                 + member_name(out, idx) + "\" column for "
                 + boost::core::demangle(typeid(out).name()));
+        } else if constexpr (detail::FixedLayoutRow<Out>) {
+            detail::recv_fixed_layout(*i, oid_map, member_value(out, idx));
         } else {
-            recv(*i, oid_map, member_value(out, idx));
+            recv(*i, oid_map, member_value(out, idx), alloc);
         }
     });
 }
 
-template <typename T, typename M, typename Out>
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
 Require<ForwardIterator<Out>, Out>
-recv_result(const basic_result<T>& in, const oid_map_t<M>& oid_map, Out out) {
+recv_result(const basic_result<T>& in, const oid_map_t<M>& oid_map, Out out, const Alloc& alloc = Alloc{}) {
     for (auto row : in) {
-        recv_row(row, oid_map, *out++);
+        recv_row(row, oid_map, *out++, alloc);
     }
     return out;
 }
 
-template <typename T, typename M, typename Out>
+template <typename T, typename M, typename Out, typename Alloc = std::allocator<char>>
 Require<InsertIterator<Out>, Out>
-recv_result(const basic_result<T>& in, const oid_map_t<M>& oid_map, Out out) {
+recv_result(const basic_result<T>& in, const oid_map_t<M>& oid_map, Out out, const Alloc& alloc = Alloc{}) {
+    using value_type = typename Out::container_type::value_type;
     for (auto row : in) {
-        typename Out::container_type::value_type v{};
-        recv_row(row, oid_map, v);
+        auto v = detail::make_with_allocator<value_type>(alloc);
+        recv_row(row, oid_map, v, alloc);
         *out++ = std::move(v);
     }
     return out;
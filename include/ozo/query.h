@@ -78,4 +78,42 @@ decltype(auto) get_params(const T& query) {
     return get_query_params(query);
 }
 
+/**
+ * @brief Requested format of the query result
+ *
+ * Returns format in which a database is asked to send the result of the query.
+ * By default it is binary format. The result format is requested for all the
+ * result columns at once since libpq does not provide per column selection.
+ * The result values are received according to the actual format of each column
+ * (see `ozo::value::is_text()`), so any column type can be received in text format.
+ *
+ * @param query --- #Query to examine
+ * @return `ozo::impl::result_format` --- format of the result
+ */
+template <class T, class = Require<Query<T>>>
+constexpr auto get_result_format(const T& query) noexcept {
+    using impl::get_query_result_format;
+    return get_query_result_format(query);
+}
+
+/**
+ * @brief Asks a database to send the query result in text format
+ *
+ * It is useful for the types which have no binary send/recv functions in a database,
+ * e.g. some extension types. Values of such a result are received via `ozo::recv_text_impl`.
+ *
+ * ### Example
+ *
+ * @code
+ozo::request(provider, ozo::text_result("SELECT ...;"_SQL), ozo::into(rows), yield);
+ * @endcode
+ *
+ * @param query --- #Query to wrap
+ * @return #Query object with text result format
+ */
+template <class T, class = Require<Query<T>>>
+auto text_result(T&& query) {
+    return impl::text_result_query<std::decay_t<T>> {std::forward<T>(query)};
+}
+
 } // namespace ozo
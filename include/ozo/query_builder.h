@@ -131,6 +131,19 @@ struct is_query_builder<query_builder<T>> : std::true_type {};
 template <class T>
 constexpr auto QueryBuilder = is_query_builder<std::decay_t<T>>::value;
 
+/**
+ * @brief Asks a database to send the query result in text format
+ *
+ * Builds the query and wraps it with `ozo::text_result()`.
+ *
+ * @param builder --- `ozo::query_builder` object
+ * @return #Query object with text result format
+ */
+template <class ElementsT>
+auto text_result(const query_builder<ElementsT>& builder) {
+    return text_result(builder.build());
+}
+
 template <class T>
 constexpr auto make_query_text(T&& value) {
     return query_element<std::decay_t<T>, query_text_tag> {std::forward<T>(value)};
@@ -3,6 +3,8 @@
 #include <ozo/io/array.h>
 #include <ozo/io/recv.h>
 #include <ozo/ext/std.h>
+#include <ozo/ext/boost.h>
+#include <ozo/core/slab_allocator.h>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -13,6 +15,47 @@ BOOST_FUSION_DEFINE_STRUCT((),
     (int32_t, digit)
 )
 
+namespace ozo::tests {
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    std::size_t* count;
+
+    explicit counting_allocator(std::size_t* count) : count(count) {}
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U>& other) : count(other.count) {}
+
+    T* allocate(std::size_t n) {
+        ++*count;
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        std::allocator<T>{}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator ==(const counting_allocator<U>& rhs) const { return count == rhs.count; }
+
+    template <typename U>
+    bool operator !=(const counting_allocator<U>& rhs) const { return !(*this == rhs); }
+};
+
+using counted_string = std::basic_string<char, std::char_traits<char>, counting_allocator<char>>;
+
+} // namespace ozo::tests
+
+OZO_PG_DEFINE_TYPE_AND_ARRAY(ozo::tests::counted_string, "text", TEXTOID, TEXTARRAYOID, dynamic_size)
+
+BOOST_FUSION_DEFINE_STRUCT((),
+    fixed_layout_test_result,
+    (int64_t, id)
+    (double, value)
+)
+
 namespace {
 
 using namespace testing;
@@ -43,6 +86,10 @@ struct recv : Test {
     ozo::empty_oid_map oid_map{};
     StrictMock<pg_result_mock> mock{};
     ozo::value<pg_result_mock> value{{&mock, 0, 0}};
+
+    recv() {
+        EXPECT_CALL(mock, field_format(_)).WillRepeatedly(Return(ozo::impl::result_format::binary));
+    }
 };
 
 TEST_F(recv, should_throw_system_error_if_oid_does_not_match_the_type) {
@@ -383,10 +430,47 @@ TEST_F(recv, should_convert_NAMEOID_to_pg_name) {
     EXPECT_EQ("test", static_cast<const std::string&>(got));
 }
 
+TEST_F(recv, should_allocate_nullable_with_given_allocator) {
+    const char bytes[] = { 0x00, 0x00, 0x00, 0x07 };
+
+    EXPECT_CALL(mock, field_type(_)).WillRepeatedly(Return(INT4OID));
+    EXPECT_CALL(mock, get_value(_, _)).WillRepeatedly(Return(bytes));
+    EXPECT_CALL(mock, get_length(_, _)).WillRepeatedly(Return(sizeof(bytes)));
+    EXPECT_CALL(mock, get_isnull(_, _)).WillRepeatedly(Return(false));
+
+    std::size_t count = 0;
+    std::shared_ptr<int32_t> got;
+    ozo::recv(value, oid_map, got, counting_allocator<char>{&count});
+    ASSERT_TRUE(got);
+    EXPECT_EQ(*got, 7);
+    EXPECT_EQ(count, 1u);
+}
+
+TEST_F(recv, should_construct_nullable_value_with_given_allocator) {
+    const std::string text = "a text which does not fit into a small string buffer";
+
+    EXPECT_CALL(mock, field_type(_)).WillRepeatedly(Return(TEXTOID));
+    EXPECT_CALL(mock, get_value(_, _)).WillRepeatedly(Return(text.data()));
+    EXPECT_CALL(mock, get_length(_, _)).WillRepeatedly(Return(text.size()));
+    EXPECT_CALL(mock, get_isnull(_, _)).WillRepeatedly(Return(false));
+
+    std::size_t count = 0;
+    boost::optional<counted_string> got;
+    ozo::recv(value, oid_map, got, counting_allocator<char>{&count});
+    ASSERT_TRUE(got);
+    EXPECT_EQ(std::string(got->begin(), got->end()), text);
+    EXPECT_EQ(got->get_allocator().count, &count);
+    EXPECT_EQ(count, 1u);
+}
+
 struct recv_row : Test {
     ozo::empty_oid_map oid_map{};
     StrictMock<pg_result_mock> mock{};
     ozo::row<pg_result_mock> row{{&mock, 0, 0}};
+
+    recv_row() {
+        EXPECT_CALL(mock, field_format(_)).WillRepeatedly(Return(ozo::impl::result_format::binary));
+    }
 };
 
 TEST_F(recv_row, should_throw_range_error_if_size_of_tuple_does_not_equal_to_row_size) {
@@ -471,10 +555,130 @@ TEST_F(recv_row, should_throw_range_error_if_row_is_unadapted_and_number_of_rows
     EXPECT_THROW(ozo::recv_row(row, oid_map, out), std::range_error);
 }
 
+TEST_F(recv_row, should_convert_fixed_layout_row_to_std_tuple) {
+    const char int64_bytes[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07 };
+    const char float8_bytes[] = { 0x40, 0x45, 0x10, static_cast<char>(0xA3),
+        static_cast<char>(0xD7), 0x0A, 0x3D, 0x71 };
+    const char int16_bytes[] = { static_cast<char>(0xFF), static_cast<char>(0xFE) };
+    const char bool_bytes[] = { true };
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(4));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(INT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(int64_bytes));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(sizeof(int64_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    EXPECT_CALL(mock, field_type(1)).WillRepeatedly(Return(FLOAT8OID));
+    EXPECT_CALL(mock, get_value(_, 1)).WillRepeatedly(Return(float8_bytes));
+    EXPECT_CALL(mock, get_length(_, 1)).WillRepeatedly(Return(sizeof(float8_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 1)).WillRepeatedly(Return(false));
+
+    EXPECT_CALL(mock, field_type(2)).WillRepeatedly(Return(INT2OID));
+    EXPECT_CALL(mock, get_value(_, 2)).WillRepeatedly(Return(int16_bytes));
+    EXPECT_CALL(mock, get_length(_, 2)).WillRepeatedly(Return(sizeof(int16_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 2)).WillRepeatedly(Return(false));
+
+    EXPECT_CALL(mock, field_type(3)).WillRepeatedly(Return(BOOLOID));
+    EXPECT_CALL(mock, get_value(_, 3)).WillRepeatedly(Return(bool_bytes));
+    EXPECT_CALL(mock, get_length(_, 3)).WillRepeatedly(Return(sizeof(bool_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 3)).WillRepeatedly(Return(false));
+
+    std::tuple<int64_t, double, int16_t, bool> got;
+    ozo::recv_row(row, oid_map, got);
+    EXPECT_EQ(std::get<0>(got), 7);
+    EXPECT_DOUBLE_EQ(std::get<1>(got), 42.13);
+    EXPECT_EQ(std::get<2>(got), -2);
+    EXPECT_TRUE(std::get<3>(got));
+}
+
+TEST_F(recv_row, should_convert_fixed_layout_row_to_fusion_adapted_structure) {
+    const char int64_bytes[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07 };
+    const char float8_bytes[] = { 0x40, 0x45, 0x10, static_cast<char>(0xA3),
+        static_cast<char>(0xD7), 0x0A, 0x3D, 0x71 };
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(2));
+
+    EXPECT_CALL(mock, field_number(Eq("id"))).WillOnce(Return(1));
+    EXPECT_CALL(mock, field_type(1)).WillRepeatedly(Return(INT8OID));
+    EXPECT_CALL(mock, get_value(_, 1)).WillRepeatedly(Return(int64_bytes));
+    EXPECT_CALL(mock, get_length(_, 1)).WillRepeatedly(Return(sizeof(int64_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 1)).WillRepeatedly(Return(false));
+
+    EXPECT_CALL(mock, field_number(Eq("value"))).WillOnce(Return(0));
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(FLOAT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(float8_bytes));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(sizeof(float8_bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    fixed_layout_test_result got;
+    ozo::recv_row(row, oid_map, got);
+    EXPECT_EQ(got.id, 7);
+    EXPECT_DOUBLE_EQ(got.value, 42.13);
+}
+
+TEST_F(recv_row, should_convert_fixed_layout_row_with_text_format_value) {
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+
+    EXPECT_CALL(mock, field_format(0)).WillRepeatedly(Return(ozo::impl::result_format::text));
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(INT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return("7"));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(1));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    std::tuple<int64_t> got;
+    ozo::recv_row(row, oid_map, got);
+    EXPECT_EQ(std::get<0>(got), 7);
+}
+
+TEST_F(recv_row, should_throw_range_error_if_fixed_layout_row_value_size_does_not_match) {
+    const char bytes[] = { 0x00, 0x00, 0x00, 0x07 };
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(INT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(bytes));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(sizeof(bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    std::tuple<int64_t> got;
+    EXPECT_THROW(ozo::recv_row(row, oid_map, got), std::range_error);
+}
+
+TEST_F(recv_row, should_throw_invalid_argument_if_fixed_layout_row_value_is_null) {
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(INT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(nullptr));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(0));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(true));
+
+    std::tuple<int64_t> got;
+    EXPECT_THROW(ozo::recv_row(row, oid_map, got), std::invalid_argument);
+}
+
+TEST_F(recv_row, should_throw_system_error_if_fixed_layout_row_value_oid_does_not_match) {
+    const char bytes[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07 };
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(FLOAT8OID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(bytes));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(sizeof(bytes)));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    std::tuple<int64_t> got;
+    EXPECT_THROW(ozo::recv_row(row, oid_map, got), ozo::system_error);
+}
+
 struct recv_result : Test {
     ozo::empty_oid_map oid_map{};
     StrictMock<pg_result_mock> mock{};
     ozo::basic_result<pg_result_mock*> res{&mock};
+
+    recv_result() {
+        EXPECT_CALL(mock, field_format(_)).WillRepeatedly(Return(ozo::impl::result_format::binary));
+    }
 };
 
 TEST_F(recv_result, send_convert_INT4OID_and_TEXTOID_to_fusion_adapted_structures_vector_via_back_inserter) {
@@ -505,6 +709,44 @@ TEST_F(recv_result, send_convert_INT4OID_and_TEXTOID_to_fusion_adapted_structure
     EXPECT_EQ(got[1].text, "test");
 }
 
+TEST_F(recv_result, should_construct_rows_with_given_allocator_via_back_inserter) {
+    const std::string text = "a text which does not fit into a small string buffer";
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+    EXPECT_CALL(mock, ntuples()).WillRepeatedly(Return(2));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(TEXTOID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(text.data()));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(text.size()));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    std::size_t count = 0;
+    std::vector<std::tuple<counted_string>> got;
+    ozo::recv_result(res, oid_map, std::back_inserter(got), counting_allocator<char>{&count});
+    ASSERT_EQ(got.size(), 2u);
+    EXPECT_EQ(std::get<0>(got[0]).get_allocator().count, &count);
+    EXPECT_EQ(std::get<0>(got[1]).get_allocator().count, &count);
+    EXPECT_EQ(count, 2u);
+}
+
+TEST_F(recv_result, should_allocate_shared_ptr_nullables_with_slab_allocator) {
+    const std::string text = "test";
+
+    EXPECT_CALL(mock, nfields()).WillRepeatedly(Return(1));
+    EXPECT_CALL(mock, ntuples()).WillRepeatedly(Return(2));
+
+    EXPECT_CALL(mock, field_type(0)).WillRepeatedly(Return(TEXTOID));
+    EXPECT_CALL(mock, get_value(_, 0)).WillRepeatedly(Return(text.data()));
+    EXPECT_CALL(mock, get_length(_, 0)).WillRepeatedly(Return(text.size()));
+    EXPECT_CALL(mock, get_isnull(_, 0)).WillRepeatedly(Return(false));
+
+    std::vector<std::shared_ptr<std::string>> got;
+    ozo::recv_result(res, oid_map, std::back_inserter(got), ozo::slab_allocator<char>{});
+    ASSERT_EQ(got.size(), 2u);
+    EXPECT_EQ(*got[0], "test");
+    EXPECT_EQ(*got[1], "test");
+}
+
 TEST_F(recv_result, send_convert_INT4OID_and_TEXTOID_to_fusion_adapted_structures_vector_via_iterator) {
     const char int32_bytes[] = { 0x00, 0x00, 0x00, 0x07 };
     const char* string_bytes = "test";
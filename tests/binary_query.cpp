@@ -36,6 +36,20 @@ TEST_F(binary_query_text, should_be_equal_to_input) {
     EXPECT_STREQ(query.text(), "query");
 }
 
+struct binary_query_result_format : Test {};
+
+TEST_F(binary_query_result_format, should_be_binary_by_default) {
+    const auto query = ozo::make_binary_query(ozo::make_query("query"));
+    EXPECT_EQ(query.result_format(), ozo::impl::result_format::binary);
+}
+
+TEST_F(binary_query_result_format, from_text_result_query_should_be_text) {
+    const auto query = ozo::make_binary_query(ozo::text_result(ozo::make_query("query", 42)));
+    EXPECT_EQ(query.result_format(), ozo::impl::result_format::text);
+    EXPECT_STREQ(query.text(), "query");
+    EXPECT_EQ(query.params_count, 1u);
+}
+
 struct binary_query_types : Test {};
 
 TEST_F(binary_query_types, for_param_should_be_equal_to_type_oid) {
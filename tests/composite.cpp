@@ -1,6 +1,10 @@
 #include "result_mock.h"
 #include <ozo/ext/std/tuple.h>
 #include <ozo/io/composite.h>
+#include <ozo/io/array.h>
+#include <ozo/ext/boost/optional.h>
+#include <ozo/ext/std/vector.h>
+#include <ozo/ext/std/shared_ptr.h>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
@@ -14,11 +18,25 @@ struct hana_test_struct {
     std::int64_t number;
 };
 
+struct fusion_nullable_test_struct {
+    boost::optional<std::string> string;
+    std::int64_t number;
+};
+
+struct hana_nullable_test_struct {
+    boost::optional<std::string> string;
+    std::int64_t number;
+};
+
 BOOST_FUSION_ADAPT_STRUCT(fusion_test_struct, string, number)
 BOOST_HANA_ADAPT_STRUCT(hana_test_struct, string, number);
+BOOST_FUSION_ADAPT_STRUCT(fusion_nullable_test_struct, string, number)
+BOOST_HANA_ADAPT_STRUCT(hana_nullable_test_struct, string, number);
 
 OZO_PG_DEFINE_CUSTOM_TYPE(fusion_test_struct, "fusion_test_struct")
 OZO_PG_DEFINE_CUSTOM_TYPE(hana_test_struct, "hana_test_struct")
+OZO_PG_DEFINE_CUSTOM_TYPE(fusion_nullable_test_struct, "fusion_nullable_test_struct")
+OZO_PG_DEFINE_CUSTOM_TYPE(hana_nullable_test_struct, "hana_nullable_test_struct")
 
 
 static bool operator == (const fusion_test_struct& rhs, const fusion_test_struct& lhs) {
@@ -126,6 +144,10 @@ struct recv_composite : Test {
     StrictMock<ozo::tests::pg_result_mock>  mock{};
     ozo::value<ozo::tests::pg_result_mock>  value{{&mock, 0, 0}};
     decltype(ozo::register_types<fusion_test_struct, hana_test_struct>()) oid_map;
+
+    recv_composite() {
+        EXPECT_CALL(mock, field_format(_)).WillRepeatedly(Return(ozo::impl::result_format::binary));
+    }
 };
 
 TEST_F(recv_composite, should_receive_fusion_adapted_structure) {
@@ -231,4 +253,208 @@ TEST_F(recv_composite, should_throw_exception_if_wrong_number_of_fields_are_rece
     EXPECT_THROW(ozo::recv(value, oid_map, got), std::range_error);
 }
 
+struct recv_composite_array : Test {
+    decltype(ozo::register_types<fusion_test_struct, hana_test_struct,
+        fusion_nullable_test_struct, hana_nullable_test_struct>()) oid_map;
+    std::vector<char> bytes;
+
+    recv_composite_array() {
+        ozo::set_type_oid<fusion_test_struct>(oid_map, 0x10);
+        ozo::set_type_oid<hana_test_struct>(oid_map, 0x11);
+        ozo::set_type_oid<fusion_nullable_test_struct>(oid_map, 0x12);
+        ozo::set_type_oid<hana_nullable_test_struct>(oid_map, 0x13);
+    }
+
+    void write_int(std::uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            bytes.push_back(char(v >> shift & 0xFF));
+        }
+    }
+
+    void write_header(ozo::oid_t elemtype, std::uint32_t size) {
+        write_int(1);        // Number of dimensions
+        write_int(0);        // Data offset
+        write_int(elemtype); // Element type oid
+        write_int(size);     // Dimension size
+        write_int(1);        // Dimension index
+    }
+
+    void write_element(ozo::oid_t string_oid, const std::string& string, std::uint32_t number) {
+        write_int(4 + 2 * 8 + std::uint32_t(string.size()) + 8); // Element size
+        write_int(2);          // Number of members
+        write_int(string_oid); //   Oid
+        write_int(std::uint32_t(string.size()));
+        bytes.insert(bytes.end(), string.begin(), string.end());
+        write_int(INT8OID);    //   Oid
+        write_int(8);          //   size
+        write_int(0);
+        write_int(number);
+    }
+
+    void write_element_with_null_string(std::uint32_t number) {
+        write_int(4 + 2 * 8 + 8); // Element size
+        write_int(2);             // Number of members
+        write_int(TEXTOID);       //   Oid
+        write_int(std::uint32_t(-1));
+        write_int(INT8OID);       //   Oid
+        write_int(8);             //   size
+        write_int(0);
+        write_int(number);
+    }
+
+    void write_null_element() {
+        write_int(std::uint32_t(-1));
+    }
+
+    template <typename T>
+    void recv(T& out) {
+        ozo::detail::istreambuf_view sbuf(bytes.data(), bytes.size());
+        ozo::istream in(&sbuf);
+        ozo::detail::get_recv_impl<T>::apply(in, ozo::size_type(bytes.size()), oid_map, out);
+    }
+};
+
+TEST_F(recv_composite_array, should_receive_vector_of_fusion_adapted_structures) {
+    write_header(0x10, 3);
+    write_element(TEXTOID, "one", 1);
+    write_element(TEXTOID, "two", 2);
+    write_element(TEXTOID, "three", 3);
+
+    std::vector<fusion_test_struct> got;
+    recv(got);
+    EXPECT_THAT(got, ElementsAre(
+        fusion_test_struct{"one", 1},
+        fusion_test_struct{"two", 2},
+        fusion_test_struct{"three", 3}
+    ));
+}
+
+TEST_F(recv_composite_array, should_receive_vector_of_hana_adapted_structures) {
+    write_header(0x11, 2);
+    write_element(TEXTOID, "one", 1);
+    write_element(TEXTOID, "two", 2);
+
+    std::vector<hana_test_struct> got;
+    recv(got);
+    EXPECT_THAT(got, ElementsAre(
+        hana_test_struct{"one", 1},
+        hana_test_struct{"two", 2}
+    ));
+}
+
+TEST_F(recv_composite_array, should_throw_if_field_oid_of_first_element_does_not_match) {
+    write_header(0x10, 2);
+    write_element(INT4OID, "one", 1);
+    write_element(TEXTOID, "two", 2);
+
+    std::vector<fusion_test_struct> got;
+    EXPECT_THROW(recv(got), ozo::system_error);
+}
+
+TEST_F(recv_composite_array, should_verify_field_oids_with_first_not_null_element) {
+    write_header(0x10, 3);
+    write_null_element();
+    write_element(INT4OID, "one", 1);
+    write_element(TEXTOID, "two", 2);
+
+    std::vector<boost::optional<fusion_test_struct>> got;
+    EXPECT_THROW(recv(got), ozo::system_error);
+}
+
+TEST_F(recv_composite_array, should_receive_vector_of_nullable_structures) {
+    write_header(0x10, 3);
+    write_element(TEXTOID, "one", 1);
+    write_null_element();
+    write_element(TEXTOID, "three", 3);
+
+    std::vector<boost::optional<fusion_test_struct>> got;
+    recv(got);
+    ASSERT_EQ(got.size(), 3u);
+    ASSERT_TRUE(got[0]);
+    EXPECT_EQ(*got[0], fusion_test_struct({"one", 1}));
+    EXPECT_FALSE(got[1]);
+    ASSERT_TRUE(got[2]);
+    EXPECT_EQ(*got[2], fusion_test_struct({"three", 3}));
+}
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    std::size_t* count;
+
+    explicit counting_allocator(std::size_t* count) : count(count) {}
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U>& other) : count(other.count) {}
+
+    T* allocate(std::size_t n) {
+        ++*count;
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        std::allocator<T>{}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator ==(const counting_allocator<U>& rhs) const { return count == rhs.count; }
+
+    template <typename U>
+    bool operator !=(const counting_allocator<U>& rhs) const { return !(*this == rhs); }
+};
+
+TEST_F(recv_composite_array, should_allocate_nullable_structures_with_allocator_of_array) {
+    write_header(0x10, 2);
+    write_element(TEXTOID, "one", 1);
+    write_element(TEXTOID, "two", 2);
+
+    using item_type = std::shared_ptr<fusion_test_struct>;
+    std::size_t count = 0;
+    std::vector<item_type, counting_allocator<item_type>> got(counting_allocator<item_type>{&count});
+    recv(got);
+    ASSERT_EQ(got.size(), 2u);
+    ASSERT_TRUE(got[0]);
+    EXPECT_EQ(*got[0], fusion_test_struct({"one", 1}));
+    ASSERT_TRUE(got[1]);
+    EXPECT_EQ(*got[1], fusion_test_struct({"two", 2}));
+    EXPECT_EQ(count, 3u); // the array storage and two items
+}
+
+TEST_F(recv_composite_array, should_verify_field_oid_after_null_field_of_fusion_adapted_structure) {
+    write_header(0x12, 2);
+    write_element_with_null_string(1);
+    write_element(INT4OID, "two", 2);
+
+    std::vector<fusion_nullable_test_struct> got;
+    EXPECT_THROW(recv(got), ozo::system_error);
+}
+
+TEST_F(recv_composite_array, should_verify_field_oid_after_null_field_of_hana_adapted_structure) {
+    write_header(0x13, 2);
+    write_element_with_null_string(1);
+    write_element(INT4OID, "two", 2);
+
+    std::vector<hana_nullable_test_struct> got;
+    EXPECT_THROW(recv(got), ozo::system_error);
+}
+
+TEST_F(recv_composite_array, should_receive_vector_of_structures_with_null_fields) {
+    write_header(0x13, 3);
+    write_element_with_null_string(1);
+    write_element(TEXTOID, "two", 2);
+    write_element_with_null_string(3);
+
+    std::vector<hana_nullable_test_struct> got;
+    recv(got);
+    ASSERT_EQ(got.size(), 3u);
+    EXPECT_FALSE(got[0].string);
+    EXPECT_EQ(got[0].number, 1);
+    ASSERT_TRUE(got[1].string);
+    EXPECT_EQ(*got[1].string, "two");
+    EXPECT_EQ(got[1].number, 2);
+    EXPECT_FALSE(got[2].string);
+    EXPECT_EQ(got[2].number, 3);
+}
+
 } // namespace
@@ -0,0 +1,369 @@
+#include <ozo/connection_cluster.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <map>
+
+namespace {
+
+using namespace testing;
+
+using ozo::error_code;
+using ozo::target_role;
+
+// Reports its return to the host load like a connection of a pool
+struct host_connection {
+    std::size_t host;
+    ozo::impl::host_load_ptr host_load_;
+    ozo::time_traits::duration host_latency_ {};
+
+    ~host_connection() {
+        if (host_load_) {
+            host_load_->release(host_latency_, ozo::time_traits::time_point::clock::now());
+        }
+    }
+};
+
+using host_connection_ptr = std::shared_ptr<host_connection>;
+
+struct cluster_mock {
+    std::vector<bool> in_recovery;
+    std::map<std::size_t, error_code> connect_errors;
+    std::map<std::size_t, error_code> probe_errors;
+    std::vector<std::size_t> connects;
+    std::vector<std::size_t> probes;
+    std::map<std::size_t, std::uint64_t> replay_lsn;
+    std::vector<std::size_t> lsn_checks;
+    bool defer_probes = false;
+    std::vector<std::function<void()>> deferred_probes;
+};
+
+struct host_source {
+    using connection_type = host_connection_ptr;
+
+    cluster_mock* mock;
+    std::size_t host;
+
+    template <typename Handler>
+    void operator ()(ozo::io_context&, Handler&& handler) const {
+        mock->connects.push_back(host);
+        const auto error = mock->connect_errors.find(host);
+        if (error != mock->connect_errors.end()) {
+            return handler(error->second, connection_type {});
+        }
+        auto conn = std::make_shared<host_connection>();
+        conn->host = host;
+        handler(error_code {}, std::move(conn));
+    }
+};
+
+struct role_probe {
+    cluster_mock* mock;
+
+    template <typename Handler>
+    void operator ()(host_connection_ptr conn, const ozo::time_traits::duration&, Handler&& handler) const {
+        mock->probes.push_back(conn->host);
+        if (mock->defer_probes) {
+            auto h = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+            mock->deferred_probes.push_back([h, conn, in_recovery = mock->in_recovery[conn->host]] {
+                (*h)(error_code {}, conn, in_recovery);
+            });
+            return;
+        }
+        const auto error = mock->probe_errors.find(conn->host);
+        if (error != mock->probe_errors.end()) {
+            return handler(error->second, std::move(conn), false);
+        }
+        const bool in_recovery = mock->in_recovery[conn->host];
+        handler(error_code {}, std::move(conn), in_recovery);
+    }
+
+    template <typename Handler>
+    void replay_lsn(host_connection_ptr conn, const ozo::time_traits::duration&, Handler&& handler) const {
+        mock->lsn_checks.push_back(conn->host);
+        const auto lsn = mock->replay_lsn[conn->host];
+        handler(error_code {}, std::move(conn), lsn);
+    }
+};
+
+using state_type = ozo::impl::cluster_state<host_source, role_probe>;
+
+struct connection_cluster : Test {
+    ozo::io_context io;
+    cluster_mock mock;
+    std::shared_ptr<state_type> state;
+    std::vector<std::size_t> provided;
+    std::vector<error_code> errors;
+
+    void make_cluster(std::vector<bool> in_recovery,
+            ozo::time_traits::duration role_check_interval = std::chrono::seconds(10),
+            ozo::time_traits::duration latency_decay = std::chrono::seconds(10)) {
+        mock.in_recovery = std::move(in_recovery);
+        std::vector<host_source> hosts;
+        for (std::size_t i = 0; i != mock.in_recovery.size(); ++i) {
+            hosts.push_back(host_source {&mock, i});
+        }
+        state = std::make_shared<state_type>(std::move(hosts), role_probe {&mock},
+            role_check_interval, std::chrono::seconds(1), latency_decay);
+    }
+
+    std::vector<host_connection_ptr> held;
+
+    void connect(target_role role, bool hold = false) {
+        ozo::impl::async_cluster_connect(state, io, role, [this, hold] (error_code ec, host_connection_ptr conn) {
+            errors.push_back(ec);
+            if (conn) {
+                provided.push_back(conn->host);
+            }
+            if (hold) {
+                held.push_back(std::move(conn));
+            }
+        });
+        io.poll();
+        io.restart();
+    }
+
+    void connect(std::uint64_t min_lsn) {
+        ozo::impl::async_session_connect(state, io, min_lsn, [this] (error_code ec, host_connection_ptr conn) {
+            errors.push_back(ec);
+            if (conn) {
+                provided.push_back(conn->host);
+            }
+        });
+        io.poll();
+        io.restart();
+    }
+};
+
+TEST_F(connection_cluster, should_provide_connection_to_primary_host_after_role_check) {
+    make_cluster({true, false});
+    connect(target_role::primary);
+    EXPECT_THAT(provided, ElementsAre(1u));
+    EXPECT_THAT(errors, ElementsAre(error_code {}));
+    EXPECT_THAT(mock.probes, Contains(1u));
+}
+
+TEST_F(connection_cluster, should_not_check_known_role_of_host) {
+    make_cluster({true, false});
+    connect(target_role::primary);
+    connect(target_role::replica);
+    mock.probes.clear();
+    mock.connects.clear();
+    provided.clear();
+
+    connect(target_role::primary);
+    connect(target_role::replica);
+    EXPECT_THAT(provided, ElementsAre(1u, 0u));
+    EXPECT_THAT(mock.connects, ElementsAre(1u, 0u));
+    EXPECT_THAT(mock.probes, IsEmpty());
+}
+
+TEST_F(connection_cluster, should_check_role_again_after_check_interval) {
+    make_cluster({true, false}, ozo::time_traits::duration::zero());
+    connect(target_role::primary);
+    mock.probes.clear();
+
+    connect(target_role::primary);
+    EXPECT_THAT(provided, ElementsAre(1u, 1u));
+    EXPECT_THAT(mock.probes, Contains(1u));
+}
+
+TEST_F(connection_cluster, should_spread_replica_requests_over_replicas) {
+    make_cluster({false, true, true});
+    connect(target_role::replica);
+    connect(target_role::replica);
+    connect(target_role::replica);
+    connect(target_role::replica);
+    EXPECT_THAT(provided, Contains(1u));
+    EXPECT_THAT(provided, Contains(2u));
+    EXPECT_THAT(provided, Not(Contains(0u)));
+}
+
+TEST_F(connection_cluster, should_provide_primary_for_prefer_replica_if_there_is_no_replica) {
+    make_cluster({false});
+    connect(target_role::prefer_replica);
+    EXPECT_THAT(provided, ElementsAre(0u));
+    EXPECT_THAT(errors, ElementsAre(error_code {}));
+}
+
+TEST_F(connection_cluster, should_provide_replica_for_prefer_replica_if_there_is_one) {
+    make_cluster({false, true});
+    connect(target_role::prefer_replica);
+    connect(target_role::prefer_replica);
+    EXPECT_THAT(provided, ElementsAre(1u, 1u));
+}
+
+TEST_F(connection_cluster, should_fail_with_no_suitable_host_if_there_is_no_host_of_role) {
+    make_cluster({false});
+    connect(target_role::replica);
+    EXPECT_THAT(provided, IsEmpty());
+    EXPECT_THAT(errors, ElementsAre(error_code {ozo::error::no_suitable_host}));
+
+    connect(target_role::replica);
+    EXPECT_THAT(errors, ElementsAre(error_code {ozo::error::no_suitable_host}, error_code {ozo::error::no_suitable_host}));
+    EXPECT_THAT(mock.connects, ElementsAre(0u));
+}
+
+TEST_F(connection_cluster, should_skip_host_which_failed_to_provide_connection) {
+    make_cluster({false, false});
+    mock.connect_errors[0] = ozo::error::pq_connection_status_bad;
+    connect(target_role::primary);
+    connect(target_role::primary);
+    EXPECT_THAT(provided, ElementsAre(1u, 1u));
+}
+
+TEST_F(connection_cluster, should_not_mark_host_unavailable_on_error_of_pool_queue) {
+    make_cluster({false});
+    mock.connect_errors[0] = yamail::resource_pool::error::get_resource_timeout;
+    connect(target_role::primary);
+    EXPECT_THAT(errors, ElementsAre(error_code {yamail::resource_pool::error::get_resource_timeout}));
+    EXPECT_EQ(state->hosts[0]->role.load(), ozo::impl::host_role::unknown);
+}
+
+TEST_F(connection_cluster, should_mark_host_unavailable_on_connect_error) {
+    make_cluster({false});
+    mock.connect_errors[0] = ozo::error::pq_connection_status_bad;
+    connect(target_role::primary);
+    EXPECT_EQ(state->hosts[0]->role.load(), ozo::impl::host_role::unavailable);
+}
+
+TEST_F(connection_cluster, should_keep_one_role_probe_in_flight_per_host) {
+    make_cluster({false});
+    mock.defer_probes = true;
+    connect(target_role::primary);
+    connect(target_role::primary);
+    EXPECT_THAT(mock.probes, ElementsAre(0u));
+    EXPECT_THAT(provided, IsEmpty());
+
+    for (auto& probe : std::exchange(mock.deferred_probes, {})) {
+        probe();
+    }
+    io.poll();
+    io.restart();
+    EXPECT_THAT(provided, ElementsAre(0u, 0u));
+    EXPECT_THAT(mock.probes, ElementsAre(0u));
+}
+
+TEST_F(connection_cluster, should_fail_with_last_error_if_all_hosts_failed) {
+    make_cluster({false, false});
+    mock.connect_errors[0] = ozo::error::pq_connection_status_bad;
+    mock.probe_errors[1] = ozo::error::bad_result_process;
+    connect(target_role::primary);
+    EXPECT_THAT(provided, IsEmpty());
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_TRUE(errors[0] == ozo::error::pq_connection_status_bad || errors[0] == ozo::error::bad_result_process);
+}
+
+TEST_F(connection_cluster, should_count_provided_connection_in_host_load_until_it_is_returned) {
+    make_cluster({false});
+    connect(target_role::primary, true);
+    auto& load = state->hosts[0]->load;
+    EXPECT_EQ(load.in_flight(), 1u);
+
+    held.clear();
+    EXPECT_EQ(load.in_flight(), 0u);
+    EXPECT_GT(load.latency(ozo::time_traits::time_point::clock::now()), 0.0);
+}
+
+TEST_F(connection_cluster, should_prefer_host_with_less_requests_in_flight) {
+    // Latencies of role probes are not taken into account without the decay time
+    make_cluster({true, true}, std::chrono::seconds(10), ozo::time_traits::duration::zero());
+    connect(target_role::replica);
+    connect(target_role::replica);
+    provided.clear();
+
+    connect(target_role::replica, true);
+    connect(target_role::replica, true);
+    connect(target_role::replica, true);
+    connect(target_role::replica, true);
+    EXPECT_EQ(std::count(provided.begin(), provided.end(), 0u), 2);
+    EXPECT_EQ(std::count(provided.begin(), provided.end(), 1u), 2);
+}
+
+TEST_F(connection_cluster, should_prefer_host_with_lower_latency) {
+    make_cluster({true, true});
+    connect(target_role::replica);
+    connect(target_role::replica);
+    provided.clear();
+
+    const auto now = ozo::time_traits::time_point::clock::now();
+    auto& slow = state->hosts[0]->load;
+    slow.acquire();
+    slow.release(std::chrono::seconds(1), now);
+
+    for (int i = 0; i != 10; ++i) {
+        connect(target_role::replica);
+    }
+    EXPECT_THAT(provided, Each(1u));
+}
+
+TEST(host_load, latency_should_decay_with_time) {
+    const auto decay = std::chrono::seconds(10);
+    ozo::impl::host_load load(decay);
+    const auto now = ozo::time_traits::time_point::clock::now();
+    load.acquire();
+    load.release(std::chrono::milliseconds(100), now);
+    EXPECT_DOUBLE_EQ(load.latency(now), 1e8);
+    EXPECT_LT(load.latency(now + decay), 1e8 / 2);
+}
+
+TEST(host_load, cost_should_grow_with_requests_in_flight) {
+    ozo::impl::host_load load;
+    const auto now = ozo::time_traits::time_point::clock::now();
+    const auto idle = load.cost(now);
+    load.acquire();
+    EXPECT_GT(load.cost(now), idle);
+}
+
+TEST_F(connection_cluster, session_connect_should_provide_replica_which_replayed_session_lsn) {
+    make_cluster({false, true});
+    mock.replay_lsn[1] = 100;
+    connect(std::uint64_t(100));
+    EXPECT_THAT(provided, ElementsAre(1u));
+    EXPECT_THAT(mock.lsn_checks, ElementsAre(1u));
+}
+
+TEST_F(connection_cluster, session_connect_should_fall_back_to_primary_when_replica_is_behind) {
+    make_cluster({false, true});
+    mock.replay_lsn[1] = 99;
+    connect(std::uint64_t(100));
+    EXPECT_THAT(provided, ElementsAre(0u));
+    EXPECT_THAT(errors, ElementsAre(error_code {}));
+}
+
+TEST_F(connection_cluster, session_connect_should_not_check_replica_known_to_have_replayed_session_lsn) {
+    make_cluster({false, true});
+    mock.replay_lsn[1] = 100;
+    connect(std::uint64_t(100));
+    connect(std::uint64_t(50));
+    EXPECT_THAT(provided, ElementsAre(1u, 1u));
+    EXPECT_THAT(mock.lsn_checks, ElementsAre(1u));
+}
+
+TEST_F(connection_cluster, session_connect_without_writes_should_not_check_replica) {
+    make_cluster({false, true});
+    connect(std::uint64_t(0));
+    EXPECT_THAT(provided, ElementsAre(1u));
+    EXPECT_TRUE(mock.lsn_checks.empty());
+}
+
+TEST_F(connection_cluster, session_connect_should_try_other_replica_when_first_one_is_behind) {
+    make_cluster({true, true, false});
+    mock.replay_lsn[0] = 10;
+    mock.replay_lsn[1] = 100;
+    connect(std::uint64_t(100));
+    EXPECT_THAT(provided, ElementsAre(1u));
+}
+
+TEST(session_token, should_advance_only_forward_and_share_position_between_copies) {
+    ozo::session_token token;
+    const auto copy = token;
+    EXPECT_EQ(copy.lsn(), 0u);
+    token.advance(100);
+    token.advance(50);
+    EXPECT_EQ(copy.lsn(), 100u);
+}
+
+} // namespace
@@ -18,4 +18,27 @@ TEST(connection_info, should_return_error_and_bad_connect_for_invalid_connection
     io.run();
 }
 
+TEST(connection_info, should_return_error_for_invalid_connection_string) {
+    const ozo::connection_info<> conn_info("invalid connection info");
+    EXPECT_FALSE(conn_info.conninfo_error().empty());
+}
+
+TEST(connection_info, should_return_no_error_for_valid_connection_string) {
+    const ozo::connection_info<> conn_info("host=localhost port=5432");
+    EXPECT_TRUE(conn_info.conninfo_error().empty());
+}
+
+TEST(connection_info, should_return_error_and_bad_connect_for_overridden_unreachable_host) {
+    ozo::io_context io;
+    const auto conn_info = ozo::connection_info<> {"host=localhost"}.with_param("host", "/nonexistent/ozo");
+
+    ozo::get_connection(ozo::make_connector(conn_info, io), [](ozo::error_code ec, auto conn){
+        EXPECT_TRUE(ec);
+        EXPECT_TRUE(!ozo::error_message(conn).empty());
+        EXPECT_TRUE(ozo::connection_bad(conn));
+    });
+
+    io.run();
+}
+
 } // namespace
@@ -8,11 +8,19 @@
 
 namespace ozo::tests {
 
-enum class native_handle {bad, good};
+enum class native_handle {bad, good, in_transaction, active};
 
 inline bool connection_status_bad(const native_handle* h) {
     return *h == native_handle::bad;
 }
+
+inline PGTransactionStatusType connection_transaction_status(const native_handle* h) {
+    switch (*h) {
+        case native_handle::in_transaction: return PQTRANS_INTRANS;
+        case native_handle::active: return PQTRANS_ACTIVE;
+        default: return PQTRANS_IDLE;
+    }
+}
 struct pg_result {
     ExecStatusType status;
     error_code error;
@@ -32,9 +40,13 @@ struct connection_mock {
     virtual int set_nonblocking() = 0;
     virtual int send_query_params() = 0;
     virtual int consume_input() = 0;
+    virtual bool input_pending() = 0;
     virtual bool is_busy() const = 0;
     virtual ozo::impl::query_state flush_output() = 0;
     virtual boost::optional<pg_result> get_result() = 0;
+    virtual int enter_pipeline_mode() = 0;
+    virtual int exit_pipeline_mode() = 0;
+    virtual int pipeline_sync() = 0;
 
     virtual int connect_poll() const = 0;
     virtual ozo::error_code start_connection(const std::string&) = 0;
@@ -50,9 +62,13 @@ struct connection_gmock : connection_mock {
     MOCK_METHOD0(set_nonblocking, int());
     MOCK_METHOD0(send_query_params, int());
     MOCK_METHOD0(consume_input, int());
+    MOCK_METHOD0(input_pending, bool());
     MOCK_CONST_METHOD0(is_busy, bool());
     MOCK_METHOD0(flush_output, ozo::impl::query_state());
     MOCK_METHOD0(get_result, boost::optional<pg_result>());
+    MOCK_METHOD0(enter_pipeline_mode, int());
+    MOCK_METHOD0(exit_pipeline_mode, int());
+    MOCK_METHOD0(pipeline_sync, int());
 
     MOCK_CONST_METHOD0(connect_poll, int());
     MOCK_METHOD1(start_connection, ozo::error_code(const std::string&));
@@ -99,6 +115,8 @@ struct connection {
     connection_mock* mock_ = nullptr;
     std::string error_context_;
     steady_timer timer_;
+    ozo::time_traits::time_point expires_at_ = ozo::time_traits::time_point::max();
+    ozo::time_traits::time_point idle_since_ = ozo::time_traits::time_point::max();
 
     friend int pq_set_nonblocking(connection& c) {
         return c.mock_->set_nonblocking();
@@ -113,6 +131,10 @@ struct connection {
         return c.mock_->consume_input();
     }
 
+    friend bool pq_input_pending(connection& c) noexcept {
+        return c.mock_->input_pending();
+    }
+
     friend bool pq_is_busy(connection& c) noexcept {
         return c.mock_->is_busy();
     }
@@ -125,6 +147,18 @@ struct connection {
         return c.mock_->get_result();
     }
 
+    friend int pq_enter_pipeline_mode(connection& c) noexcept {
+        return c.mock_->enter_pipeline_mode();
+    }
+
+    friend int pq_exit_pipeline_mode(connection& c) noexcept {
+        return c.mock_->exit_pipeline_mode();
+    }
+
+    friend int pq_pipeline_sync(connection& c) noexcept {
+        return c.mock_->pipeline_sync();
+    }
+
     friend int pq_connect_poll(connection& c) {
         return c.mock_->connect_poll();
     }
@@ -0,0 +1,363 @@
+#include "connection_mock.h"
+#include "test_error.h"
+
+#include <ozo/connection_multiplexer.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <deque>
+
+namespace {
+
+using namespace testing;
+using namespace ozo::tests;
+using namespace std::chrono_literals;
+
+using ozo::error_code;
+using ozo::time_traits;
+
+struct provider_mock {
+    ozo::tests::io_context io;
+    connection_mock* conn = nullptr;
+    stream_descriptor_mock* socket = nullptr;
+    steady_timer_mock* timer = nullptr;
+    std::size_t connects = 0;
+    std::vector<error_code> errors;
+    std::function<void()> deferred;
+    bool defer = false;
+};
+
+struct connection_provider {
+    using connection_type = connection_ptr<>;
+
+    provider_mock* mock;
+
+    template <typename Handler>
+    void async_get_connection(Handler&& handler) const {
+        ++mock->connects;
+        std::function<void(error_code, connection_type)> h = std::forward<Handler>(handler);
+        if (mock->defer) {
+            mock->defer = false;
+            mock->deferred = [*this, h] { complete(h); };
+            return;
+        }
+        complete(h);
+    }
+
+    void complete(const std::function<void(error_code, connection_type)>& handler) const {
+        if (!mock->errors.empty()) {
+            auto ec = mock->errors.front();
+            mock->errors.erase(mock->errors.begin());
+            return handler(ec, connection_type {});
+        }
+        handler(error_code {}, std::make_shared<connection<>>(connection<> {
+            std::make_unique<native_handle>(native_handle::good),
+            stream_descriptor {mock->io, *mock->socket},
+            {},
+            mock->conn,
+            "",
+            steady_timer {mock->timer}
+        }));
+    }
+};
+
+static_assert(!ozo::ConnectionProvider<ozo::connection_multiplexer<connection_provider>>,
+    "connection_multiplexer must not lend the shared connection");
+
+using multiplexer_state = ozo::impl::multiplexer_state<connection_provider>;
+
+struct connection_multiplexer : Test {
+    NiceMock<connection_gmock> conn_mock;
+    NiceMock<stream_descriptor_gmock> socket_mock;
+    NiceMock<steady_timer_gmock> timer_mock;
+    provider_mock mock;
+    std::deque<boost::optional<ozo::tests::pg_result>> results;
+    // Pending operations keep the multiplexer state alive, so it is destroyed
+    // after them and before the mocks
+    ozo::io_context io;
+    std::vector<std::function<void(error_code)>> reads;
+    std::vector<std::function<void(error_code)>> writes;
+    std::size_t sent = 0;
+    std::vector<int> processed;
+    std::vector<std::pair<int, error_code>> completed;
+
+    connection_multiplexer() {
+        mock.conn = &conn_mock;
+        mock.socket = &socket_mock;
+        mock.timer = &timer_mock;
+        ON_CALL(conn_mock, set_nonblocking()).WillByDefault(Return(0));
+        ON_CALL(conn_mock, enter_pipeline_mode()).WillByDefault(Return(1));
+        ON_CALL(conn_mock, exit_pipeline_mode()).WillByDefault(Return(1));
+        ON_CALL(conn_mock, pipeline_sync()).WillByDefault(Return(1));
+        ON_CALL(conn_mock, send_query_params()).WillByDefault(Invoke([this] { ++sent; return 1; }));
+        ON_CALL(conn_mock, consume_input()).WillByDefault(Return(1));
+        ON_CALL(conn_mock, is_busy()).WillByDefault(Return(false));
+        ON_CALL(conn_mock, flush_output()).WillByDefault(Return(ozo::impl::query_state::send_finish));
+        ON_CALL(conn_mock, get_result()).WillByDefault(Invoke([this] {
+            if (results.empty()) {
+                return boost::optional<ozo::tests::pg_result> {};
+            }
+            auto res = results.front();
+            results.pop_front();
+            return res;
+        }));
+        ON_CALL(socket_mock, async_read_some(_)).WillByDefault(Invoke([this] (auto h) { reads.push_back(h); }));
+        ON_CALL(socket_mock, async_write_some(_)).WillByDefault(Invoke([this] (auto h) { writes.push_back(h); }));
+    }
+
+    auto make_multiplexer(std::size_t queue_capacity = 1024) {
+        return std::make_shared<multiplexer_state>(io, connection_provider {&mock}, queue_capacity);
+    }
+
+    void request(multiplexer_state& multiplexer, int id, time_traits::duration timeout = time_traits::duration::max(),
+            bool throws = false) {
+        multiplexer.request(fake_query {}, timeout,
+            [this, id, throws] (auto, const auto&) {
+                if (throws) {
+                    throw std::runtime_error("error");
+                }
+                processed.push_back(id);
+            },
+            [this, id] (error_code ec, connection_ptr<>) {
+                completed.emplace_back(id, ec);
+            });
+    }
+
+    void add_result(ExecStatusType status, error_code ec = {}) {
+        results.push_back(make_pg_result(status, ec));
+        results.push_back(boost::none);
+        results.push_back(make_pg_result(PGRES_PIPELINE_SYNC, {}));
+    }
+
+    void poll() {
+        io.poll();
+        io.restart();
+    }
+
+    void readable() {
+        ASSERT_FALSE(reads.empty());
+        auto read = std::move(reads.back());
+        reads.pop_back();
+        read(error_code {});
+        poll();
+    }
+};
+
+TEST_F(connection_multiplexer, should_send_requests_back_to_back_without_waiting_for_results) {
+    auto multiplexer = make_multiplexer();
+    EXPECT_CALL(conn_mock, enter_pipeline_mode()).WillOnce(Return(1));
+    EXPECT_CALL(conn_mock, pipeline_sync()).Times(3).WillRepeatedly(Return(1));
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    request(*multiplexer, 3);
+    poll();
+
+    EXPECT_EQ(sent, 3u);
+    EXPECT_EQ(mock.connects, 1u);
+    EXPECT_EQ(reads.size(), 1u);
+    EXPECT_TRUE(completed.empty());
+    EXPECT_EQ(multiplexer->waiting(), 3u);
+}
+
+TEST_F(connection_multiplexer, should_dispatch_results_in_order_of_requests) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    request(*multiplexer, 3);
+    poll();
+
+    add_result(PGRES_TUPLES_OK);
+    add_result(PGRES_COMMAND_OK);
+    readable();
+
+    EXPECT_THAT(processed, ElementsAre(1));
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {}), std::make_pair(2, error_code {})));
+    EXPECT_EQ(multiplexer->waiting(), 1u);
+    EXPECT_EQ(reads.size(), 1u);
+
+    add_result(PGRES_TUPLES_OK);
+    readable();
+
+    EXPECT_THAT(processed, ElementsAre(1, 3));
+    EXPECT_EQ(completed.size(), 3u);
+    EXPECT_EQ(multiplexer->waiting(), 0u);
+    EXPECT_TRUE(reads.empty());
+}
+
+TEST_F(connection_multiplexer, should_wait_for_sync_point_before_next_request_result) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    poll();
+
+    results.push_back(make_pg_result(PGRES_TUPLES_OK, {}));
+    readable();
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {})));
+
+    results.push_back(boost::none);
+    results.push_back(make_pg_result(PGRES_PIPELINE_SYNC, {}));
+    add_result(PGRES_TUPLES_OK);
+    readable();
+    EXPECT_THAT(processed, ElementsAre(1, 2));
+    EXPECT_EQ(completed.size(), 2u);
+}
+
+TEST_F(connection_multiplexer, should_fail_only_request_with_error_result) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    poll();
+
+    add_result(PGRES_FATAL_ERROR, error::error);
+    add_result(PGRES_TUPLES_OK);
+    readable();
+
+    EXPECT_THAT(processed, ElementsAre(2));
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {error::error}),
+        std::make_pair(2, error_code {})));
+}
+
+TEST_F(connection_multiplexer, should_fail_request_with_bad_result_process_when_output_throws) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1, time_traits::duration::max(), true);
+    poll();
+
+    add_result(PGRES_TUPLES_OK);
+    readable();
+
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {ozo::error::bad_result_process})));
+}
+
+TEST_F(connection_multiplexer, should_complete_timed_out_request_and_drop_its_result) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2, 1ms);
+    request(*multiplexer, 3);
+    io.run_for(20ms);
+    io.restart();
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(2, error_code {boost::asio::error::timed_out})));
+
+    add_result(PGRES_TUPLES_OK);
+    add_result(PGRES_TUPLES_OK);
+    add_result(PGRES_TUPLES_OK);
+    readable();
+
+    EXPECT_THAT(processed, ElementsAre(1, 3));
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(2, error_code {boost::asio::error::timed_out}),
+        std::make_pair(1, error_code {}), std::make_pair(3, error_code {})));
+}
+
+TEST_F(connection_multiplexer, should_close_connection_and_fail_next_requests_when_first_request_in_pipeline_timed_out) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1, 1ms);
+    request(*multiplexer, 2);
+    poll();
+
+    EXPECT_CALL(socket_mock, close(_));
+    io.run_for(20ms);
+    io.restart();
+    EXPECT_THAT(completed, UnorderedElementsAre(std::make_pair(1, error_code {boost::asio::error::timed_out}),
+        std::make_pair(2, error_code {boost::asio::error::connection_aborted})));
+    EXPECT_EQ(multiplexer->waiting(), 0u);
+
+    request(*multiplexer, 3);
+    poll();
+    EXPECT_EQ(mock.connects, 2u);
+}
+
+TEST_F(connection_multiplexer, should_close_connection_and_fail_next_requests_when_timed_out_request_becomes_first_in_pipeline) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2, 1ms);
+    request(*multiplexer, 3);
+    io.run_for(20ms);
+    io.restart();
+
+    EXPECT_CALL(socket_mock, close(_));
+    add_result(PGRES_TUPLES_OK);
+    readable();
+
+    EXPECT_THAT(processed, ElementsAre(1));
+    EXPECT_THAT(completed, UnorderedElementsAre(std::make_pair(2, error_code {boost::asio::error::timed_out}),
+        std::make_pair(1, error_code {}), std::make_pair(3, error_code {boost::asio::error::connection_aborted})));
+    EXPECT_EQ(multiplexer->waiting(), 0u);
+}
+
+TEST_F(connection_multiplexer, should_flush_output_when_socket_becomes_writable) {
+    auto multiplexer = make_multiplexer();
+    EXPECT_CALL(conn_mock, flush_output())
+        .WillOnce(Return(ozo::impl::query_state::send_in_progress))
+        .WillRepeatedly(Return(ozo::impl::query_state::send_finish));
+    request(*multiplexer, 1);
+    poll();
+    ASSERT_EQ(writes.size(), 1u);
+
+    writes.front()(error_code {});
+    poll();
+
+    add_result(PGRES_COMMAND_OK);
+    readable();
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {})));
+}
+
+TEST_F(connection_multiplexer, should_fail_sent_requests_and_reconnect_when_connection_failed) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    poll();
+
+    EXPECT_CALL(socket_mock, close(_));
+    EXPECT_CALL(conn_mock, consume_input()).WillOnce(Return(0)).WillRepeatedly(Return(1));
+    readable();
+
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {ozo::error::pg_consume_input_failed}),
+        std::make_pair(2, error_code {ozo::error::pg_consume_input_failed})));
+    EXPECT_EQ(multiplexer->waiting(), 0u);
+
+    request(*multiplexer, 3);
+    poll();
+    EXPECT_EQ(mock.connects, 2u);
+    EXPECT_EQ(sent, 3u);
+}
+
+TEST_F(connection_multiplexer, should_fail_queued_requests_and_connect_for_next_request_when_connect_failed) {
+    auto multiplexer = make_multiplexer();
+    mock.defer = true;
+    mock.errors.push_back(error::error);
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    EXPECT_EQ(mock.connects, 1u);
+    std::exchange(mock.deferred, {})();
+    poll();
+    EXPECT_THAT(completed, ElementsAre(std::make_pair(1, error_code {error::error}),
+        std::make_pair(2, error_code {error::error})));
+
+    request(*multiplexer, 3);
+    poll();
+    EXPECT_EQ(mock.connects, 2u);
+    EXPECT_EQ(sent, 1u);
+}
+
+TEST_F(connection_multiplexer, should_fail_request_with_queue_overflow_when_queue_is_full) {
+    auto multiplexer = make_multiplexer(1);
+    request(*multiplexer, 1);
+    request(*multiplexer, 2);
+    poll();
+    EXPECT_THAT(completed, ElementsAre(
+        std::make_pair(2, error_code {yamail::resource_pool::error::request_queue_overflow})));
+}
+
+TEST_F(connection_multiplexer, should_return_connection_in_regular_mode_when_destroyed) {
+    auto multiplexer = make_multiplexer();
+    request(*multiplexer, 1);
+    poll();
+    add_result(PGRES_COMMAND_OK);
+    readable();
+
+    EXPECT_CALL(conn_mock, exit_pipeline_mode()).WillOnce(Return(1));
+    EXPECT_CALL(socket_mock, close(_)).Times(0);
+    multiplexer.reset();
+}
+
+} // namespace
@@ -7,6 +7,8 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <optional>
+
 namespace {
 
 TEST(make_connection_pool, should_not_throw) {
@@ -84,7 +86,18 @@ struct pooled_connection : Test {
     StrictMock<connection_gmock> connection_mock{};
     StrictMock<pool_handle_mock> handle_mock{};
 
+    ozo::io_context io;
+    std::shared_ptr<int> expiries = std::make_shared<int>(0);
+
     using impl = ozo::impl::pooled_connection<connection_provider>;
+
+    ozo::impl::connection_expiry make_expiry() {
+        return {expiries, std::addressof(io), {}, {},
+            [] (std::shared_ptr<void> state, ozo::io_context&, ozo::time_traits::duration, ozo::time_traits::duration) {
+                ++*std::static_pointer_cast<int>(state);
+            }};
+    }
+
     auto make_connection() {
         return std::make_shared<connection<>>();
     }
@@ -127,6 +140,63 @@ TEST_F(pooled_connection, should_call_nothing_on_destruction_if_handle_is_empty)
     }
 }
 
+TEST_F(pooled_connection, should_release_host_load_with_host_latency_on_destruction) {
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
+    auto load = std::make_shared<ozo::impl::host_load>();
+    load->acquire();
+
+    {
+        impl p(connection_pool::handle{&handle_mock});
+        p.host_load_ = load;
+        p.host_latency_ = std::chrono::milliseconds(5);
+    }
+
+    EXPECT_EQ(load->in_flight(), 0u);
+    EXPECT_NEAR(load->latency(ozo::time_traits::time_point::clock::now()) / 1e6, 5.0, 0.1);
+}
+
+TEST_F(pooled_connection, should_call_handle_waste_and_on_expiry_on_destruction_if_connection_is_good_and_expired) {
+    auto conn = make_connection(native_handle::good);
+    conn->expires_at_ = ozo::time_traits::time_point::clock::now();
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(handle_mock, waste()).WillOnce(Return());
+
+    {
+        impl p(connection_pool::handle{&handle_mock}, make_expiry());
+    }
+    EXPECT_EQ(*expiries, 1);
+}
+
+TEST_F(pooled_connection, should_not_call_on_expiry_on_destruction_if_connection_is_bad_and_expired) {
+    auto conn = make_connection(native_handle::bad);
+    conn->expires_at_ = ozo::time_traits::time_point::clock::now();
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(handle_mock, waste()).WillOnce(Return());
+
+    {
+        impl p(connection_pool::handle{&handle_mock}, make_expiry());
+    }
+    EXPECT_EQ(*expiries, 0);
+}
+
+TEST_F(pooled_connection, should_set_idle_time_on_destruction_if_connection_is_returned_to_pool) {
+    auto conn = make_connection(native_handle::good);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+
+    const auto before = ozo::time_traits::time_point::clock::now();
+    {
+        impl p(connection_pool::handle{&handle_mock});
+    }
+    EXPECT_GE(conn->idle_since_, before);
+    EXPECT_LE(conn->idle_since_, ozo::time_traits::time_point::clock::now());
+}
+
 TEST_F(pooled_connection, should_call_handle_reset_on_reset) {
     EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
     {
@@ -136,6 +206,388 @@ TEST_F(pooled_connection, should_call_handle_reset_on_reset) {
     }
 }
 
+TEST_F(pooled_connection, warm_up_join_should_return_idle_connection_at_once_and_hold_new_ones_until_all_are_done) {
+    auto idle = make_connection(native_handle::good);
+    idle->idle_since_ = ozo::time_traits::time_point::clock::now();
+    auto fresh = make_connection(native_handle::good);
+    NiceMock<pool_handle_mock> idle_handle;
+    NiceMock<pool_handle_mock> fresh_handle;
+    ON_CALL(idle_handle, value()).WillByDefault(ReturnRef(idle));
+    ON_CALL(fresh_handle, value()).WillByDefault(ReturnRef(fresh));
+
+    std::optional<ozo::error_code> done;
+    ozo::impl::warm_up_join<connection_provider, std::function<void(ozo::error_code)>> join {
+        [&] (ozo::error_code ec) { done = ec; }, 3, nullptr
+    };
+    auto idle_conn = std::make_shared<impl>(connection_pool::handle{&idle_handle});
+    auto fresh_conn = std::make_shared<impl>(connection_pool::handle{&fresh_handle});
+    const std::weak_ptr<impl> idle_weak = idle_conn;
+    const std::weak_ptr<impl> fresh_weak = fresh_conn;
+
+    join({}, std::move(fresh_conn));
+    join({}, std::move(idle_conn));
+    EXPECT_TRUE(idle_weak.expired());
+    EXPECT_FALSE(fresh_weak.expired());
+    EXPECT_FALSE(done);
+
+    join(error::error, nullptr);
+    EXPECT_TRUE(fresh_weak.expired());
+    ASSERT_TRUE(done);
+    EXPECT_EQ(*done, ozo::error_code(error::error));
+}
+
+struct pooled_connection_session_reset : pooled_connection {
+    struct call {
+        bool rollback;
+        bool reset;
+    };
+
+    static std::vector<call>& calls() {
+        static std::vector<call> result;
+        return result;
+    }
+
+    static void run(connection_pool::handle&, ozo::impl::pool_slot&, const ozo::impl::session_reset_config_ptr&,
+            bool rollback, bool reset) {
+        calls().push_back({rollback, reset});
+    }
+
+    pooled_connection_session_reset() { calls().clear(); }
+
+    impl::session_reset_type make_session_reset(ozo::session_reset_policy policy) {
+        return {
+            std::make_shared<ozo::impl::session_reset_config>(policy, "RESET ALL", std::chrono::seconds(1)),
+            &run
+        };
+    }
+
+    void destroy_acquired(native_handle h, ozo::session_reset_policy policy, bool dirty = false) {
+        auto conn = make_connection(h);
+        EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+        EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+        impl p(connection_pool::handle{&handle_mock}, {}, nullptr, ozo::impl::pool_slot {}, nullptr,
+            make_session_reset(policy));
+        p.acquired(ozo::time_traits::time_point::clock::now());
+        p.session_dirty_ = dirty;
+    }
+};
+
+TEST_F(pooled_connection_session_reset, should_not_reset_clean_session) {
+    destroy_acquired(native_handle::good, ozo::session_reset_policy::discard_all);
+    EXPECT_TRUE(calls().empty());
+}
+
+TEST_F(pooled_connection_session_reset, should_not_reset_session_with_none_policy) {
+    destroy_acquired(native_handle::in_transaction, ozo::session_reset_policy::none, true);
+    EXPECT_TRUE(calls().empty());
+}
+
+TEST_F(pooled_connection_session_reset, should_rollback_transaction_left_open_with_check_policy) {
+    destroy_acquired(native_handle::in_transaction, ozo::session_reset_policy::check);
+    ASSERT_EQ(calls().size(), 1u);
+    EXPECT_TRUE(calls()[0].rollback);
+    EXPECT_FALSE(calls()[0].reset);
+}
+
+TEST_F(pooled_connection_session_reset, should_not_reset_session_marked_dirty_with_check_policy) {
+    destroy_acquired(native_handle::good, ozo::session_reset_policy::check, true);
+    EXPECT_TRUE(calls().empty());
+}
+
+TEST_F(pooled_connection_session_reset, should_rollback_and_reset_session_with_transaction_left_open) {
+    destroy_acquired(native_handle::in_transaction, ozo::session_reset_policy::custom);
+    ASSERT_EQ(calls().size(), 1u);
+    EXPECT_TRUE(calls()[0].rollback);
+    EXPECT_TRUE(calls()[0].reset);
+}
+
+TEST_F(pooled_connection_session_reset, should_reset_session_marked_dirty) {
+    destroy_acquired(native_handle::good, ozo::session_reset_policy::discard_all, true);
+    ASSERT_EQ(calls().size(), 1u);
+    EXPECT_FALSE(calls()[0].rollback);
+    EXPECT_TRUE(calls()[0].reset);
+}
+
+TEST_F(pooled_connection_session_reset, should_waste_connection_with_query_in_progress) {
+    EXPECT_CALL(handle_mock, waste()).WillOnce(Return());
+    destroy_acquired(native_handle::active, ozo::session_reset_policy::discard_all);
+    EXPECT_TRUE(calls().empty());
+}
+
+TEST_F(pooled_connection_session_reset, should_not_reset_session_of_not_acquired_connection) {
+    auto conn = make_connection(native_handle::in_transaction);
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    {
+        impl p(connection_pool::handle{&handle_mock}, {}, nullptr, ozo::impl::pool_slot {}, nullptr,
+            make_session_reset(ozo::session_reset_policy::check));
+    }
+    EXPECT_TRUE(calls().empty());
+}
+
+TEST(session_reset_config, should_have_query_for_policy) {
+    using ozo::impl::session_reset_config;
+    using ozo::session_reset_policy;
+    EXPECT_EQ(session_reset_config(session_reset_policy::none, "RESET ALL", {}).query, "");
+    EXPECT_EQ(session_reset_config(session_reset_policy::check, "RESET ALL", {}).query, "");
+    EXPECT_EQ(session_reset_config(session_reset_policy::discard_all, "RESET ALL", {}).query, "DISCARD ALL");
+    EXPECT_EQ(session_reset_config(session_reset_policy::custom, "RESET ALL", {}).query, "RESET ALL");
+}
+
+struct fake_pool {
+    std::size_t capacity_;
+    std::size_t queue_capacity_;
+    ozo::time_traits::duration idle_timeout_;
+    std::size_t size_ = 0;
+    std::size_t available_ = 0;
+
+    fake_pool(std::size_t capacity, std::size_t queue_capacity, ozo::time_traits::duration idle_timeout)
+    : capacity_(capacity), queue_capacity_(queue_capacity), idle_timeout_(idle_timeout) {}
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t size() const { return size_; }
+    std::size_t available() const { return available_; }
+};
+
+TEST(connection_pool_histogram, bucket_should_count_durations_less_than_upper_bound) {
+    using histogram = ozo::connection_pool_histogram;
+    EXPECT_EQ(histogram::bucket(std::chrono::nanoseconds(500)), 0u);
+    EXPECT_EQ(histogram::bucket(std::chrono::microseconds(1)), 1u);
+    EXPECT_EQ(histogram::bucket(std::chrono::microseconds(3)), 2u);
+    EXPECT_EQ(histogram::bucket(std::chrono::microseconds(4)), 3u);
+    for (std::size_t i = 0; i + 1 < histogram::buckets_count; ++i) {
+        EXPECT_EQ(histogram::bucket(histogram::upper_bound(i) - std::chrono::nanoseconds(1)), i);
+    }
+}
+
+TEST(connection_pool_histogram, bucket_should_count_too_long_durations_in_the_last_bucket) {
+    using histogram = ozo::connection_pool_histogram;
+    EXPECT_EQ(histogram::bucket(std::chrono::hours(24)), histogram::buckets_count - 1);
+    EXPECT_EQ(histogram::upper_bound(histogram::buckets_count - 1), ozo::time_traits::duration::max());
+}
+
+TEST(pool_metrics, snapshot_should_contain_added_values) {
+    ozo::impl::pool_metrics metrics;
+    ozo::impl::pool_metrics::increment(metrics.queue_overflows);
+    metrics.wait_time.add(std::chrono::microseconds(3));
+    metrics.wait_time.add(std::chrono::microseconds(5));
+
+    const auto snapshot = metrics.snapshot();
+    EXPECT_EQ(snapshot.queue_overflows, 1u);
+    EXPECT_EQ(snapshot.acquisitions, 0u);
+    EXPECT_EQ(snapshot.wait_time.count, 2u);
+    EXPECT_EQ(snapshot.wait_time.sum, ozo::time_traits::duration(std::chrono::microseconds(8)));
+    EXPECT_EQ(snapshot.wait_time.buckets[2], 1u);
+    EXPECT_EQ(snapshot.wait_time.buckets[3], 1u);
+    EXPECT_EQ(snapshot.connect_time.count, 0u);
+}
+
+struct connection_lifespan : Test {
+    const ozo::time_traits::time_point now = ozo::time_traits::time_point::clock::now();
+};
+
+TEST_F(connection_lifespan, should_be_infinite_by_default) {
+    const ozo::impl::connection_lifespan lifespan;
+    EXPECT_FALSE(lifespan.finite());
+    EXPECT_EQ(lifespan.expires_at(now), ozo::time_traits::time_point::max());
+}
+
+TEST_F(connection_lifespan, without_jitter_should_expire_after_max_age) {
+    const ozo::impl::connection_lifespan lifespan {std::chrono::minutes(10), {}, {}};
+    EXPECT_TRUE(lifespan.finite());
+    EXPECT_EQ(lifespan.expires_at(now), now + std::chrono::minutes(10));
+}
+
+TEST_F(connection_lifespan, with_jitter_should_expire_not_later_than_max_age_and_not_earlier_than_max_age_minus_jitter) {
+    const ozo::impl::connection_lifespan lifespan {std::chrono::minutes(10), std::chrono::minutes(1), {}};
+    for (int i = 0; i != 100; ++i) {
+        const auto expires_at = lifespan.expires_at(now);
+        EXPECT_LE(expires_at, now + std::chrono::minutes(10));
+        EXPECT_GE(expires_at, now + std::chrono::minutes(9));
+    }
+}
+
+TEST_F(connection_lifespan, with_jitter_greater_than_max_age_should_expire_not_earlier_than_now) {
+    const ozo::impl::connection_lifespan lifespan {std::chrono::seconds(1), std::chrono::minutes(1), {}};
+    for (int i = 0; i != 100; ++i) {
+        EXPECT_GE(lifespan.expires_at(now), now);
+    }
+}
+
+struct pool_shards : Test {
+    using shards_type = ozo::impl::pool_shards<fake_pool>;
+    const int keys[3] = {};
+
+    static void exhaust(fake_pool& pool) {
+        pool.size_ = pool.capacity_;
+        pool.available_ = 0;
+    }
+};
+
+TEST_F(pool_shards, should_split_capacities_between_shards) {
+    shards_type shards(3, 10, 5, std::chrono::seconds(1));
+    ASSERT_EQ(shards.size(), 3u);
+    EXPECT_EQ(shards[0].capacity_, 4u);
+    EXPECT_EQ(shards[1].capacity_, 3u);
+    EXPECT_EQ(shards[2].capacity_, 3u);
+    EXPECT_EQ(shards[0].queue_capacity_, 2u);
+    EXPECT_EQ(shards[1].queue_capacity_, 2u);
+    EXPECT_EQ(shards[2].queue_capacity_, 1u);
+    EXPECT_EQ(shards[2].idle_timeout_, ozo::time_traits::duration(std::chrono::seconds(1)));
+}
+
+TEST_F(pool_shards, should_limit_shards_number_by_capacity) {
+    shards_type shards(8, 2, 5, std::chrono::seconds(1));
+    EXPECT_EQ(shards.size(), 2u);
+}
+
+TEST_F(pool_shards, should_create_at_least_one_shard) {
+    shards_type shards(0, 10, 5, std::chrono::seconds(1));
+    ASSERT_EQ(shards.size(), 1u);
+    EXPECT_EQ(shards[0].capacity_, 10u);
+    EXPECT_EQ(shards[0].queue_capacity_, 5u);
+}
+
+TEST_F(pool_shards, should_return_same_shard_for_same_key) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    EXPECT_EQ(&shards.get(&keys[0]), &shards.get(&keys[0]));
+}
+
+TEST_F(pool_shards, should_return_different_shards_for_different_keys) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    EXPECT_EQ(&shards.get(&keys[0]), &shards[0]);
+    EXPECT_EQ(&shards.get(&keys[1]), &shards[1]);
+}
+
+TEST_F(pool_shards, should_share_shards_if_there_are_more_keys_than_shards) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    shards.get(&keys[0]);
+    shards.get(&keys[1]);
+    auto& shard = shards.get(&keys[2]);
+    EXPECT_TRUE(&shard == &shards[0] || &shard == &shards[1]);
+    EXPECT_EQ(&shards.get(&keys[2]), &shard);
+}
+
+TEST_F(pool_shards, should_steal_from_other_shard_with_available_connection_if_local_shard_is_exhausted) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    shards.get(&keys[0]);
+    exhaust(shards[0]);
+    shards[1].available_ = 1;
+    EXPECT_EQ(&shards.get(&keys[0]), &shards[1]);
+}
+
+TEST_F(pool_shards, should_return_local_shard_if_it_has_room_for_new_connection) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    shards.get(&keys[0]);
+    shards[1].available_ = 1;
+    EXPECT_EQ(&shards.get(&keys[0]), &shards[0]);
+}
+
+TEST_F(pool_shards, should_return_local_shard_if_it_is_exhausted_and_others_have_no_available_connection) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    shards.get(&keys[0]);
+    exhaust(shards[0]);
+    EXPECT_EQ(&shards.get(&keys[0]), &shards[0]);
+}
+
+TEST_F(pool_shards, should_split_min_idle_between_shards) {
+    shards_type shards(3, 10, 5, std::chrono::seconds(1), 5);
+    EXPECT_EQ(shards.min_idle(0), 2u);
+    EXPECT_EQ(shards.min_idle(1), 2u);
+    EXPECT_EQ(shards.min_idle(2), 1u);
+}
+
+TEST_F(pool_shards, should_limit_min_idle_by_shard_capacity) {
+    shards_type shards(1, 2, 5, std::chrono::seconds(1), 4);
+    EXPECT_EQ(shards.min_idle(0), 2u);
+}
+
+TEST_F(pool_shards, start_keeping_min_idle_should_return_true_only_once_per_shard) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1), 2);
+    EXPECT_TRUE(shards.start_keeping_min_idle(0));
+    EXPECT_FALSE(shards.start_keeping_min_idle(0));
+    EXPECT_TRUE(shards.start_keeping_min_idle(1));
+}
+
+TEST_F(pool_shards, start_health_check_should_return_true_only_once_per_shard) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    EXPECT_TRUE(shards.start_health_check(1));
+    EXPECT_FALSE(shards.start_health_check(1));
+    EXPECT_TRUE(shards.start_health_check(0));
+}
+
+TEST_F(pool_shards, local_should_return_index_of_shard_owned_by_key) {
+    shards_type shards(2, 10, 5, std::chrono::seconds(1));
+    EXPECT_EQ(shards.local(&keys[0]), 0u);
+    EXPECT_EQ(shards.local(&keys[1]), 1u);
+    EXPECT_EQ(shards.local(&keys[0]), 0u);
+}
+
+struct connection_source {
+    using connection_type = std::shared_ptr<connection<>>;
+
+    std::vector<std::shared_ptr<void>>* pending = nullptr;
+
+    template <typename Handler>
+    void operator ()(ozo::io_context&, Handler&& h, ozo::time_traits::duration = ozo::time_traits::duration::max()) const {
+        if (pending) {
+            pending->push_back(std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(h)));
+        }
+    }
+};
+
+TEST(connection_pool_priority, should_not_request_more_connections_than_capacity_at_once) {
+    ozo::io_context io;
+    std::vector<std::shared_ptr<void>> pending;
+    ozo::connection_pool_config config;
+    config.capacity = 1;
+    auto pool = ozo::make_connection_pool(connection_source {&pending}, config);
+    const auto handler = [] (ozo::error_code, auto) {};
+    pool(io, handler);
+    pool(io, handler, ozo::connection_priority::high);
+    pool(io, handler, ozo::connection_pool_timeouts {}, ozo::connection_priority::low);
+    io.poll();
+    EXPECT_EQ(pending.size(), 1u);
+    pending.clear();
+    io.poll();
+    EXPECT_EQ(pending.size(), 1u);
+    pending.clear();
+    io.poll();
+    EXPECT_EQ(pending.size(), 1u);
+    pending.clear();
+    io.poll();
+    EXPECT_EQ(pending.size(), 0u);
+}
+
+TEST(connection_pool_shards, should_serve_request_by_other_shard_with_free_slot_if_local_shard_is_busy) {
+    ozo::io_context io;
+    std::vector<std::shared_ptr<void>> pending;
+    ozo::connection_pool_config config;
+    config.capacity = 2;
+    config.shards = 2;
+    auto pool = ozo::make_connection_pool(connection_source {&pending}, config);
+    const auto handler = [] (ozo::error_code, auto) {};
+    pool(io, handler);
+    pool(io, handler);
+    pool(io, handler);
+    io.poll();
+    EXPECT_EQ(pending.size(), 2u);
+    EXPECT_EQ(pool.metrics().capacity_limit, 2u);
+}
+
+TEST(connection_pool_warm_up, without_min_idle_should_post_handler_without_error) {
+    ozo::io_context io;
+    auto pool = ozo::make_connection_pool(connection_source {}, ozo::connection_pool_config {});
+    bool called = false;
+    pool.warm_up(io, [&] (ozo::error_code ec) {
+        EXPECT_FALSE(ec);
+        called = true;
+    });
+    EXPECT_FALSE(called);
+    io.run();
+    EXPECT_TRUE(called);
+}
+
 struct pooled_connection_wrapper : Test {
     using pooled_connection_ptr = ozo::impl::pooled_connection_ptr<connection_provider>;
     StrictMock<connection_provider_mock> provider_mock;
@@ -181,6 +633,7 @@ TEST_F(pooled_connection_wrapper, should_invoke_handler_if_passed_connection_is_
 
     EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
     EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillRepeatedly(Return(false));
     EXPECT_CALL(connection_mock, rebind_io_context()).WillRepeatedly(Return(ozo::error_code{}));
 
     EXPECT_CALL(callback_mock, call(_, _)).WillOnce(Return());
@@ -188,6 +641,141 @@ TEST_F(pooled_connection_wrapper, should_invoke_handler_if_passed_connection_is_
     h({}, connection_pool::handle{&handle_mock});
 }
 
+TEST_F(pooled_connection_wrapper, should_invoke_handler_if_passed_connection_is_good_and_has_consumable_input) {
+    auto conn = make_connection(native_handle::good);
+
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock)
+        );
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillOnce(Return(true));
+    EXPECT_CALL(connection_mock, consume_input()).WillOnce(Return(1));
+    EXPECT_CALL(connection_mock, rebind_io_context()).WillRepeatedly(Return(ozo::error_code{}));
+
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+}
+
+TEST_F(pooled_connection_wrapper, should_not_check_liveness_of_connection_idle_for_less_than_unchecked_idle_time) {
+    auto conn = make_connection(native_handle::good);
+    conn->idle_since_ = ozo::time_traits::time_point::clock::now();
+
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            nullptr,
+            nullptr,
+            ozo::impl::recycling_allocator<void> {},
+            {},
+            std::chrono::minutes(1)
+        );
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).Times(0);
+    EXPECT_CALL(connection_mock, rebind_io_context()).WillRepeatedly(Return(ozo::error_code{}));
+
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+}
+
+TEST_F(pooled_connection_wrapper, should_check_liveness_of_connection_idle_for_unchecked_idle_time) {
+    auto conn = make_connection(native_handle::good);
+    conn->idle_since_ = ozo::time_traits::time_point::clock::now() - std::chrono::minutes(2);
+
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            nullptr,
+            nullptr,
+            ozo::impl::recycling_allocator<void> {},
+            {},
+            std::chrono::minutes(1)
+        );
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillOnce(Return(false));
+    EXPECT_CALL(connection_mock, rebind_io_context()).WillRepeatedly(Return(ozo::error_code{}));
+
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+}
+
+TEST_F(pooled_connection_wrapper, should_call_async_get_connection_and_invoke_handler_if_passed_connection_is_closed_by_server) {
+    auto closed_conn = make_connection(native_handle::good);
+
+    auto good_conn = make_connection();
+    good_conn->handle_ = std::make_unique<native_handle>(native_handle::good);
+
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock)
+        );
+
+    auto conn = std::move(closed_conn);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillOnce(Return(true));
+    EXPECT_CALL(connection_mock, consume_input()).WillOnce(Return(0));
+
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error_code{}, good_conn));
+
+    EXPECT_CALL(handle_mock, reset(_))
+        .WillOnce(Invoke([&](auto c){
+            conn = std::move(c);
+        }));
+
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+}
+
+TEST_F(pooled_connection_wrapper, should_call_async_get_connection_and_invoke_handler_if_passed_connection_is_expired) {
+    auto expired_conn = make_connection(native_handle::good);
+    expired_conn->expires_at_ = ozo::time_traits::time_point::clock::now() - std::chrono::seconds(1);
+
+    auto good_conn = make_connection();
+    good_conn->handle_ = std::make_unique<native_handle>(native_handle::good);
+
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock)
+        );
+
+    auto conn = std::move(expired_conn);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error_code{}, good_conn));
+
+    EXPECT_CALL(handle_mock, reset(_))
+        .WillOnce(Invoke([&](auto c){
+            conn = std::move(c);
+        }));
+
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+}
+
 TEST_F(pooled_connection_wrapper, should_call_async_get_connection_and_invoke_handler_if_passed_connection_is_bad_and_handle_is_not_empty) {
     auto bad_conn = make_connection(native_handle::bad);
 
@@ -238,6 +826,29 @@ TEST_F(pooled_connection_wrapper, should_call_async_get_connection_and_invoke_ha
     h({}, connection_pool::handle{&handle_mock});
 }
 
+TEST_F(pooled_connection_wrapper, should_set_new_connection_expiry_by_lifespan) {
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {std::chrono::minutes(10), {}, {}}
+        );
+
+    auto conn = make_connection();
+    const auto before = ozo::time_traits::time_point::clock::now();
+
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error_code{}, conn));
+    EXPECT_CALL(handle_mock, reset(_)).WillOnce(Return());
+    EXPECT_CALL(callback_mock, call(_, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    EXPECT_GE(conn->expires_at_, before + std::chrono::minutes(10));
+    EXPECT_LE(conn->expires_at_, ozo::time_traits::time_point::clock::now() + std::chrono::minutes(10));
+}
+
 TEST_F(pooled_connection_wrapper, should_invoke_callback_with_error_if_async_get_connection_fails) {
     auto h = ozo::impl::wrap_pooled_connection_handler(
             io,
@@ -257,4 +868,254 @@ TEST_F(pooled_connection_wrapper, should_invoke_callback_with_error_if_async_get
     h({}, connection_pool::handle{&handle_mock});
 }
 
+TEST_F(pooled_connection_wrapper, should_count_queue_overflow_in_metrics) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    const error_code overflow = yamail::resource_pool::error::request_queue_overflow;
+    EXPECT_CALL(callback_mock, call(overflow, _)).WillOnce(Return());
+
+    h(overflow, connection_pool::handle{});
+
+    const auto snapshot = metrics->snapshot();
+    EXPECT_EQ(snapshot.queue_overflows, 1u);
+    EXPECT_EQ(snapshot.queue_timeouts, 0u);
+    EXPECT_EQ(snapshot.wait_time.count, 1u);
+    EXPECT_EQ(snapshot.acquisitions, 0u);
+}
+
+TEST_F(pooled_connection_wrapper, should_count_acquisition_connect_and_hold_time_in_metrics) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    auto conn = make_connection();
+    pooled_connection_ptr provided;
+
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error_code{}, conn));
+    EXPECT_CALL(handle_mock, reset(_)).WillOnce(Return());
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(SaveArg<1>(&provided));
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    auto snapshot = metrics->snapshot();
+    EXPECT_EQ(snapshot.acquisitions, 1u);
+    EXPECT_EQ(snapshot.connect_time.count, 1u);
+    EXPECT_EQ(snapshot.hold_time.count, 0u);
+
+    provided.reset();
+
+    snapshot = metrics->snapshot();
+    EXPECT_EQ(snapshot.hold_time.count, 1u);
+}
+
+TEST_F(pooled_connection_wrapper, should_not_rebind_connection_bound_to_requesting_io_context) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    auto conn = make_connection(native_handle::good);
+    conn->socket_.io_ = std::addressof(io);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillRepeatedly(Return(false));
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    EXPECT_EQ(metrics->snapshot().rebinds, 0u);
+}
+
+TEST_F(pooled_connection_wrapper, should_rebind_connection_bound_to_other_io_context_and_count_it_in_metrics) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    io_context other;
+    auto conn = make_connection(native_handle::good);
+    conn->socket_.io_ = std::addressof(other);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, rebind_io_context()).WillOnce(Return(error_code{}));
+    EXPECT_CALL(callback_mock, call(error_code{}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    EXPECT_EQ(metrics->snapshot().rebinds, 1u);
+}
+
+TEST_F(pooled_connection_wrapper, should_not_count_failed_rebind_in_metrics) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    io_context other;
+    auto conn = make_connection(native_handle::good);
+    conn->socket_.io_ = std::addressof(other);
+
+    EXPECT_CALL(handle_mock, value()).WillRepeatedly(ReturnRef(conn));
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, input_pending()).WillRepeatedly(Return(false));
+    EXPECT_CALL(connection_mock, rebind_io_context()).WillOnce(Return(error_code{error::error}));
+    EXPECT_CALL(callback_mock, call(error_code{error::error}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    EXPECT_EQ(metrics->snapshot().rebinds, 0u);
+}
+
+TEST_F(pooled_connection_wrapper, should_count_connect_error_in_metrics) {
+    auto metrics = std::make_shared<ozo::impl::pool_metrics>();
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            metrics
+        );
+
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error::error, make_connection()));
+    EXPECT_CALL(callback_mock, call(error_code{error::error}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    const auto snapshot = metrics->snapshot();
+    EXPECT_EQ(snapshot.connect_errors, 1u);
+    EXPECT_EQ(snapshot.acquisitions, 0u);
+    EXPECT_EQ(snapshot.connect_time.count, 0u);
+}
+
+TEST_F(pooled_connection_wrapper, should_count_connect_error_as_circuit_breaker_failure) {
+    auto breaker = std::make_shared<ozo::impl::circuit_breaker>(1, std::chrono::seconds(5));
+    auto h = ozo::impl::wrap_pooled_connection_handler(
+            io,
+            connection_provider{&provider_mock},
+            wrap(callback_mock),
+            ozo::impl::connection_lifespan {},
+            nullptr,
+            breaker
+        );
+
+    EXPECT_CALL(handle_mock, empty()).WillRepeatedly(Return(true));
+    EXPECT_CALL(provider_mock, async_get_connection(_))
+        .WillOnce(InvokeArgument<0>(error::error, make_connection()));
+    EXPECT_CALL(callback_mock, call(error_code{error::error}, _)).WillOnce(Return());
+
+    h({}, connection_pool::handle{&handle_mock});
+
+    EXPECT_EQ(breaker->state(), ozo::circuit_state::open);
+}
+
+struct circuit_breaker : Test {
+    using time_point = ozo::time_traits::time_point;
+    const time_point now = time_point::clock::now();
+    ozo::impl::circuit_breaker breaker {3, std::chrono::seconds(5)};
+
+    void fail(std::size_t count) {
+        for (std::size_t i = 0; i != count; ++i) {
+            breaker.failure(now);
+        }
+    }
+};
+
+TEST_F(circuit_breaker, should_be_closed_by_default) {
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::closed);
+    EXPECT_TRUE(breaker.allow(now));
+}
+
+TEST_F(circuit_breaker, should_stay_closed_while_failures_are_less_than_threshold) {
+    fail(2);
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::closed);
+    EXPECT_TRUE(breaker.allow(now));
+}
+
+TEST_F(circuit_breaker, should_reset_failures_on_success) {
+    fail(2);
+    breaker.success();
+    fail(2);
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::closed);
+}
+
+TEST_F(circuit_breaker, should_open_and_reject_requests_after_consecutive_failures) {
+    fail(3);
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::open);
+    EXPECT_FALSE(breaker.allow(now + std::chrono::seconds(1)));
+    EXPECT_EQ(breaker.trips(), 1u);
+    EXPECT_EQ(breaker.rejections(), 1u);
+}
+
+TEST_F(circuit_breaker, should_let_single_probe_through_after_open_timeout) {
+    fail(3);
+    EXPECT_TRUE(breaker.allow(now + std::chrono::seconds(5)));
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::half_open);
+    EXPECT_FALSE(breaker.allow(now + std::chrono::seconds(6)));
+}
+
+TEST_F(circuit_breaker, should_close_on_probe_success) {
+    fail(3);
+    breaker.allow(now + std::chrono::seconds(5));
+    breaker.success();
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::closed);
+    EXPECT_TRUE(breaker.allow(now + std::chrono::seconds(6)));
+}
+
+TEST_F(circuit_breaker, should_open_again_on_probe_failure) {
+    fail(3);
+    breaker.allow(now + std::chrono::seconds(5));
+    breaker.failure(now + std::chrono::seconds(6));
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::open);
+    EXPECT_FALSE(breaker.allow(now + std::chrono::seconds(10)));
+    EXPECT_TRUE(breaker.allow(now + std::chrono::seconds(11)));
+    EXPECT_EQ(breaker.trips(), 2u);
+}
+
+TEST_F(circuit_breaker, should_let_another_probe_through_if_previous_one_reported_nothing) {
+    fail(3);
+    breaker.allow(now + std::chrono::seconds(5));
+    EXPECT_TRUE(breaker.allow(now + std::chrono::seconds(10)));
+}
+
+TEST(circuit_breaker_disabled, should_never_open) {
+    ozo::impl::circuit_breaker breaker {0, std::chrono::seconds(5)};
+    for (int i = 0; i != 100; ++i) {
+        breaker.failure();
+    }
+    EXPECT_FALSE(breaker.enabled());
+    EXPECT_EQ(breaker.state(), ozo::circuit_state::closed);
+    EXPECT_TRUE(breaker.allow());
+}
+
 } // namespace
@@ -0,0 +1,93 @@
+#include <ozo/impl/async_resolve.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+namespace {
+
+using namespace testing;
+
+using ozo::error_code;
+using ozo::time_traits;
+
+std::string get_resolvable_host(std::string conninfo) {
+    return ozo::impl::get_resolvable_host(ozo::impl::parsed_conninfo {std::move(conninfo)});
+}
+
+TEST(get_resolvable_host, should_return_host_name) {
+    EXPECT_EQ(get_resolvable_host("host=db.example.com port=5432"), "db.example.com");
+}
+
+TEST(get_resolvable_host, should_return_host_name_from_uri) {
+    EXPECT_EQ(get_resolvable_host("postgresql://user@db.example.com:5432/db"), "db.example.com");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_for_numeric_address) {
+    EXPECT_EQ(get_resolvable_host("host=127.0.0.1"), "");
+    EXPECT_EQ(get_resolvable_host("host=::1"), "");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_for_unix_domain_socket) {
+    EXPECT_EQ(get_resolvable_host("host=/var/run/postgresql"), "");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_for_multiple_hosts) {
+    EXPECT_EQ(get_resolvable_host("host=db1.example.com,db2.example.com"), "");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_if_hostaddr_is_specified) {
+    EXPECT_EQ(get_resolvable_host("host=db.example.com hostaddr=10.0.0.1"), "");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_if_hostaddr_is_overridden) {
+    ozo::impl::parsed_conninfo conninfo {"host=db.example.com"};
+    conninfo.set("hostaddr", "10.0.0.1");
+    EXPECT_EQ(ozo::impl::get_resolvable_host(conninfo), "");
+}
+
+TEST(get_resolvable_host, should_return_empty_string_for_invalid_connection_string) {
+    EXPECT_EQ(get_resolvable_host("invalid connection info"), "");
+}
+
+TEST(add_hostaddr, should_override_hostaddr_parameter) {
+    const auto conninfo = ozo::impl::add_hostaddr(ozo::impl::parsed_conninfo {"host=db.example.com"}, {"10.0.0.1"});
+    EXPECT_EQ(conninfo.get("host"), "db.example.com");
+    EXPECT_EQ(conninfo.get("hostaddr"), "10.0.0.1");
+}
+
+TEST(add_hostaddr, should_pass_all_addresses_with_host_repeated_for_each_of_them) {
+    const auto conninfo = ozo::impl::add_hostaddr(ozo::impl::parsed_conninfo {"host=db.example.com"},
+        {"10.0.0.1", "10.0.0.2", "::1"});
+    EXPECT_EQ(conninfo.get("host"), "db.example.com,db.example.com,db.example.com");
+    EXPECT_EQ(conninfo.get("hostaddr"), "10.0.0.1,10.0.0.2,::1");
+}
+
+TEST(async_resolve_conninfo, should_invoke_handler_immediately_with_same_connection_parameters_if_there_is_nothing_to_resolve) {
+    ozo::io_context io;
+    bool called = false;
+    ozo::impl::async_resolve_conninfo(io, ozo::impl::parsed_conninfo {"host=127.0.0.1"}, std::chrono::seconds(1),
+        [&] (error_code ec, ozo::impl::parsed_conninfo conninfo, time_traits::duration timeout) {
+            EXPECT_FALSE(ec);
+            EXPECT_EQ(conninfo.get("host"), "127.0.0.1");
+            EXPECT_TRUE(conninfo.get("hostaddr").empty());
+            EXPECT_EQ(timeout, time_traits::duration(std::chrono::seconds(1)));
+            called = true;
+        });
+    EXPECT_TRUE(called);
+}
+
+TEST(async_resolve_conninfo, should_invoke_handler_with_hostaddr_of_resolved_host) {
+    ozo::io_context io;
+    bool called = false;
+    ozo::impl::async_resolve_conninfo(io, ozo::impl::parsed_conninfo {"host=localhost"}, std::chrono::seconds(10),
+        [&] (error_code ec, ozo::impl::parsed_conninfo conninfo, time_traits::duration) {
+            EXPECT_FALSE(ec);
+            EXPECT_EQ(conninfo.get("host"), "localhost");
+            EXPECT_FALSE(conninfo.get("hostaddr").empty());
+            called = true;
+        });
+    io.run();
+    EXPECT_TRUE(called);
+}
+
+} // namespace
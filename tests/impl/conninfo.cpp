@@ -0,0 +1,87 @@
+#include <ozo/impl/conninfo.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+namespace {
+
+using namespace testing;
+
+using ozo::impl::parsed_conninfo;
+
+std::vector<std::pair<std::string, std::string>> params(const parsed_conninfo& conninfo) {
+    return conninfo.apply([] (const char* const* keywords, const char* const* values) {
+        std::vector<std::pair<std::string, std::string>> result;
+        for (; *keywords; ++keywords, ++values) {
+            result.emplace_back(*keywords, *values);
+        }
+        return result;
+    });
+}
+
+TEST(parsed_conninfo, should_parse_connection_string) {
+    const parsed_conninfo conninfo("host=localhost port=5432 dbname=db");
+    EXPECT_TRUE(conninfo.valid());
+    EXPECT_EQ(conninfo.get("host"), "localhost");
+    EXPECT_EQ(conninfo.get("port"), "5432");
+    EXPECT_EQ(conninfo.get("dbname"), "db");
+    EXPECT_EQ(conninfo.get("user"), "");
+}
+
+TEST(parsed_conninfo, should_parse_uri) {
+    const parsed_conninfo conninfo("postgresql://user@db.example.com:5433/db?application_name=app");
+    EXPECT_TRUE(conninfo.valid());
+    EXPECT_EQ(conninfo.get("host"), "db.example.com");
+    EXPECT_EQ(conninfo.get("port"), "5433");
+    EXPECT_EQ(conninfo.get("user"), "user");
+    EXPECT_EQ(conninfo.get("application_name"), "app");
+}
+
+TEST(parsed_conninfo, should_keep_error_and_string_for_invalid_connection_string) {
+    const parsed_conninfo conninfo("invalid connection info");
+    EXPECT_FALSE(conninfo.valid());
+    EXPECT_FALSE(conninfo.error().empty());
+    EXPECT_EQ(conninfo.str(), "invalid connection info");
+}
+
+TEST(parsed_conninfo, should_pass_only_specified_parameters) {
+    const parsed_conninfo conninfo("host=localhost port=5432");
+    EXPECT_THAT(params(conninfo), UnorderedElementsAre(Pair("host", "localhost"), Pair("port", "5432")));
+}
+
+TEST(parsed_conninfo, should_override_specified_parameter) {
+    parsed_conninfo conninfo("host=localhost port=5432");
+    conninfo.set("port", "6432");
+    EXPECT_EQ(conninfo.get("port"), "6432");
+    EXPECT_THAT(params(conninfo), UnorderedElementsAre(Pair("host", "localhost"), Pair("port", "6432")));
+}
+
+TEST(parsed_conninfo, should_add_overridden_parameter_which_is_not_specified) {
+    parsed_conninfo conninfo("host=localhost");
+    conninfo.set("application_name", "app").set("application_name", "other");
+    EXPECT_THAT(params(conninfo), UnorderedElementsAre(Pair("host", "localhost"), Pair("application_name", "other")));
+}
+
+TEST(parsed_conninfo, should_not_affect_copy_by_override) {
+    const parsed_conninfo conninfo("host=localhost");
+    auto copy = conninfo;
+    copy.set("host", "db.example.com");
+    EXPECT_EQ(conninfo.get("host"), "localhost");
+    EXPECT_EQ(copy.get("host"), "db.example.com");
+}
+
+TEST(append_conninfo_param, should_append_quoted_parameter) {
+    std::string conninfo = "host=localhost";
+    ozo::impl::append_conninfo_param(conninfo, "application_name", "app");
+    EXPECT_EQ(conninfo, "host=localhost application_name='app'");
+}
+
+TEST(append_conninfo_param, should_escape_quotes_and_backslashes_of_value) {
+    std::string conninfo = "host=localhost";
+    ozo::impl::append_conninfo_param(conninfo, "application_name", "x' host='other\\");
+    EXPECT_EQ(conninfo, "host=localhost application_name='x\\' host=\\'other\\\\'");
+    EXPECT_EQ(parsed_conninfo {conninfo}.get("application_name"), "x' host='other\\");
+    EXPECT_EQ(parsed_conninfo {conninfo}.get("host"), "localhost");
+}
+
+} // namespace
@@ -0,0 +1,242 @@
+#include <test_error.h>
+
+#include <ozo/impl/hedged_request.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <optional>
+#include <thread>
+
+namespace {
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+using ozo::error_code;
+using ozo::time_traits;
+using ozo::impl::hedge_delay_estimator;
+
+TEST(hedge_delay_estimator, should_return_initial_delay_without_samples) {
+    const hedge_delay_estimator estimator(0.95, 10ms, 1ms, 32);
+    EXPECT_EQ(estimator.delay(), time_traits::duration(10ms));
+}
+
+TEST(hedge_delay_estimator, should_return_percentile_of_samples) {
+    hedge_delay_estimator estimator(0.75, 10ms, 0ms, 64);
+    for (int i = 1; i <= 64; ++i) {
+        estimator.add(std::chrono::milliseconds(i));
+    }
+    EXPECT_EQ(estimator.delay(), time_traits::duration(48ms));
+}
+
+TEST(hedge_delay_estimator, should_forget_samples_out_of_window) {
+    hedge_delay_estimator estimator(0.5, 10ms, 0ms, 16);
+    for (int i = 0; i < 16; ++i) {
+        estimator.add(100ms);
+    }
+    for (int i = 0; i < 16; ++i) {
+        estimator.add(2ms);
+    }
+    EXPECT_EQ(estimator.delay(), time_traits::duration(2ms));
+}
+
+TEST(hedge_delay_estimator, should_not_return_delay_less_than_min_delay) {
+    hedge_delay_estimator estimator(0.5, 10ms, 5ms, 16);
+    for (int i = 0; i < 16; ++i) {
+        estimator.add(1ms);
+    }
+    EXPECT_EQ(estimator.delay(), time_traits::duration(5ms));
+}
+
+TEST(query_cancel_queue, push_should_drop_request_if_queue_is_full) {
+    ozo::impl::query_cancel_queue queue(0);
+    EXPECT_FALSE(queue.push(ozo::impl::native_cancel_handle {}));
+}
+
+TEST(query_cancel_queue, should_join_worker_on_destruction) {
+    auto queue = std::make_unique<ozo::impl::query_cancel_queue>(4);
+    EXPECT_TRUE(queue->push(ozo::impl::native_cancel_handle {}));
+    queue.reset();
+}
+
+struct connection {
+    int id = 0;
+};
+
+struct hedged_request : Test {
+    ozo::io_context io;
+    std::function<void()> make_canceller(int id) {
+        return [this, id] { cancelled.push_back(id); };
+    }
+
+    std::vector<int> cancelled;
+    std::vector<int> committed;
+    std::vector<int> discarded;
+    std::vector<std::size_t> attempts;
+    std::vector<std::size_t> sent;
+    bool defer_connect = false;
+    std::vector<std::function<void()>> connect;
+    std::vector<std::function<void(error_code)>> complete;
+
+    struct attempt {
+        hedged_request* self;
+
+        template <typename Op>
+        void operator ()(std::size_t index, Op op) const {
+            self->attempts.push_back(index);
+            self->connect.push_back([this_ = self, op, index] () mutable {
+                if (op.on_start(index, this_->make_canceller(int(index)))) {
+                    this_->sent.push_back(index);
+                }
+            });
+            self->complete.push_back([this_ = self, op, index] (error_code ec) mutable {
+                op.on_complete(index, ec, connection {int(index)}, [this_] (connection& conn) {
+                    this_->committed.push_back(conn.id);
+                    return error_code {};
+                }, [this_] (connection& conn) {
+                    this_->discarded.push_back(conn.id);
+                });
+            });
+            if (!self->defer_connect) {
+                self->connect.back()();
+            }
+        }
+    };
+
+    std::optional<error_code> result_ec;
+    std::optional<int> result_conn;
+
+    void start(time_traits::duration delay) {
+        auto estimator = std::make_shared<hedge_delay_estimator>(0.95, delay, 0ms, 16);
+        ozo::impl::async_hedged(io, estimator, attempt {this}, [this] (error_code ec, connection conn) {
+            result_ec = ec;
+            result_conn = conn.id;
+        });
+    }
+
+    void run_hedge_timer() {
+        io.run_for(50ms);
+        io.restart();
+    }
+};
+
+TEST_F(hedged_request, should_not_hedge_request_completed_before_delay) {
+    start(1s);
+    ASSERT_THAT(attempts, ElementsAre(0u));
+    complete[0](error_code {});
+    io.run();
+
+    EXPECT_EQ(result_ec, error_code {});
+    EXPECT_EQ(result_conn, 0);
+    EXPECT_THAT(attempts, ElementsAre(0u));
+    EXPECT_THAT(committed, ElementsAre(0));
+    EXPECT_TRUE(cancelled.empty());
+}
+
+TEST_F(hedged_request, should_send_hedge_after_delay) {
+    start(1ms);
+    run_hedge_timer();
+    EXPECT_THAT(attempts, ElementsAre(0u, 1u));
+    EXPECT_FALSE(result_ec);
+}
+
+TEST_F(hedged_request, should_complete_with_first_successful_attempt_and_cancel_other) {
+    start(1ms);
+    run_hedge_timer();
+    complete[1](error_code {});
+
+    EXPECT_EQ(result_ec, error_code {});
+    EXPECT_EQ(result_conn, 1);
+    EXPECT_THAT(committed, ElementsAre(1));
+    EXPECT_THAT(cancelled, ElementsAre(0));
+
+    result_ec.reset();
+    complete[0](ozo::tests::error::error);
+    EXPECT_FALSE(result_ec);
+    EXPECT_THAT(committed, ElementsAre(1));
+    EXPECT_THAT(discarded, ElementsAre(0));
+}
+
+TEST_F(hedged_request, should_discard_connection_of_cancelled_attempt_completed_before_cancel_reached_server) {
+    start(1ms);
+    run_hedge_timer();
+    complete[1](error_code {});
+    ASSERT_THAT(cancelled, ElementsAre(0));
+
+    complete[0](error_code {});
+
+    EXPECT_EQ(result_conn, 1);
+    EXPECT_THAT(committed, ElementsAre(1));
+    EXPECT_THAT(discarded, ElementsAre(0));
+}
+
+TEST_F(hedged_request, should_not_discard_connection_of_winner) {
+    start(1s);
+    complete[0](error_code {});
+    io.run();
+
+    EXPECT_EQ(result_conn, 0);
+    EXPECT_TRUE(discarded.empty());
+}
+
+TEST_F(hedged_request, should_not_send_query_of_attempt_connected_after_other_won) {
+    defer_connect = true;
+    start(1ms);
+    connect[0]();
+    run_hedge_timer();
+    ASSERT_THAT(attempts, ElementsAre(0u, 1u));
+    complete[0](error_code {});
+
+    connect[1]();
+
+    EXPECT_EQ(result_conn, 0);
+    EXPECT_THAT(sent, ElementsAre(0u));
+    EXPECT_TRUE(cancelled.empty());
+    EXPECT_TRUE(discarded.empty());
+}
+
+TEST_F(hedged_request, should_wait_for_other_attempt_when_first_one_failed) {
+    start(1ms);
+    run_hedge_timer();
+    complete[0](ozo::tests::error::error);
+    EXPECT_FALSE(result_ec);
+
+    complete[1](error_code {});
+    EXPECT_EQ(result_ec, error_code {});
+    EXPECT_EQ(result_conn, 1);
+    EXPECT_TRUE(cancelled.empty());
+    EXPECT_TRUE(discarded.empty());
+}
+
+TEST_F(hedged_request, should_complete_with_last_error_when_both_attempts_failed) {
+    start(1ms);
+    run_hedge_timer();
+    complete[1](ozo::tests::error::error);
+    complete[0](boost::asio::error::timed_out);
+
+    EXPECT_EQ(result_ec, error_code {boost::asio::error::timed_out});
+    EXPECT_EQ(result_conn, 0);
+    EXPECT_TRUE(committed.empty());
+}
+
+TEST_F(hedged_request, should_complete_with_error_and_not_hedge_when_attempt_failed_before_delay) {
+    start(1s);
+    complete[0](ozo::tests::error::error);
+    io.run();
+
+    EXPECT_EQ(result_ec, error_code {ozo::tests::error::error});
+    EXPECT_THAT(attempts, ElementsAre(0u));
+}
+
+TEST_F(hedged_request, should_add_latency_of_winner_to_estimator) {
+    auto estimator = std::make_shared<hedge_delay_estimator>(0.5, 1s, 0ms, 1);
+    ozo::impl::async_hedged(io, estimator, attempt {this}, [] (error_code, connection) {});
+    std::this_thread::sleep_for(5ms);
+    complete[0](error_code {});
+
+    EXPECT_GE(estimator->delay(), time_traits::duration(5ms));
+    EXPECT_LT(estimator->delay(), time_traits::duration(1s));
+}
+
+} // namespace
@@ -0,0 +1,362 @@
+#include <ozo/impl/pool_queue.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace testing;
+
+using ozo::error_code;
+using ozo::impl::pool_slot;
+
+struct pool_queue : Test {
+    ozo::io_context io;
+    std::shared_ptr<ozo::impl::pool_queue> queue;
+    std::vector<pool_slot> slots;
+    std::vector<int> served;
+
+    void make_queue(std::size_t capacity, std::size_t queue_capacity) {
+        queue = std::make_shared<ozo::impl::pool_queue>(capacity, queue_capacity);
+    }
+
+    void enter(int id, std::size_t priority = 1, ozo::time_traits::duration timeout = std::chrono::seconds(10)) {
+        queue->enter(queue, io, priority, timeout, [this, id] (error_code ec, pool_slot slot) {
+            EXPECT_FALSE(ec);
+            served.push_back(id);
+            slots.push_back(std::move(slot));
+        });
+    }
+};
+
+TEST_F(pool_queue, enter_should_invoke_handler_immediately_if_there_is_free_slot) {
+    make_queue(2, 2);
+    enter(1);
+    enter(2);
+    EXPECT_THAT(served, ElementsAre(1, 2));
+    EXPECT_EQ(queue->in_flight(), 2u);
+    EXPECT_EQ(queue->waiting(), 0u);
+}
+
+TEST_F(pool_queue, enter_should_put_request_into_queue_if_there_is_no_free_slot) {
+    make_queue(1, 2);
+    enter(1);
+    enter(2);
+    EXPECT_THAT(served, ElementsAre(1));
+    EXPECT_EQ(queue->waiting(), 1u);
+}
+
+TEST_F(pool_queue, released_slot_should_be_passed_to_waiting_request_with_highest_priority) {
+    make_queue(1, 3);
+    enter(1);
+    enter(2, 0);
+    enter(3, 1);
+    enter(4, 2);
+
+    slots.clear();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1, 4));
+
+    slots.clear();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1, 4, 3));
+
+    slots.clear();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1, 4, 3, 2));
+    EXPECT_EQ(queue->in_flight(), 1u);
+
+    slots.clear();
+    EXPECT_EQ(queue->in_flight(), 0u);
+    EXPECT_EQ(queue->waiting(), 0u);
+}
+
+TEST_F(pool_queue, requests_with_same_priority_should_be_served_in_fifo_order) {
+    make_queue(1, 3);
+    enter(1);
+    enter(2);
+    enter(3);
+
+    slots.clear();
+    io.poll();
+    slots.clear();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1, 2, 3));
+}
+
+TEST_F(pool_queue, slot_should_be_released_when_last_copy_is_destroyed) {
+    make_queue(1, 1);
+    enter(1);
+    auto copy = slots.front();
+    slots.clear();
+    EXPECT_EQ(queue->in_flight(), 1u);
+    copy.release();
+    EXPECT_EQ(queue->in_flight(), 0u);
+}
+
+TEST_F(pool_queue, enter_should_invoke_handler_with_request_queue_overflow_if_queue_is_full) {
+    make_queue(1, 1);
+    enter(1);
+    enter(2);
+    error_code result;
+    queue->enter(queue, io, 1, std::chrono::seconds(10), [&] (error_code ec, pool_slot slot) {
+        result = ec;
+        EXPECT_TRUE(slot.empty());
+    });
+    EXPECT_FALSE(result);
+    io.poll();
+    EXPECT_EQ(result, error_code(yamail::resource_pool::error::request_queue_overflow));
+}
+
+TEST_F(pool_queue, waiting_request_should_be_invoked_with_get_resource_timeout_on_timeout) {
+    make_queue(1, 1);
+    enter(1);
+    error_code result;
+    queue->enter(queue, io, 1, std::chrono::milliseconds(1), [&] (error_code ec, pool_slot slot) {
+        result = ec;
+        EXPECT_TRUE(slot.empty());
+    });
+    io.run();
+    EXPECT_EQ(result, error_code(yamail::resource_pool::error::get_resource_timeout));
+    EXPECT_EQ(queue->waiting(), 0u);
+
+    slots.clear();
+    EXPECT_EQ(queue->in_flight(), 0u);
+}
+
+TEST_F(pool_queue, slot_should_keep_queue_alive_until_released) {
+    make_queue(1, 1);
+    enter(1);
+    const std::weak_ptr<ozo::impl::pool_queue> weak = queue;
+    queue.reset();
+    EXPECT_FALSE(weak.expired());
+    slots.clear();
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST_F(pool_queue, released_slots_should_be_reused) {
+    make_queue(2, 1);
+    for (int i = 0; i != 3; ++i) {
+        enter(2 * i);
+        enter(2 * i + 1);
+        EXPECT_EQ(queue->in_flight(), 2u);
+        slots.clear();
+        EXPECT_EQ(queue->in_flight(), 0u);
+    }
+    EXPECT_THAT(served, ElementsAre(0, 1, 2, 3, 4, 5));
+}
+
+TEST_F(pool_queue, try_enter_should_return_free_slot) {
+    make_queue(1, 1);
+    auto slot = queue->try_enter(queue);
+    EXPECT_FALSE(slot.empty());
+    EXPECT_EQ(queue->in_flight(), 1u);
+    slot.release();
+    EXPECT_EQ(queue->in_flight(), 0u);
+}
+
+TEST_F(pool_queue, try_enter_should_return_empty_slot_if_there_is_no_free_slot) {
+    make_queue(1, 1);
+    enter(1);
+    EXPECT_TRUE(queue->try_enter(queue).empty());
+    EXPECT_EQ(queue->in_flight(), 1u);
+}
+
+TEST_F(pool_queue, slot_of_try_enter_should_pass_to_waiting_request_on_release) {
+    make_queue(1, 1);
+    auto slot = queue->try_enter(queue);
+    enter(1);
+    EXPECT_TRUE(served.empty());
+    slot.release();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1));
+}
+
+TEST_F(pool_queue, timed_out_request_should_not_be_held_by_queue) {
+    make_queue(1, 1);
+    enter(1);
+    const auto state = std::make_shared<int>(0);
+    queue->enter(queue, io, 1, std::chrono::milliseconds(1), [state] (error_code, pool_slot) {});
+    io.run();
+    EXPECT_EQ(state.use_count(), 1);
+
+    io.restart();
+    enter(2);
+    slots.clear();
+    io.poll();
+    EXPECT_THAT(served, ElementsAre(1, 2));
+}
+
+struct adaptive_capacity : Test {
+    const ozo::time_traits::duration fast = std::chrono::milliseconds(1);
+    const ozo::time_traits::duration slow = std::chrono::milliseconds(10);
+
+    static void update_window(ozo::impl::adaptive_capacity& capacity, ozo::time_traits::duration latency, bool queued) {
+        for (auto n = capacity.limit(); n != 0; --n) {
+            capacity.update(latency, queued);
+        }
+    }
+};
+
+TEST_F(adaptive_capacity, should_be_disabled_if_min_is_not_less_than_max) {
+    ozo::impl::adaptive_capacity capacity(10, 10, 2.0);
+    EXPECT_FALSE(capacity.enabled());
+    update_window(capacity, fast, false);
+    update_window(capacity, slow, false);
+    EXPECT_EQ(capacity.limit(), 10u);
+}
+
+TEST_F(adaptive_capacity, should_start_from_max) {
+    ozo::impl::adaptive_capacity capacity(2, 10, 2.0);
+    EXPECT_TRUE(capacity.enabled());
+    EXPECT_EQ(capacity.limit(), 10u);
+}
+
+TEST_F(adaptive_capacity, should_decrease_multiplicatively_if_latency_exceeds_baseline_by_tolerance) {
+    ozo::impl::adaptive_capacity capacity(2, 20, 2.0);
+    update_window(capacity, fast, false);
+    EXPECT_EQ(capacity.limit(), 20u);
+    update_window(capacity, slow, false);
+    EXPECT_EQ(capacity.limit(), 18u);
+}
+
+TEST_F(adaptive_capacity, should_decrease_at_least_by_one_and_not_below_min) {
+    ozo::impl::adaptive_capacity capacity(2, 3, 2.0);
+    update_window(capacity, fast, false);
+    update_window(capacity, slow, false);
+    EXPECT_EQ(capacity.limit(), 2u);
+    update_window(capacity, slow * 10, false);
+    EXPECT_EQ(capacity.limit(), 2u);
+}
+
+TEST_F(adaptive_capacity, should_increase_by_one_if_requests_are_queued_and_latency_is_fine) {
+    ozo::impl::adaptive_capacity capacity(2, 20, 2.0);
+    update_window(capacity, fast, false);
+    update_window(capacity, slow, false);
+    EXPECT_EQ(capacity.limit(), 18u);
+    update_window(capacity, fast, true);
+    EXPECT_EQ(capacity.limit(), 19u);
+    update_window(capacity, fast, false);
+    EXPECT_EQ(capacity.limit(), 19u);
+}
+
+TEST_F(pool_queue, enter_should_put_request_into_queue_if_effective_capacity_is_decreased) {
+    queue = std::make_shared<ozo::impl::pool_queue>(3, 10, 1, 2.0);
+    enter(1);
+    enter(2);
+    enter(3);
+    slots.erase(slots.begin());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    slots.clear();
+    EXPECT_EQ(queue->limit(), 2u);
+
+    enter(4);
+    enter(5);
+    enter(6);
+    EXPECT_THAT(served, ElementsAre(1, 2, 3, 4, 5));
+    EXPECT_EQ(queue->waiting(), 1u);
+}
+
+struct queue_delay_controller : Test {
+    using time_point = ozo::time_traits::time_point;
+    const time_point now = time_point::clock::now();
+    ozo::impl::queue_delay_controller controller {std::chrono::milliseconds(5), std::chrono::milliseconds(100)};
+
+    time_point at(int ms) const { return now + std::chrono::milliseconds(ms); }
+};
+
+TEST_F(queue_delay_controller, should_be_disabled_with_max_target) {
+    ozo::impl::queue_delay_controller disabled {ozo::time_traits::duration::max(), std::chrono::milliseconds(100)};
+    EXPECT_FALSE(disabled.enabled());
+    disabled.sample(std::chrono::seconds(10), at(200), true);
+    EXPECT_FALSE(disabled.overloaded(at(400), true));
+}
+
+TEST_F(queue_delay_controller, should_detect_overload_if_minimum_delay_exceeds_target_during_interval) {
+    controller.sample(std::chrono::milliseconds(50), at(200), true);
+    controller.sample(std::chrono::milliseconds(10), at(250), true);
+    EXPECT_TRUE(controller.overloaded(at(400), true));
+}
+
+TEST_F(queue_delay_controller, should_not_detect_overload_if_queue_was_drained_during_interval) {
+    controller.sample(std::chrono::milliseconds(50), at(200), true);
+    controller.sample(std::chrono::milliseconds(0), at(250), false);
+    EXPECT_FALSE(controller.overloaded(at(400), true));
+}
+
+TEST_F(queue_delay_controller, should_detect_overload_if_nothing_left_queue_during_interval) {
+    controller.overloaded(at(200), true);
+    EXPECT_TRUE(controller.overloaded(at(400), true));
+}
+
+TEST_F(queue_delay_controller, should_recover_after_interval_with_short_delays) {
+    controller.sample(std::chrono::milliseconds(50), at(200), true);
+    EXPECT_TRUE(controller.overloaded(at(400), true));
+    controller.sample(std::chrono::milliseconds(1), at(450), true);
+    EXPECT_FALSE(controller.overloaded(at(600), true));
+}
+
+struct pool_queue_with_load_shedding : pool_queue {
+    std::vector<error_code> errors;
+
+    void make_queue(std::size_t capacity) {
+        queue = std::make_shared<ozo::impl::pool_queue>(capacity, 100, 0, 2.0,
+            std::chrono::milliseconds(5), std::chrono::milliseconds(5));
+    }
+
+    void enter_tracked(int id) {
+        queue->enter(queue, io, 1, std::chrono::seconds(10), [this, id] (error_code ec, pool_slot slot) {
+            errors.push_back(ec);
+            if (!ec) {
+                served.push_back(id);
+                slots.push_back(std::move(slot));
+            }
+        });
+    }
+
+    void overload() {
+        enter(0);
+        enter_tracked(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        enter_tracked(2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+};
+
+TEST_F(pool_queue_with_load_shedding, should_serve_waiting_requests_in_fifo_order_without_overload) {
+    make_queue(1);
+    enter(1);
+    enter_tracked(2);
+    enter_tracked(3);
+    slots.clear();
+    io.poll();
+    io.restart();
+    EXPECT_THAT(served, ElementsAre(1, 2));
+}
+
+TEST_F(pool_queue_with_load_shedding, should_shed_stale_requests_and_serve_fresh_one_under_overload) {
+    make_queue(1);
+    overload();
+    enter_tracked(3);
+    slots.clear();
+    io.poll();
+    io.restart();
+    EXPECT_THAT(served, ElementsAre(0, 3));
+    EXPECT_THAT(errors, ElementsAre(error_code {ozo::error::pool_overloaded},
+        error_code {ozo::error::pool_overloaded}, error_code {}));
+}
+
+TEST_F(pool_queue_with_load_shedding, should_fail_fast_request_waiting_longer_than_target_under_overload) {
+    make_queue(1);
+    overload();
+    errors.clear();
+    enter_tracked(3);
+    io.run_for(std::chrono::milliseconds(50));
+    EXPECT_THAT(errors, Contains(error_code {ozo::error::pool_overloaded}));
+    EXPECT_THAT(served, ElementsAre(0));
+}
+
+} // namespace
@@ -0,0 +1,68 @@
+#include <ozo/impl/recycling_allocator.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+namespace {
+
+using namespace testing;
+
+using ozo::impl::block_cache;
+using ozo::impl::recycling_allocator;
+
+struct object {
+    int value;
+    explicit object(int value) : value(value) {}
+};
+
+TEST(recycling_allocator, should_keep_block_of_destroyed_object_in_cache) {
+    const auto cache = std::make_shared<block_cache>(2);
+    std::allocate_shared<object>(recycling_allocator<object> {cache}, 42);
+    EXPECT_EQ(cache->size(), 1u);
+}
+
+TEST(recycling_allocator, should_reuse_cached_block_for_next_object) {
+    const auto cache = std::make_shared<block_cache>(2);
+    const void* block = nullptr;
+    {
+        const auto ptr = std::allocate_shared<object>(recycling_allocator<object> {cache}, 42);
+        block = ptr.get();
+    }
+    const auto ptr = std::allocate_shared<object>(recycling_allocator<object> {cache}, 13);
+    EXPECT_EQ(ptr.get(), block);
+    EXPECT_EQ(ptr->value, 13);
+    EXPECT_EQ(cache->size(), 0u);
+}
+
+TEST(recycling_allocator, should_not_keep_more_blocks_than_limit) {
+    const auto cache = std::make_shared<block_cache>(1);
+    {
+        const recycling_allocator<object> allocator {cache};
+        const auto first = std::allocate_shared<object>(allocator, 1);
+        const auto second = std::allocate_shared<object>(allocator, 2);
+    }
+    EXPECT_EQ(cache->size(), 1u);
+}
+
+TEST(recycling_allocator, should_keep_cache_alive_while_object_exists) {
+    auto cache = std::make_shared<block_cache>(1);
+    const std::weak_ptr<block_cache> weak = cache;
+    auto ptr = std::allocate_shared<object>(recycling_allocator<object> {std::move(cache)}, 42);
+    EXPECT_FALSE(weak.expired());
+    ptr.reset();
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST(recycling_allocator, should_use_heap_without_cache) {
+    const auto ptr = std::allocate_shared<object>(recycling_allocator<object> {}, 42);
+    EXPECT_EQ(ptr->value, 42);
+}
+
+TEST(block_cache, should_not_cache_blocks_of_other_size) {
+    block_cache cache(2);
+    cache.deallocate(cache.allocate(16), 16);
+    cache.deallocate(cache.allocate(32), 32);
+    EXPECT_EQ(cache.size(), 1u);
+}
+
+} // namespace
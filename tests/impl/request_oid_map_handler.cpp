@@ -24,29 +24,43 @@ using ozo::error_code;
 
 struct connection_mock {
     MOCK_METHOD0(request_oid_map, void());
+    std::function<void(error_code, ozo::oid_t)> handler;
 };
 
 template <typename OidMap = empty_oid_map>
 struct connection_wrapper {
     connection_mock& mock_;
     OidMap oid_map_;
+    boost::asio::io_context* io_ = nullptr;
 
     friend OidMap& get_oid_map(connection_wrapper& conn) {
         return conn.oid_map_;
     }
 
+    friend boost::asio::io_context& get_io_context(connection_wrapper& conn) {
+        return *conn.io_;
+    }
+
     template <typename Handler>
-    friend void request_oid_map(connection_wrapper c, Handler&&) {
+    friend void request_oid_map(connection_wrapper c, Handler&& handler) {
         c.mock_.request_oid_map();
+        auto h = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+        c.mock_.handler = [c, h] (error_code ec, ozo::oid_t oid) mutable {
+            if (!ec) {
+                ozo::impl::set_oid_map(c.oid_map_, ozo::impl::oids_result {oid});
+            }
+            (*h)(ec, c);
+        };
     }
 };
 
 struct request_oid_map_handler : Test {
     StrictMock<connection_mock> connection{};
+    boost::asio::io_context io;
 
     template <typename OidMap>
     auto make_connection(OidMap oid_map) {
-        return connection_wrapper<OidMap>{connection, oid_map};
+        return connection_wrapper<OidMap>{connection, oid_map, std::addressof(io)};
     }
 
     template <typename Conn>
@@ -83,4 +97,152 @@ TEST_F(request_oid_map_handler, should_not_request_for_oid_when_oid_map_ist_empt
     ozo::impl::make_request_oid_map_handler(wrap(callback))(error_code{}, std::move(conn));
 }
 
+struct request_oid_map_handler_with_cache : request_oid_map_handler {
+    ozo::impl::oid_map_cache cache;
+};
+
+TEST_F(request_oid_map_handler_with_cache, should_request_for_oid_and_put_it_into_cache_when_cache_is_empty) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+    EXPECT_CALL(callback, call(error_code{}, _)).WillOnce(Invoke([] (error_code, auto conn) {
+        EXPECT_EQ(ozo::type_oid<custom_type>(conn.oid_map_), 42u);
+    }));
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+    connection.handler(error_code{}, 42);
+
+    ozo::impl::oid_map_cache::oids_type oids;
+    EXPECT_TRUE(cache.get("target", oids));
+    EXPECT_THAT(oids, ElementsAre(42u));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_not_put_oid_into_cache_when_request_failed) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+    EXPECT_CALL(callback, call(error_code{error::error}, _)).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+    connection.handler(error::error, 0);
+
+    ozo::impl::oid_map_cache::oids_type oids;
+    EXPECT_FALSE(cache.get("target", oids));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_not_request_for_oid_when_cache_contains_oid_for_target) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+    cache.put("target", {42});
+
+    EXPECT_CALL(callback, call(error_code{}, _)).WillOnce(Invoke([] (error_code, auto conn) {
+        EXPECT_EQ(ozo::type_oid<custom_type>(conn.oid_map_), 42u);
+    }));
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_request_for_oid_when_cache_contains_oid_for_other_target) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+    cache.put("other", {42});
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_request_for_oid_when_cache_is_invalidated) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+    cache.put("target", {42});
+    cache.invalidate("target");
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_request_for_oid_and_invalidate_cache_when_cached_oids_do_not_match_oid_map) {
+    auto conn = make_connection(ozo::register_types<custom_type>());
+    auto callback = make_callback(conn);
+    cache.put("target", {42, 43});
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(callback), cache, "target")(error_code{}, std::move(conn));
+
+    ozo::impl::oid_map_cache::oids_type oids;
+    EXPECT_FALSE(cache.get("target", oids));
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_not_request_for_oid_when_fill_for_target_is_pending_and_take_it_from_cache_after_fill) {
+    auto first = make_connection(ozo::register_types<custom_type>());
+    auto second = make_connection(ozo::register_types<custom_type>());
+    auto first_callback = make_callback(first);
+    auto second_callback = make_callback(second);
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(first_callback), cache, "target")(error_code{}, std::move(first));
+    ozo::impl::make_request_oid_map_handler(wrap(second_callback), cache, "target")(error_code{}, std::move(second));
+
+    EXPECT_CALL(first_callback, call(error_code{}, _)).WillOnce(Return());
+    connection.handler(error_code{}, 42);
+
+    EXPECT_CALL(second_callback, call(error_code{}, _)).WillOnce(Invoke([] (error_code, auto conn) {
+        EXPECT_EQ(ozo::type_oid<custom_type>(conn.oid_map_), 42u);
+    }));
+    io.poll();
+}
+
+TEST_F(request_oid_map_handler_with_cache, should_request_for_oid_by_waiting_connection_when_pending_fill_failed) {
+    auto first = make_connection(ozo::register_types<custom_type>());
+    auto second = make_connection(ozo::register_types<custom_type>());
+    auto first_callback = make_callback(first);
+    auto second_callback = make_callback(second);
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+
+    ozo::impl::make_request_oid_map_handler(wrap(first_callback), cache, "target")(error_code{}, std::move(first));
+    ozo::impl::make_request_oid_map_handler(wrap(second_callback), cache, "target")(error_code{}, std::move(second));
+
+    EXPECT_CALL(first_callback, call(error_code{error::error}, _)).WillOnce(Return());
+    connection.handler(error::error, 0);
+
+    EXPECT_CALL(connection, request_oid_map()).WillOnce(Return());
+    io.poll();
+
+    EXPECT_CALL(second_callback, call(error_code{}, _)).WillOnce(Return());
+    connection.handler(error_code{}, 42);
+
+    ozo::impl::oid_map_cache::oids_type oids;
+    EXPECT_TRUE(cache.get("target", oids));
+    EXPECT_THAT(oids, ElementsAre(42u));
+}
+
+TEST(oid_map_cache, should_resume_waiting_lookups_when_fill_is_dropped) {
+    struct waiter : ozo::impl::oid_map_cache::waiter {
+        int& resumed;
+        explicit waiter(int& resumed) : resumed(resumed) {}
+        void resume() override { ++resumed; }
+    };
+
+    ozo::impl::oid_map_cache cache;
+    ozo::impl::oid_map_cache::oids_type oids;
+    int resumed = 0;
+    const auto make_waiter = [&] { return std::make_unique<waiter>(resumed); };
+
+    EXPECT_EQ(cache.lookup("target", oids, make_waiter), ozo::impl::oid_map_cache::lookup_result::fill);
+    {
+        ozo::impl::oid_map_cache_fill fill {cache, "target"};
+        EXPECT_EQ(cache.lookup("target", oids, make_waiter), ozo::impl::oid_map_cache::lookup_result::wait);
+        EXPECT_EQ(resumed, 0);
+    }
+    EXPECT_EQ(resumed, 1);
+    EXPECT_EQ(cache.lookup("target", oids, make_waiter), ozo::impl::oid_map_cache::lookup_result::fill);
+}
+
 } // namespace
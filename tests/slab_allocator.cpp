@@ -0,0 +1,53 @@
+#include <ozo/core/slab_allocator.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <string>
+
+namespace {
+
+using namespace testing;
+
+TEST(slab_allocator, copies_should_be_equal) {
+    const ozo::slab_allocator<char> alloc;
+    const ozo::slab_allocator<int> copy(alloc);
+    EXPECT_TRUE(alloc == copy);
+    EXPECT_FALSE(alloc != copy);
+}
+
+TEST(slab_allocator, different_allocators_should_not_be_equal) {
+    EXPECT_TRUE(ozo::slab_allocator<char>{} != ozo::slab_allocator<char>{});
+}
+
+TEST(slab_allocator, allocate_should_return_adjacent_aligned_memory_from_slab) {
+    ozo::slab_allocator<char> alloc;
+    const auto c = alloc.allocate(1);
+    const auto i = ozo::slab_allocator<std::int64_t>(alloc).allocate(1);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(i) % alignof(std::int64_t), 0u);
+    EXPECT_EQ(reinterpret_cast<char*>(i) - c, std::ptrdiff_t(alignof(std::int64_t)));
+}
+
+TEST(slab_allocator, allocate_should_return_memory_for_blocks_bigger_than_slab) {
+    ozo::slab_allocator<char> alloc(16);
+    const auto p = alloc.allocate(1024);
+    std::fill(p, p + 1024, 'a');
+    EXPECT_EQ(p[1023], 'a');
+}
+
+TEST(slab_allocator, allocate_should_throw_bad_alloc_for_overaligned_type) {
+    struct alignas(2 * alignof(std::max_align_t)) overaligned {};
+    ozo::slab_allocator<overaligned> alloc;
+    EXPECT_THROW(alloc.allocate(1), std::bad_alloc);
+}
+
+TEST(slab_allocator, shared_ptr_should_keep_memory_alive_after_allocator_destruction) {
+    std::shared_ptr<std::string> ptr;
+    {
+        ozo::slab_allocator<char> alloc;
+        ptr = std::allocate_shared<std::string>(alloc, "text");
+    }
+    EXPECT_EQ(*ptr, "text");
+}
+
+} // namespace
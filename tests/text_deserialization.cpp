@@ -0,0 +1,131 @@
+#include "result_mock.h"
+
+#include <ozo/io/array.h>
+#include <ozo/io/recv.h>
+#include <ozo/ext/std.h>
+#include <ozo/ext/boost.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <clocale>
+#include <iostream>
+
+namespace {
+
+using namespace testing;
+using namespace ozo::tests;
+
+struct recv_text : Test {
+    ozo::empty_oid_map oid_map{};
+    StrictMock<pg_result_mock> mock{};
+    ozo::value<pg_result_mock> value{{&mock, 0, 0}};
+
+    void expect_value(ozo::oid_t oid, std::string_view text) {
+        EXPECT_CALL(mock, field_format(_)).WillRepeatedly(Return(ozo::impl::result_format::text));
+        EXPECT_CALL(mock, field_type(_)).WillRepeatedly(Return(oid));
+        EXPECT_CALL(mock, get_value(_, _)).WillRepeatedly(Return(text.data()));
+        EXPECT_CALL(mock, get_length(_, _)).WillRepeatedly(Return(text.size()));
+        EXPECT_CALL(mock, get_isnull(_, _)).WillRepeatedly(Return(false));
+    }
+};
+
+TEST_F(recv_text, should_convert_BOOLOID_to_bool) {
+    expect_value(BOOLOID, "t");
+    bool got = false;
+    ozo::recv(value, oid_map, got);
+    EXPECT_TRUE(got);
+}
+
+TEST_F(recv_text, should_convert_INT4OID_to_int32_t) {
+    expect_value(INT4OID, "-42");
+    int32_t got = 0;
+    ozo::recv(value, oid_map, got);
+    EXPECT_EQ(got, -42);
+}
+
+TEST_F(recv_text, should_convert_INT8OID_to_int64_t) {
+    expect_value(INT8OID, "9223372036854775807");
+    int64_t got = 0;
+    ozo::recv(value, oid_map, got);
+    EXPECT_EQ(got, std::numeric_limits<int64_t>::max());
+}
+
+TEST_F(recv_text, should_throw_on_out_of_range_integer) {
+    expect_value(INT2OID, "32768");
+    int16_t got = 0;
+    EXPECT_THROW(ozo::recv(value, oid_map, got), std::invalid_argument);
+}
+
+TEST_F(recv_text, should_throw_on_malformed_integer) {
+    expect_value(INT4OID, "4x2");
+    int32_t got = 0;
+    EXPECT_THROW(ozo::recv(value, oid_map, got), std::invalid_argument);
+}
+
+TEST_F(recv_text, should_convert_FLOAT8OID_to_double) {
+    expect_value(FLOAT8OID, "42.13");
+    double got = 0;
+    ozo::recv(value, oid_map, got);
+    EXPECT_DOUBLE_EQ(got, 42.13);
+}
+
+struct scoped_comma_decimal_locale {
+    std::string previous = std::setlocale(LC_NUMERIC, nullptr);
+    bool set = false;
+
+    scoped_comma_decimal_locale() {
+        for (const auto name : {"de_DE.UTF-8", "ru_RU.UTF-8", "fr_FR.UTF-8", "de_DE", "ru_RU", "fr_FR"}) {
+            if (std::setlocale(LC_NUMERIC, name) && *std::localeconv()->decimal_point == ',') {
+                set = true;
+                break;
+            }
+        }
+    }
+
+    ~scoped_comma_decimal_locale() {
+        std::setlocale(LC_NUMERIC, previous.c_str());
+    }
+};
+
+TEST_F(recv_text, should_convert_FLOAT8OID_to_double_with_comma_decimal_locale) {
+    const scoped_comma_decimal_locale locale;
+    if (!locale.set) {
+        std::cout << "no locale with comma decimal separator is available, the test is skipped" << std::endl;
+        return;
+    }
+    expect_value(FLOAT8OID, "42.13");
+    double got = 0;
+    ozo::recv(value, oid_map, got);
+    EXPECT_DOUBLE_EQ(got, 42.13);
+}
+
+TEST_F(recv_text, should_convert_TEXTOID_to_std_string) {
+    expect_value(TEXTOID, "test");
+    std::string got;
+    ozo::recv(value, oid_map, got);
+    EXPECT_EQ(got, "test");
+}
+
+TEST_F(recv_text, should_convert_BYTEAOID_in_hex_format_to_pg_bytea) {
+    expect_value(BYTEAOID, "\\x00ff7A");
+    ozo::pg::bytea got;
+    ozo::recv(value, oid_map, got);
+    EXPECT_THAT(got.get(), ElementsAre(0x00, char(0xff), 0x7a));
+}
+
+TEST_F(recv_text, should_reset_nullable_on_null_value) {
+    expect_value(INT4OID, "");
+    EXPECT_CALL(mock, get_isnull(_, _)).WillRepeatedly(Return(true));
+    boost::optional<int32_t> got = 42;
+    ozo::recv(value, oid_map, got);
+    EXPECT_FALSE(got);
+}
+
+TEST_F(recv_text, should_throw_for_type_without_text_format_support) {
+    expect_value(INT4ARRAYOID, "{1,2,3}");
+    std::vector<int32_t> got;
+    EXPECT_THROW(ozo::recv(value, oid_map, got), std::invalid_argument);
+}
+
+} // namespace